@@ -0,0 +1,244 @@
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Kernel search benchmark and regression check
+//
+// Runs every kernel scanner on the same synthetic kernels for a range of
+// targets and coin values, checks that they agree with each other and
+// prints hashes per second for each of them. A machine-readable summary,
+// one JSON object per line, goes to stdout, the human-readable table goes
+// to stderr.
+//
+// Usage: bench_kernel [-days=<n>] [-inputs=<n>] [-threads=<n,n,...>] [-seed=<n>] [-checkarith]
+//
+// -checkarith cross-checks all target arithmetic against bignums, which
+// makes hash rates meaningless but covers the fixed-width code as well.
+// Exit code is non-zero if any of the scanners disagree.
+
+#include "kernel.h"
+#include "kernel_worker.h"
+#include "sha256.h"
+#include "util.h"
+
+#include <chrono>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+// Chain parameters used by the kernel code, normally defined in main.cpp
+unsigned int nStakeMinAge = 30 * nOneDay;
+unsigned int nStakeMaxAge = 90 * nOneDay;
+
+// Mismatches of the target arithmetic cross-check are counted
+//   instead of aborting the benchmark
+bool fCheckTargetArith = false;
+static atomic<uint64_t> nArithMismatches(0);
+
+void CheckTargetArith(bool fMatch, const char* pszFunction)
+{
+    if (!fMatch && nArithMismatches++ == 0)
+        fprintf(stderr, "%s : fixed-width target arithmetic doesn't match bignum result\n", pszFunction);
+}
+
+struct BenchKernel
+{
+    unsigned char kernel[KernelScan::KERNEL_SIZE];
+    uint32_t nInputTxTime;
+};
+
+struct BenchCase
+{
+    uint32_t nBits;
+    int64_t nValueIn;
+};
+
+typedef vector<KernelScanSolution> Solutions;
+
+static double SecondsSince(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// One line of the summary
+static void Report(const char* pszVariant, const BenchCase& bench, unsigned int nThreads, uint64_t nHashes, double dSeconds, size_t nSolutions, bool fMatch)
+{
+    double dRate = dSeconds > 0 ? nHashes / dSeconds : 0;
+    fprintf(stderr, "%-10s nBits=%08x value=%-12s threads=%-3u %10.3f Mhash/s %6zu solutions %s\n",
+        pszVariant, bench.nBits, FormatMoney(bench.nValueIn).c_str(), nThreads, dRate / 1e6, nSolutions, fMatch ? "ok" : "MISMATCH");
+    fprintf(stdout, "{\"variant\":\"%s\",\"impl\":\"%s\",\"nbits\":\"%08x\",\"value\":%" PRId64 ",\"threads\":%u,\"hashes\":%" PRIu64 ",\"seconds\":%.6f,\"hashrate\":%.0f,\"solutions\":%zu,\"match\":%s}\n",
+        pszVariant, sha256_kernel_impl(), bench.nBits, bench.nValueIn, nThreads, nHashes, dSeconds, dRate, nSolutions, fMatch ? "true" : "false");
+}
+
+static bool SameSolutions(const Solutions& a, const Solutions& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].nTime != b[i].nTime || a[i].nInput != b[i].nInput || a[i].hashProofOfStake != b[i].hashProofOfStake)
+            return false;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+
+    int nDays = GetArgInt("-days", 2);
+    int nInputs = GetArgInt("-inputs", 4);
+    uint64_t nSeed = GetArg("-seed", 1);
+    fCheckTargetArith = GetBoolArg("-checkarith");
+
+    vector<unsigned int> vThreads;
+    {
+        string strThreads = GetArg("-threads", "");
+        if (strThreads.empty())
+        {
+            unsigned int nCores = max(thread::hardware_concurrency(), 1u);
+            for (unsigned int n = 1; n < nCores; n *= 2)
+                vThreads.push_back(n);
+            vThreads.push_back(nCores);
+        }
+        else
+        {
+            istringstream ss(strThreads);
+            string str;
+            while (getline(ss, str, ','))
+                if (atoi(str) > 0)
+                    vThreads.push_back(atoi(str));
+        }
+    }
+
+    if (nDays <= 0 || nInputs <= 0 || vThreads.empty())
+    {
+        fprintf(stderr, "Usage: bench_kernel [-days=<n>] [-inputs=<n>] [-threads=<n,n,...>] [-seed=<n>] [-checkarith]\n");
+        return 2;
+    }
+
+    // Hash with the implementations the node would pick on this CPU,
+    //   sha256_kernel_impl() only reports the default before this
+    string strSHA256Impl = SHA256AutoDetect();
+    if (!SHA256SelfTest())
+    {
+        fprintf(stderr, "SHA256 self-test failed for %s\n", strSHA256Impl.c_str());
+        return 1;
+    }
+    fprintf(stderr, "SHA256 implementation: %s\n", strSHA256Impl.c_str());
+
+    // Synthetic kernels, all of them old enough to have full weight at the
+    //   end of the interval and some weight at its beginning
+    uint32_t nIntervalBegin = 1500000000;
+    uint32_t nIntervalEnd = nIntervalBegin + nDays * nOneDay;
+    mt19937_64 rng(nSeed);
+    vector<BenchKernel> vKernels(nInputs);
+    for (auto& kernel : vKernels)
+    {
+        for (auto& ch : kernel.kernel)
+            ch = (unsigned char)rng();
+        kernel.nInputTxTime = nIntervalBegin - nStakeMinAge - (uint32_t)(rng() % (nStakeMaxAge - nStakeMinAge));
+    }
+
+    // Targets from the proof-of-stake limit down to harder ones, small and large coins
+    const uint32_t vBits[] = { 0x1e00ffff, 0x1d3fffff, 0x1d0fffff };
+    const int64_t vValues[] = { 10 * COIN, 1000 * COIN, 100000 * COIN };
+
+    fprintf(stderr, "Kernel hashing: %s, %d inputs, %d days\n", sha256_kernel_impl(), nInputs, nDays);
+
+    bool fAllMatch = true;
+    for (uint32_t nBits : vBits)
+    {
+        for (int64_t nValueIn : vValues)
+        {
+            BenchCase bench = { nBits, nValueIn };
+            uint64_t nHashes = (uint64_t)nInputs * (nIntervalEnd - nIntervalBegin);
+
+            // Reference: one KernelWorker per input over the whole interval
+            Solutions vReference;
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < nInputs; i++)
+            {
+                KernelWorker worker(vKernels[i].kernel, nBits, vKernels[i].nInputTxTime, nValueIn, nIntervalBegin, nIntervalEnd);
+                worker.Do();
+                for (const auto& solution : worker.GetSolutions())
+                {
+                    KernelScanSolution item;
+                    item.nTime = solution.second;
+                    item.hashProofOfStake = solution.first;
+                    item.nInput = i;
+                    vReference.push_back(item);
+                }
+            }
+            sort(vReference.begin(), vReference.end());
+            Report("worker", bench, 1, nHashes, SecondsSince(start), vReference.size(), true);
+
+            // ScanKernelForward, one input at a time
+            Solutions vForward;
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < nInputs; i++)
+            {
+                pair<uint32_t, uint32_t> interval(nIntervalBegin, nIntervalEnd);
+                vector<pair<uint256, uint32_t> > result;
+                ScanKernelForward(vKernels[i].kernel, nBits, vKernels[i].nInputTxTime, nValueIn, interval, result);
+                for (const auto& solution : result)
+                {
+                    KernelScanSolution item;
+                    item.nTime = solution.second;
+                    item.hashProofOfStake = solution.first;
+                    item.nInput = i;
+                    vForward.push_back(item);
+                }
+            }
+            sort(vForward.begin(), vForward.end());
+            bool fMatch = SameSolutions(vForward, vReference);
+            fAllMatch &= fMatch;
+            Report("forward", bench, max(thread::hardware_concurrency(), 1u), nHashes, SecondsSince(start), vForward.size(), fMatch);
+
+            // KernelScan over all inputs at once, thread scaling
+            for (unsigned int nThreads : vThreads)
+            {
+                shared_ptr<KernelScan> scan = make_shared<KernelScan>(nBits, nIntervalBegin, nIntervalEnd);
+                for (const auto& kernel : vKernels)
+                    scan->AddInput(kernel.kernel, kernel.nInputTxTime, nValueIn);
+                start = chrono::steady_clock::now();
+                scan->Start(nThreads);
+                scan->Wait();
+                double dSeconds = SecondsSince(start);
+                Solutions vScan = scan->GetSolutions();
+                fMatch = SameSolutions(vScan, vReference);
+                fAllMatch &= fMatch;
+                Report("scan", bench, nThreads, nHashes, dSeconds, vScan.size(), fMatch);
+            }
+
+            // ScanKernelBackward stops at the latest solution of each input,
+            //   which must be the last one found by the reference scan
+            uint64_t nBackwardHashes = 0;
+            size_t nBackwardSolutions = 0;
+            fMatch = true;
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < nInputs; i++)
+            {
+                pair<uint32_t, uint32_t> interval(nIntervalEnd - 1, nIntervalBegin - 1);
+                pair<uint256, uint32_t> solution;
+                bool fFound = ScanKernelBackward(vKernels[i].kernel, nBits, vKernels[i].nInputTxTime, nValueIn, interval, solution);
+
+                const KernelScanSolution* pLast = NULL;
+                for (const auto& item : vReference)
+                    if (item.nInput == i)
+                        pLast = &item;
+
+                if (fFound != (pLast != NULL) || (fFound && (solution.second != pLast->nTime || solution.first != pLast->hashProofOfStake)))
+                    fMatch = false;
+                nBackwardHashes += fFound ? nIntervalEnd - solution.second : nIntervalEnd - nIntervalBegin;
+                nBackwardSolutions += fFound;
+            }
+            fAllMatch &= fMatch;
+            Report("backward", bench, 1, nBackwardHashes, SecondsSince(start), nBackwardSolutions, fMatch);
+        }
+    }
+
+    if (nArithMismatches > 0)
+        fprintf(stderr, "%" PRIu64 " target arithmetic mismatches\n", nArithMismatches.load());
+    fprintf(stderr, "%s\n", fAllMatch && nArithMismatches == 0 ? "All scanners agree" : "FAILED: scanners disagree");
+
+    return fAllMatch && nArithMismatches == 0 ? 0 : 1;
+}
@@ -236,10 +236,15 @@ static const CRPCCommand vRPCCommands[] =
     { "addnode",                    &addnode,                     true,   true  },
     { "getaddednodeinfo",           &getaddednodeinfo,            true,   true  },
     { "getdifficulty",              &getdifficulty,               true,   false },
+    { "getcacheinfo",               &getcacheinfo,                true,   false },
     { "getinfo",                    &getinfo,                     true,   false },
     { "getsubsidy",                 &getsubsidy,                  true,   false },
-    { "getmininginfo",              &getmininginfo,               true,   false },
+    { "getmininginfo",              &getmininginfo,               true,   true  },
+    { "setgenerate",                &setgenerate,                 true,   true  },
+    { "getmintingforecast",         &getmintingforecast,          true,   false },
     { "scaninput",                  &scaninput,                   true,   true },
+    { "getscanresult",              &getscanresult,               true,   true },
+    { "cancelscan",                 &cancelscan,                  true,   true },
     { "getnewaddress",              &getnewaddress,               true,   false },
     { "getnettotals",               &getnettotals,                true,   true  },
     { "ntptime",                    &ntptime,                     true,   true  },
@@ -744,7 +749,12 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "getblocktemplate"       && n > 0) ConvertTo<Object>(params[0]);
     if (strMethod == "listsinceblock"         && n > 1) ConvertTo<int64_t>(params[1]);
 
+    if (strMethod == "setgenerate"            && n > 0) ConvertTo<bool>(params[0]);
+    if (strMethod == "setgenerate"            && n > 1) ConvertTo<int64_t>(params[1]);
+    if (strMethod == "getmintingforecast"     && n > 0) ConvertTo<int64_t>(params[0]);
     if (strMethod == "scaninput"              && n > 0) ConvertTo<Object>(params[0]);
+    if (strMethod == "getscanresult"          && n > 0) ConvertTo<int64_t>(params[0]);
+    if (strMethod == "cancelscan"             && n > 0) ConvertTo<int64_t>(params[0]);
 
     if (strMethod == "sendalert"              && n > 2) ConvertTo<int64_t>(params[2]);
     if (strMethod == "sendalert"              && n > 3) ConvertTo<int64_t>(params[3]);
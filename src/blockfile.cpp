@@ -0,0 +1,346 @@
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfile.h"
+#include "util.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+using namespace std;
+
+CBlockFilePool blockFilePool;
+
+namespace {
+
+// Read buffer shared by the readers of a thread, a nested reader
+// falls back to a buffer of its own
+struct CThreadReadBuffer
+{
+    vector<char> vch;
+    bool fInUse;
+
+    CThreadReadBuffer() : fInUse(false) { }
+};
+
+thread_local CThreadReadBuffer threadReadBuffer;
+
+// Don't keep more than this per thread after a read of a huge block
+const size_t MAX_KEPT_READ_BUFFER = 2 * 1024 * 1024;
+
+}
+
+boost::filesystem::path GetBlockFilePath(unsigned int nFile)
+{
+    string strBlockFn = strprintf("blk%04u.dat", nFile);
+    return GetDataDir() / strBlockFn;
+}
+
+CBlockFileHandle::CBlockFileHandle(int fdIn, bool fMap) : fd(fdIn), pMap(NULL), nMapSize(0)
+{
+#ifdef WIN32
+    hMapping = NULL;
+    if (!fMap)
+        return;
+    int64_t nSize = _filelengthi64(fd);
+    if (nSize <= 0)
+        return;
+    hMapping = CreateFileMappingA((HANDLE)_get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping)
+        return;
+    void* p = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!p)
+    {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+        return;
+    }
+#else
+    if (!fMap)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        return;
+    int64_t nSize = st.st_size;
+    void* p = mmap(NULL, (size_t)nSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return;
+#endif
+    pMap = (const char*)p;
+    nMapSize = (uint64_t)nSize;
+}
+
+CBlockFileHandle::~CBlockFileHandle()
+{
+#ifdef WIN32
+    if (pMap)
+    {
+        UnmapViewOfFile(pMap);
+        CloseHandle(hMapping);
+    }
+    _close(fd);
+#else
+    if (pMap)
+        munmap((void*)pMap, (size_t)nMapSize);
+    close(fd);
+#endif
+}
+
+int64_t CBlockFileHandle::ReadAt(char* pch, size_t nSize, uint64_t nPos) const
+{
+#ifdef WIN32
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)nPos;
+    overlapped.OffsetHigh = (DWORD)(nPos >> 32);
+    DWORD nRead = 0;
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), pch, (DWORD)nSize, &nRead, &overlapped))
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    return nRead;
+#else
+    for ( ; ; )
+    {
+        ssize_t nRead = pread(fd, pch, nSize, (off_t)nPos);
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        return nRead;
+    }
+#endif
+}
+
+void CBlockFilePool::Drop(unsigned int nFile)
+{
+    map<unsigned int, list_type::iterator>::iterator mi = mapHandles.find(nFile);
+    if (mi != mapHandles.end())
+    {
+        lruHandles.erase(mi->second);
+        mapHandles.erase(mi);
+    }
+}
+
+void CBlockFilePool::Trim()
+{
+    while (lruHandles.size() > nMaxOpen)
+    {
+        mapHandles.erase(lruHandles.back().first);
+        lruHandles.pop_back();
+    }
+}
+
+shared_ptr<CBlockFileHandle> CBlockFilePool::Get(unsigned int nFile)
+{
+    if ((nFile < 1) || (nFile == numeric_limits<uint32_t>::max()))
+        return shared_ptr<CBlockFileHandle>();
+
+    bool fMap;
+    {
+        LOCK(cs);
+        map<unsigned int, list_type::iterator>::iterator mi = mapHandles.find(nFile);
+        if (mi != mapHandles.end())
+        {
+            lruHandles.splice(lruHandles.begin(), lruHandles, mi->second);
+            return mi->second->second;
+        }
+        fMap = fMapFiles && nFile != nWriteFile;
+    }
+
+    // Open outside of the lock, another thread may race us to it
+#ifdef WIN32
+    int fd = _open(GetBlockFilePath(nFile).string().c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(GetBlockFilePath(nFile).string().c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd < 0)
+        return shared_ptr<CBlockFileHandle>();
+    shared_ptr<CBlockFileHandle> handle(new CBlockFileHandle(fd, fMap));
+
+    LOCK(cs);
+    map<unsigned int, list_type::iterator>::iterator mi = mapHandles.find(nFile);
+    if (mi != mapHandles.end())
+    {
+        lruHandles.splice(lruHandles.begin(), lruHandles, mi->second);
+        return mi->second->second;
+    }
+
+    // Don't keep a mapping of the file which became the write file meanwhile
+    if (handle->IsMapped() && nFile == nWriteFile)
+        return handle;
+
+    lruHandles.push_front(make_pair(nFile, handle));
+    mapHandles[nFile] = lruHandles.begin();
+    Trim();
+    return handle;
+}
+
+void CBlockFilePool::SetWriteFile(unsigned int nFile)
+{
+    LOCK(cs);
+    if (nFile == nWriteFile)
+        return;
+
+    // Reopen both files on their next use, the finished one gets mapped
+    // and the new one must not stay mapped at its old size
+    Drop(nWriteFile);
+    Drop(nFile);
+    nWriteFile = nFile;
+}
+
+void CBlockFilePool::SetMaxOpen(unsigned int nMaxOpenIn)
+{
+    LOCK(cs);
+    nMaxOpen = max(1u, nMaxOpenIn);
+    Trim();
+}
+
+void CBlockFilePool::SetMapFiles(bool fMapFilesIn)
+{
+    LOCK(cs);
+    if (fMapFiles == fMapFilesIn)
+        return;
+    fMapFiles = fMapFilesIn;
+    mapHandles.clear();
+    lruHandles.clear();
+}
+
+void CBlockFilePool::CloseAll()
+{
+    LOCK(cs);
+    mapHandles.clear();
+    lruHandles.clear();
+}
+
+CBlockFileReader::CBlockFileReader(unsigned int nFile, uint64_t nPos, int nTypeIn, int nVersionIn, size_t nReadAheadIn) :
+    handle(blockFilePool.Get(nFile)), pvch(&vchOwn), fThreadBuffer(false),
+    nBufPos(nPos), nBufSize(0), nReadPos(nPos), nReadAhead(nReadAheadIn),
+    nType(nTypeIn), nVersion(nVersionIn)
+{
+    if (!threadReadBuffer.fInUse)
+    {
+        threadReadBuffer.fInUse = true;
+        fThreadBuffer = true;
+        pvch = &threadReadBuffer.vch;
+    }
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    if (fThreadBuffer)
+    {
+        if (pvch->size() > MAX_KEPT_READ_BUFFER)
+            vector<char>().swap(*pvch);
+        threadReadBuffer.fInUse = false;
+    }
+}
+
+void CBlockFileReader::Fill(size_t nSize)
+{
+    if (!handle)
+        throw ios_base::failure("CBlockFileReader::Fill : file handle is NULL");
+
+    // Keep the unread part of the buffer and append the rest to it
+    size_t nKeep = 0;
+    if (nReadPos >= nBufPos && nReadPos < nBufPos + nBufSize)
+    {
+        nKeep = (size_t)(nBufPos + nBufSize - nReadPos);
+        if (nKeep >= nSize)
+            return;
+        memmove(&(*pvch)[0], &(*pvch)[nReadPos - nBufPos], nKeep);
+    }
+    nBufPos = nReadPos;
+    nBufSize = nKeep;
+
+    size_t nWant = max(nSize, nReadAhead) - nKeep;
+    if (pvch->size() < nKeep + nWant)
+        pvch->resize(nKeep + nWant);
+
+    int64_t nRead = handle->ReadAt(&(*pvch)[nKeep], nWant, nBufPos + nKeep);
+    if (nRead < 0)
+        throw ios_base::failure("CBlockFileReader::Fill : read failed");
+    if (nRead == 0)
+        throw ios_base::failure("CBlockFileReader::Fill : end of file");
+    nBufSize += (size_t)nRead;
+}
+
+void CBlockFileReader::Reserve(size_t nSize)
+{
+    if (handle && handle->GetMapped(nReadPos, nSize))
+        return;
+    Fill(nSize);
+}
+
+CBlockFileReader& CBlockFileReader::read(char* pch, size_t nSize)
+{
+    // Copy straight from the mapped pages, reads past the mapped size of
+    // the file fall through to the buffer
+    if (handle)
+    {
+        const char* pMapped = handle->GetMapped(nReadPos, nSize);
+        if (pMapped)
+        {
+            memcpy(pch, pMapped, nSize);
+            nReadPos += nSize;
+            return (*this);
+        }
+    }
+
+    while (nSize > 0)
+    {
+        if (nReadPos < nBufPos || nReadPos >= nBufPos + nBufSize)
+            Fill(nSize);
+        size_t nNow = min(nSize, (size_t)(nBufPos + nBufSize - nReadPos));
+        memcpy(pch, &(*pvch)[nReadPos - nBufPos], nNow);
+        nReadPos += nNow;
+        pch += nNow;
+        nSize -= nNow;
+    }
+    return (*this);
+}
+
+bool CBlockFileBytes::Read(unsigned int nFile, uint64_t nPos, size_t nSizeIn)
+{
+    clear();
+    handle = blockFilePool.Get(nFile);
+    if (!handle)
+        return false;
+
+    pbegin = handle->GetMapped(nPos, nSizeIn);
+    if (!pbegin)
+    {
+        vch.resize(nSizeIn);
+        size_t nDone = 0;
+        while (nDone < nSizeIn)
+        {
+            int64_t nRead = handle->ReadAt(&vch[nDone], nSizeIn - nDone, nPos + nDone);
+            if (nRead <= 0)
+            {
+                clear();
+                return false;
+            }
+            nDone += (size_t)nRead;
+        }
+        pbegin = nSizeIn ? &vch[0] : NULL;
+    }
+    nSize = nSizeIn;
+    return true;
+}
+
+void CBlockFileBytes::clear()
+{
+    handle.reset();
+    vector<char>().swap(vch);
+    pbegin = NULL;
+    nSize = 0;
+}
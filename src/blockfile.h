@@ -0,0 +1,191 @@
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_BLOCKFILE_H
+#define NOVACOIN_BLOCKFILE_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <boost/filesystem/path.hpp>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Number of block files kept open for reading
+static const unsigned int DEFAULT_MAX_OPEN_BLOCK_FILES = 8;
+
+// Bytes fetched by a single read when the object size is unknown
+static const unsigned int BLOCKFILE_READ_AHEAD = 4096;
+
+boost::filesystem::path GetBlockFilePath(unsigned int nFile);
+
+/** Read-only descriptor of a blkNNNN.dat file.
+ *
+ * Reads are positional and never touch a shared file offset, so one
+ * handle may be used by any number of threads at once. A file which
+ * isn't appended to anymore may also be mapped into memory as a whole,
+ * the mapping lives as long as the handle.
+ */
+class CBlockFileHandle
+{
+private:
+    int fd;
+    const char* pMap;
+    uint64_t nMapSize;
+#ifdef WIN32
+    void* hMapping;
+#endif
+
+public:
+    CBlockFileHandle(int fdIn, bool fMap);
+    ~CBlockFileHandle();
+
+    // Read up to nSize bytes at nPos, returns the number of bytes read,
+    //   0 at the end of file or -1 on error
+    int64_t ReadAt(char* pch, size_t nSize, uint64_t nPos) const;
+
+    // Mapped bytes at [nPos, nPos + nSize), NULL if that range isn't mapped
+    const char* GetMapped(uint64_t nPos, uint64_t nSize) const
+    {
+        if (!pMap || nPos > nMapSize || nSize > nMapSize - nPos)
+            return NULL;
+        return pMap + nPos;
+    }
+
+    bool IsMapped() const { return pMap != NULL; }
+
+private:
+    CBlockFileHandle(const CBlockFileHandle&);
+    CBlockFileHandle& operator=(const CBlockFileHandle&);
+};
+
+/** Bounded pool of open block file handles.
+ *
+ * The least recently used handle is dropped when the pool is full.
+ * Readers hold a shared pointer, so a dropped handle is only closed
+ * after the last read through it has finished.
+ *
+ * When mapping is enabled, files other than the one blocks are being
+ * appended to are opened mapped.
+ */
+class CBlockFilePool
+{
+private:
+    typedef std::list<std::pair<unsigned int, std::shared_ptr<CBlockFileHandle> > > list_type;
+
+    mutable CCriticalSection cs;
+    list_type lruHandles;
+    std::map<unsigned int, list_type::iterator> mapHandles;
+    unsigned int nMaxOpen;
+    unsigned int nWriteFile;
+    bool fMapFiles;
+
+    void Drop(unsigned int nFile);
+    void Trim();
+
+public:
+    // Only map on 64-bit systems, block files take up to 2 GB each
+    CBlockFilePool() : nMaxOpen(DEFAULT_MAX_OPEN_BLOCK_FILES), nWriteFile(0), fMapFiles(sizeof(void*) >= 8) { }
+
+    // Returns an empty pointer if the file doesn't exist or can't be opened
+    std::shared_ptr<CBlockFileHandle> Get(unsigned int nFile);
+
+    // Tell which file blocks are appended to, the previous one is
+    //   finished and gets mapped on its next use
+    void SetWriteFile(unsigned int nFile);
+
+    void SetMaxOpen(unsigned int nMaxOpenIn);
+    void SetMapFiles(bool fMapFilesIn);
+    void CloseAll();
+};
+
+extern CBlockFilePool blockFilePool;
+
+/** Stored bytes of a block file range.
+ *
+ * Points straight into the mapped file when possible, otherwise the
+ * bytes are read into a buffer of its own. Holds the file handle, so
+ * the bytes stay valid while this object lives.
+ */
+class CBlockFileBytes
+{
+private:
+    std::shared_ptr<CBlockFileHandle> handle;
+    std::vector<char> vch;
+    const char* pbegin;
+    size_t nSize;
+
+public:
+    CBlockFileBytes() : pbegin(NULL), nSize(0) { }
+
+    bool Read(unsigned int nFile, uint64_t nPos, size_t nSizeIn);
+    void clear();
+
+    const char* begin() const   { return pbegin; }
+    const char* end() const     { return pbegin + nSize; }
+    size_t size() const         { return nSize; }
+    bool empty() const          { return nSize == 0; }
+    bool IsMapped() const       { return nSize != 0 && vch.empty(); }
+
+private:
+    CBlockFileBytes(const CBlockFileBytes&);
+    CBlockFileBytes& operator=(const CBlockFileBytes&);
+};
+
+/** Unserialization stream reading a block file through the handle pool.
+ *
+ * A mapped file is read as a span of its pages, objects are unserialized
+ * from them without any intermediate copy. Otherwise data is fetched
+ * with positional reads into a buffer which is reused by all readers of
+ * the calling thread. Bytes past the current position are read ahead,
+ * so a whole transaction or block usually needs one read.
+ */
+class CBlockFileReader
+{
+private:
+    std::shared_ptr<CBlockFileHandle> handle;
+    std::vector<char> vchOwn;
+    std::vector<char>* pvch;
+    bool fThreadBuffer;
+
+    uint64_t nBufPos;   // file position of the first buffered byte
+    size_t nBufSize;    // number of buffered bytes
+    uint64_t nReadPos;  // file position of the next byte to return
+    size_t nReadAhead;
+
+    void Fill(size_t nSize);
+
+public:
+    int nType;
+    int nVersion;
+
+    CBlockFileReader(unsigned int nFile, uint64_t nPos, int nTypeIn, int nVersionIn, size_t nReadAheadIn=BLOCKFILE_READ_AHEAD);
+    ~CBlockFileReader();
+
+    bool operator!() const       { return !handle; }
+    uint64_t GetPos() const      { return nReadPos; }
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+
+    // Make sure the next nSize bytes are available, one read at most
+    void Reserve(size_t nSize);
+
+    CBlockFileReader& read(char* pch, size_t nSize);
+
+    template<typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+private:
+    CBlockFileReader(const CBlockFileReader&);
+    CBlockFileReader& operator=(const CBlockFileReader&);
+};
+
+#endif // NOVACOIN_BLOCKFILE_H
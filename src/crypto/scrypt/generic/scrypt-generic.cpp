@@ -138,3 +138,14 @@ uint256 scrypt_blockhash(const uint8_t* input)
 
     return result;
 }
+
+void scrypt_blockhash_batch(const uint8_t* input, uint256* output, size_t nCount)
+{
+    for (size_t n = 0; n < nCount; n++)
+        output[n] = scrypt_blockhash(input + 80 * n);
+}
+
+const char* scrypt_batch_impl()
+{
+    return "generic";
+}
@@ -0,0 +1,92 @@
+/*
+ * Eight lane AVX2 scrypt core: every 32-bit lane of a register belongs to
+ * a different hash. This file is compiled with AVX2 code generation enabled
+ * and is only called after the CPU support has been checked at runtime.
+ */
+
+#include <immintrin.h>
+#include <stdint.h>
+
+static inline __m256i R(__m256i a, int b)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(a, b), _mm256_srli_epi32(a, 32 - b));
+}
+
+static inline void xor_salsa8_avx2(__m256i B[16], const __m256i Bx[16])
+{
+    __m256i x[16];
+    for (int i = 0; i < 16; i++)
+        x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+
+#define ADD(a, b) _mm256_add_epi32(a, b)
+#define XOR(a, b) a = _mm256_xor_si256(a, b)
+    for (int i = 0; i < 8; i += 2) {
+        /* Operate on columns. */
+        XOR(x[ 4], R(ADD(x[ 0], x[12]), 7));  XOR(x[ 9], R(ADD(x[ 5], x[ 1]), 7));
+        XOR(x[14], R(ADD(x[10], x[ 6]), 7));  XOR(x[ 3], R(ADD(x[15], x[11]), 7));
+
+        XOR(x[ 8], R(ADD(x[ 4], x[ 0]), 9));  XOR(x[13], R(ADD(x[ 9], x[ 5]), 9));
+        XOR(x[ 2], R(ADD(x[14], x[10]), 9));  XOR(x[ 7], R(ADD(x[ 3], x[15]), 9));
+
+        XOR(x[12], R(ADD(x[ 8], x[ 4]),13));  XOR(x[ 1], R(ADD(x[13], x[ 9]),13));
+        XOR(x[ 6], R(ADD(x[ 2], x[14]),13));  XOR(x[11], R(ADD(x[ 7], x[ 3]),13));
+
+        XOR(x[ 0], R(ADD(x[12], x[ 8]),18));  XOR(x[ 5], R(ADD(x[ 1], x[13]),18));
+        XOR(x[10], R(ADD(x[ 6], x[ 2]),18));  XOR(x[15], R(ADD(x[11], x[ 7]),18));
+
+        /* Operate on rows. */
+        XOR(x[ 1], R(ADD(x[ 0], x[ 3]), 7));  XOR(x[ 6], R(ADD(x[ 5], x[ 4]), 7));
+        XOR(x[11], R(ADD(x[10], x[ 9]), 7));  XOR(x[12], R(ADD(x[15], x[14]), 7));
+
+        XOR(x[ 2], R(ADD(x[ 1], x[ 0]), 9));  XOR(x[ 7], R(ADD(x[ 6], x[ 5]), 9));
+        XOR(x[ 8], R(ADD(x[11], x[10]), 9));  XOR(x[13], R(ADD(x[12], x[15]), 9));
+
+        XOR(x[ 3], R(ADD(x[ 2], x[ 1]),13));  XOR(x[ 4], R(ADD(x[ 7], x[ 6]),13));
+        XOR(x[ 9], R(ADD(x[ 8], x[11]),13));  XOR(x[14], R(ADD(x[13], x[12]),13));
+
+        XOR(x[ 0], R(ADD(x[ 3], x[ 2]),18));  XOR(x[ 5], R(ADD(x[ 4], x[ 7]),18));
+        XOR(x[10], R(ADD(x[ 9], x[ 8]),18));  XOR(x[15], R(ADD(x[14], x[13]),18));
+    }
+#undef XOR
+#undef ADD
+
+    for (int i = 0; i < 16; i++)
+        B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+// X holds the 32 words of eight hashes in natural order, V is 1M of
+//   scratchpad
+void scrypt_core_8way_avx2(uint32_t X[8][32], void *pV)
+{
+    __m256i *V = (__m256i *)pV;
+    __m256i Y[32];
+
+    for (int k = 0; k < 32; k++)
+        Y[k] = _mm256_set_epi32(X[7][k], X[6][k], X[5][k], X[4][k], X[3][k], X[2][k], X[1][k], X[0][k]);
+
+    for (int i = 0; i < 1024; i++) {
+        for (int k = 0; k < 32; k++)
+            _mm256_storeu_si256(&V[i * 32 + k], Y[k]);
+        xor_salsa8_avx2(&Y[0], &Y[16]);
+        xor_salsa8_avx2(&Y[16], &Y[0]);
+    }
+
+    // Every lane reads its own scratchpad row: word k of lane l in row j is
+    //   the 32-bit element (j * 32 + k) * 8 + l
+    const __m256i vLane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i vMask = _mm256_set1_epi32(1023);
+    for (int i = 0; i < 1024; i++) {
+        __m256i vIndex = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(Y[16], vMask), 8), vLane);
+        for (int k = 0; k < 32; k++)
+            Y[k] = _mm256_xor_si256(Y[k], _mm256_i32gather_epi32((const int *)V, _mm256_add_epi32(vIndex, _mm256_set1_epi32(k * 8)), 4));
+        xor_salsa8_avx2(&Y[0], &Y[16]);
+        xor_salsa8_avx2(&Y[16], &Y[0]);
+    }
+
+    uint32_t words[8];
+    for (int k = 0; k < 32; k++) {
+        _mm256_storeu_si256((__m256i *)words, Y[k]);
+        for (int n = 0; n < 8; n++)
+            X[n][k] = words[n];
+    }
+}
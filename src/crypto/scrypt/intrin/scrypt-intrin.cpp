@@ -34,9 +34,17 @@
 #endif
 
 #include "scrypt.h"
+#include "sha256.h"
+
+#include <memory>
 
 #include <openssl/evp.h>
 
+#if defined(USE_AVX2)
+// Implemented in scrypt-avx2.cpp
+void scrypt_core_8way_avx2(uint32_t X[8][32], void *V);
+#endif
+
 static inline uint32_t le32dec(const void *pp)
 {
     const uint8_t *p = (uint8_t const *)pp;
@@ -151,3 +159,205 @@ uint256 scrypt_blockhash(const uint8_t* input)
 
     return result;
 }
+
+/*
+ * Batch interface. Salsa20/8 is a long chain of dependent operations, so
+ * a single hash leaves most of the execution units idle. Interleaving the
+ * rounds of two or three independent hashes keeps them busy.
+ */
+
+static inline __m128i xor_rotl_sse2(__m128i X, __m128i T, int n)
+{
+    return _mm_xor_si128(_mm_xor_si128(X, _mm_slli_epi32(T, n)), _mm_srli_epi32(T, 32 - n));
+}
+
+template<int N>
+static inline void xor_salsa8_sse2_nway(__m128i (*X)[8], int nB, int nBx)
+{
+    __m128i X0[N], X1[N], X2[N], X3[N];
+    for (int n = 0; n < N; n++) {
+        __m128i *B = &X[n][nB];
+        const __m128i *Bx = &X[n][nBx];
+        X0[n] = B[0] = _mm_xor_si128(B[0], Bx[0]);
+        X1[n] = B[1] = _mm_xor_si128(B[1], Bx[1]);
+        X2[n] = B[2] = _mm_xor_si128(B[2], Bx[2]);
+        X3[n] = B[3] = _mm_xor_si128(B[3], Bx[3]);
+    }
+
+    for (uint32_t i = 0; i < 8; i += 2) {
+        /* Operate on "columns". */
+        for (int n = 0; n < N; n++) X1[n] = xor_rotl_sse2(X1[n], _mm_add_epi32(X0[n], X3[n]), 7);
+        for (int n = 0; n < N; n++) X2[n] = xor_rotl_sse2(X2[n], _mm_add_epi32(X1[n], X0[n]), 9);
+        for (int n = 0; n < N; n++) X3[n] = xor_rotl_sse2(X3[n], _mm_add_epi32(X2[n], X1[n]), 13);
+        for (int n = 0; n < N; n++) X0[n] = xor_rotl_sse2(X0[n], _mm_add_epi32(X3[n], X2[n]), 18);
+
+        /* Rearrange data. */
+        for (int n = 0; n < N; n++) {
+            X1[n] = _mm_shuffle_epi32(X1[n], 0x93);
+            X2[n] = _mm_shuffle_epi32(X2[n], 0x4E);
+            X3[n] = _mm_shuffle_epi32(X3[n], 0x39);
+        }
+
+        /* Operate on "rows". */
+        for (int n = 0; n < N; n++) X3[n] = xor_rotl_sse2(X3[n], _mm_add_epi32(X0[n], X1[n]), 7);
+        for (int n = 0; n < N; n++) X2[n] = xor_rotl_sse2(X2[n], _mm_add_epi32(X3[n], X0[n]), 9);
+        for (int n = 0; n < N; n++) X1[n] = xor_rotl_sse2(X1[n], _mm_add_epi32(X2[n], X3[n]), 13);
+        for (int n = 0; n < N; n++) X0[n] = xor_rotl_sse2(X0[n], _mm_add_epi32(X1[n], X2[n]), 18);
+
+        /* Rearrange data. */
+        for (int n = 0; n < N; n++) {
+            X1[n] = _mm_shuffle_epi32(X1[n], 0x39);
+            X2[n] = _mm_shuffle_epi32(X2[n], 0x4E);
+            X3[n] = _mm_shuffle_epi32(X3[n], 0x93);
+        }
+    }
+
+    for (int n = 0; n < N; n++) {
+        __m128i *B = &X[n][nB];
+        B[0] = _mm_add_epi32(B[0], X0[n]);
+        B[1] = _mm_add_epi32(B[1], X1[n]);
+        B[2] = _mm_add_epi32(B[2], X2[n]);
+        B[3] = _mm_add_epi32(B[3], X3[n]);
+    }
+}
+
+template<int N>
+static void scrypt_blockhash_sse2_nway(const uint8_t* input, uint256* output, __m128i *V)
+{
+    union {
+        __m128i i128[8];
+        uint32_t u32[32];
+    } X[N];
+    uint8_t B[128];
+    uint32_t i, k;
+    int n;
+
+    for (n = 0; n < N; n++) {
+        const uint8_t *pHeader = input + 80 * n;
+        PKCS5_PBKDF2_HMAC((const char*)pHeader, 80, pHeader, 80, 1, EVP_sha256(), 128, B);
+        for (k = 0; k < 2; k++) {
+            for (i = 0; i < 16; i++) {
+                X[n].u32[k * 16 + i] = le32dec(&B[(k * 16 + (i * 5 % 16)) * 4]);
+            }
+        }
+    }
+
+    __m128i Y[N][8];
+    for (n = 0; n < N; n++)
+        for (k = 0; k < 8; k++)
+            Y[n][k] = X[n].i128[k];
+
+    for (i = 0; i < 1024; i++) {
+        for (n = 0; n < N; n++)
+            for (k = 0; k < 8; k++)
+                V[(i * N + n) * 8 + k] = Y[n][k];
+        xor_salsa8_sse2_nway<N>(Y, 0, 4);
+        xor_salsa8_sse2_nway<N>(Y, 4, 0);
+    }
+    for (i = 0; i < 1024; i++) {
+        for (n = 0; n < N; n++) {
+            uint32_t j = ((uint32_t)_mm_cvtsi128_si32(Y[n][4]) & 1023) * N + n;
+            for (k = 0; k < 8; k++)
+                Y[n][k] = _mm_xor_si128(Y[n][k], V[j * 8 + k]);
+        }
+        xor_salsa8_sse2_nway<N>(Y, 0, 4);
+        xor_salsa8_sse2_nway<N>(Y, 4, 0);
+    }
+
+    for (n = 0; n < N; n++) {
+        const uint8_t *pHeader = input + 80 * n;
+        for (k = 0; k < 8; k++)
+            X[n].i128[k] = Y[n][k];
+        for (k = 0; k < 2; k++) {
+            for (i = 0; i < 16; i++) {
+                le32enc(&B[(k * 16 + (i * 5 % 16)) * 4], X[n].u32[k * 16 + i]);
+            }
+        }
+        output[n] = 0;
+        PKCS5_PBKDF2_HMAC((const char*)pHeader, 80, B, 128, 1, EVP_sha256(), 32, (unsigned char*)&output[n]);
+    }
+}
+
+#if defined(USE_AVX2)
+// Eight hashes in the lanes of AVX2 registers; the core works on words in
+//   their natural order, not in the diagonal order used by the SSE2 code.
+static void scrypt_blockhash_8way(const uint8_t* input, uint256* output, void *V)
+{
+    uint32_t X[8][32];
+    uint8_t B[128];
+
+    for (int n = 0; n < 8; n++) {
+        const uint8_t *pHeader = input + 80 * n;
+        PKCS5_PBKDF2_HMAC((const char*)pHeader, 80, pHeader, 80, 1, EVP_sha256(), 128, B);
+        for (int k = 0; k < 32; k++)
+            X[n][k] = le32dec(&B[k * 4]);
+    }
+
+    scrypt_core_8way_avx2(X, V);
+
+    for (int n = 0; n < 8; n++) {
+        const uint8_t *pHeader = input + 80 * n;
+        for (int k = 0; k < 32; k++)
+            le32enc(&B[k * 4], X[n][k]);
+        output[n] = 0;
+        PKCS5_PBKDF2_HMAC((const char*)pHeader, 80, B, 128, 1, EVP_sha256(), 32, (unsigned char*)&output[n]);
+    }
+}
+
+#endif
+
+// Scratchpad of the batches, allocated once per thread and neither
+//   freed nor cleared between calls
+static thread_local std::unique_ptr<uint8_t[]> pScratchpad;
+static thread_local size_t nScratchpadSize = 0;
+
+// 128K of scratchpad per hash, 64 byte aligned
+static __m128i *GetScratchpad(size_t nHashes)
+{
+    size_t nSize = nHashes * 131072 + 63;
+    if (nScratchpadSize < nSize) {
+        pScratchpad.reset(new uint8_t[nSize]);
+        nScratchpadSize = nSize;
+    }
+    return (__m128i *)(((uintptr_t)(pScratchpad.get()) + 63) & ~ (uintptr_t)(63));
+}
+
+void scrypt_blockhash_batch(const uint8_t* input, uint256* output, size_t nCount)
+{
+    if (nCount == 1) {
+        output[0] = scrypt_blockhash(input);
+        return;
+    }
+
+    __m128i *V = NULL;
+
+#if defined(USE_AVX2)
+    if (nCount >= 8 && CPUSupportsAVX2()) {
+        V = GetScratchpad(8);
+        for (; nCount >= 8; nCount -= 8, input += 8 * 80, output += 8)
+            scrypt_blockhash_8way(input, output, V);
+    }
+#endif
+
+    if (nCount >= 2 && V == NULL)
+        V = GetScratchpad(3);
+    for (; nCount >= 3; nCount -= 3, input += 3 * 80, output += 3)
+        scrypt_blockhash_sse2_nway<3>(input, output, V);
+    if (nCount == 2)
+        scrypt_blockhash_sse2_nway<2>(input, output, V);
+    else if (nCount == 1)
+        output[0] = scrypt_blockhash(input);
+}
+
+const char* scrypt_batch_impl()
+{
+#if defined(USE_AVX2)
+    if (CPUSupportsAVX2())
+        return "avx2(8way),sse2(3way)";
+#endif
+#ifdef __ARM_NEON
+    return "neon(3way)";
+#else
+    return "sse2(3way)";
+#endif
+}
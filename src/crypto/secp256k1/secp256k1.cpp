@@ -0,0 +1,807 @@
+/*
+ * Native secp256k1 ECDSA verification.
+ *
+ * Field elements and scalars are four 64-bit limbs, always kept fully
+ * reduced. Verification computes u1*G + u2*Q with the GLV endomorphism
+ * splitting both scalars in halves, and interleaved wNAF multiplication
+ * (Strauss) over a precomputed table for the generator.
+ *
+ * Only public data is processed here, so the code is not constant time
+ * and must not be used with secret keys.
+ */
+
+#include "secp256k1.h"
+
+#ifdef HAVE_NATIVE_SECP256K1
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <vector>
+
+namespace {
+
+typedef unsigned __int128 uint128_t;
+
+//
+// Multi-precision helpers, limbs are least significant first
+//
+
+inline void read_be256(uint64_t r[4], const unsigned char *p)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t x = 0;
+        for (int j = 0; j < 8; j++)
+            x = (x << 8) | p[(3 - i) * 8 + j];
+        r[i] = x;
+    }
+}
+
+inline int cmp256(const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a[i] < b[i]) return -1;
+        if (a[i] > b[i]) return 1;
+    }
+    return 0;
+}
+
+inline bool is_zero256(const uint64_t a[4])
+{
+    return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+// r = a + b, returns carry
+inline uint64_t add256(uint64_t r[4], const uint64_t a[4], const uint64_t b[4])
+{
+    uint128_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        c += (uint128_t)a[i] + b[i];
+        r[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    return (uint64_t)c;
+}
+
+// r = a - b, returns borrow
+inline uint64_t sub256(uint64_t r[4], const uint64_t a[4], const uint64_t b[4])
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint128_t d = (uint128_t)a[i] - b[i] - borrow;
+        r[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+    return borrow;
+}
+
+inline void mul512(uint64_t t[8], const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 0; i < 8; i++)
+        t[i] = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint128_t c = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            c += (uint128_t)a[i] * b[j] + t[i + j];
+            t[i + j] = (uint64_t)c;
+            c >>= 64;
+        }
+        t[i + 4] = (uint64_t)c;
+    }
+}
+
+//
+// Field elements modulo p = 2^256 - 0x1000003D1
+//
+
+const uint64_t FIELD_C = 0x1000003D1ULL;
+const uint64_t FIELD_P[4] = { 0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL };
+
+struct fe
+{
+    uint64_t n[4];
+};
+
+// Reduce a + carry * 2^256 where carry is small
+inline void fe_reduce_carry(fe& r, uint64_t carry)
+{
+    while (carry)
+    {
+        uint128_t c = (uint128_t)carry * FIELD_C;
+        for (int i = 0; i < 4; i++)
+        {
+            c += r.n[i];
+            r.n[i] = (uint64_t)c;
+            c >>= 64;
+        }
+        carry = (uint64_t)c;
+    }
+    if (cmp256(r.n, FIELD_P) >= 0)
+        sub256(r.n, r.n, FIELD_P);
+}
+
+inline void fe_set_int(fe& r, uint64_t x)
+{
+    r.n[0] = x; r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+inline bool fe_is_zero(const fe& a)
+{
+    return is_zero256(a.n);
+}
+
+inline bool fe_equal(const fe& a, const fe& b)
+{
+    return cmp256(a.n, b.n) == 0;
+}
+
+inline bool fe_is_odd(const fe& a)
+{
+    return a.n[0] & 1;
+}
+
+inline void fe_add(fe& r, const fe& a, const fe& b)
+{
+    fe_reduce_carry(r, add256(r.n, a.n, b.n));
+}
+
+inline void fe_sub(fe& r, const fe& a, const fe& b)
+{
+    if (sub256(r.n, a.n, b.n))
+    {
+        // Wrapped around 2^256, add p instead
+        uint64_t c[4] = { FIELD_C, 0, 0, 0 };
+        sub256(r.n, r.n, c);
+    }
+}
+
+inline void fe_negate(fe& r, const fe& a)
+{
+    fe zero;
+    fe_set_int(zero, 0);
+    fe_sub(r, zero, a);
+}
+
+void fe_mul(fe& r, const fe& a, const fe& b)
+{
+    uint64_t t[8];
+    mul512(t, a.n, b.n);
+
+    // t = lo + hi * 2^256 = lo + hi * C (mod p)
+    uint128_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        c += (uint128_t)t[i + 4] * FIELD_C + t[i];
+        r.n[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    fe_reduce_carry(r, (uint64_t)c);
+}
+
+inline void fe_sqr(fe& r, const fe& a)
+{
+    fe_mul(r, a, a);
+}
+
+inline void fe_sqr_n(fe& r, const fe& a, int n)
+{
+    r = a;
+    for (int i = 0; i < n; i++)
+        fe_sqr(r, r);
+}
+
+// a^(2^223 - 1) and the intermediate powers a^(2^k - 1) used by both
+//   the inverse and the square root addition chains
+void fe_pow_chain(const fe& a, fe& x2, fe& x22, fe& x223)
+{
+    fe x3, x6, x9, x11, x44, x88, x176, x220, t;
+
+    fe_sqr(t, a); fe_mul(x2, t, a);
+    fe_sqr(t, x2); fe_mul(x3, t, a);
+    fe_sqr_n(t, x3, 3); fe_mul(x6, t, x3);
+    fe_sqr_n(t, x6, 3); fe_mul(x9, t, x3);
+    fe_sqr_n(t, x9, 2); fe_mul(x11, t, x2);
+    fe_sqr_n(t, x11, 11); fe_mul(x22, t, x11);
+    fe_sqr_n(t, x22, 22); fe_mul(x44, t, x22);
+    fe_sqr_n(t, x44, 44); fe_mul(x88, t, x44);
+    fe_sqr_n(t, x88, 88); fe_mul(x176, t, x88);
+    fe_sqr_n(t, x176, 44); fe_mul(x220, t, x44);
+    fe_sqr_n(t, x220, 3); fe_mul(x223, t, x3);
+}
+
+// r = a^(p - 2)
+void fe_inv(fe& r, const fe& a)
+{
+    fe x2, x22, x223, t;
+    fe_pow_chain(a, x2, x22, x223);
+    fe_sqr_n(t, x223, 23); fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 5); fe_mul(t, t, a);
+    fe_sqr_n(t, t, 3); fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2); fe_mul(r, t, a);
+}
+
+// r = a^((p + 1) / 4), returns whether it is a square root of a
+bool fe_sqrt(fe& r, const fe& a)
+{
+    fe x2, x22, x223, t;
+    fe_pow_chain(a, x2, x22, x223);
+    fe_sqr_n(t, x223, 23); fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 6); fe_mul(t, t, x2);
+    fe_sqr_n(r, t, 2);
+
+    fe_sqr(t, r);
+    return fe_equal(t, a);
+}
+
+//
+// Scalars modulo the group order n = 2^256 - SCALAR_C
+//
+
+const uint64_t SCALAR_N[4] = { 0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL };
+const uint64_t SCALAR_N_HALF[4] = { 0xDFE92F46681B20A0ULL, 0x5D576E7357A4501DULL, 0xFFFFFFFFFFFFFFFFULL, 0x7FFFFFFFFFFFFFFFULL };
+const uint64_t SCALAR_C[3] = { 0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 1 };
+
+struct scalar
+{
+    uint64_t n[4];
+};
+
+// r = t mod n, where t has 8 limbs
+void scalar_reduce512(scalar& r, const uint64_t tIn[8])
+{
+    uint64_t t[8];
+    memcpy(t, tIn, sizeof(t));
+
+    // Fold t = lo + hi * 2^256 into lo + hi * C until hi vanishes
+    while (t[4] | t[5] | t[6] | t[7])
+    {
+        uint64_t u[8] = { t[0], t[1], t[2], t[3], 0, 0, 0, 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            if (!t[i + 4])
+                continue;
+            uint128_t c = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                c += (uint128_t)t[i + 4] * SCALAR_C[j] + u[i + j];
+                u[i + j] = (uint64_t)c;
+                c >>= 64;
+            }
+            for (int k = i + 3; c && k < 8; k++)
+            {
+                c += u[k];
+                u[k] = (uint64_t)c;
+                c >>= 64;
+            }
+        }
+        memcpy(t, u, sizeof(t));
+    }
+
+    memcpy(r.n, t, sizeof(r.n));
+    while (cmp256(r.n, SCALAR_N) >= 0)
+        sub256(r.n, r.n, SCALAR_N);
+}
+
+inline bool scalar_is_zero(const scalar& a)
+{
+    return is_zero256(a.n);
+}
+
+inline void scalar_mul(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t t[8];
+    mul512(t, a.n, b.n);
+    scalar_reduce512(r, t);
+}
+
+inline void scalar_add(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t carry = add256(r.n, a.n, b.n);
+    if (carry || cmp256(r.n, SCALAR_N) >= 0)
+        sub256(r.n, r.n, SCALAR_N);
+}
+
+inline void scalar_negate(scalar& r, const scalar& a)
+{
+    if (scalar_is_zero(a))
+        r = a;
+    else
+        sub256(r.n, SCALAR_N, a.n);
+}
+
+inline void shr1(uint64_t a[4], uint64_t top)
+{
+    for (int i = 0; i < 3; i++)
+        a[i] = (a[i] >> 1) | (a[i + 1] << 63);
+    a[3] = (a[3] >> 1) | (top << 63);
+}
+
+// r = a^-1 mod n by the binary extended Euclidean algorithm, a != 0
+void scalar_inv(scalar& r, const scalar& a)
+{
+    uint64_t u[4], v[4], x1[4] = { 1, 0, 0, 0 }, x2[4] = { 0, 0, 0, 0 };
+    memcpy(u, a.n, sizeof(u));
+    memcpy(v, SCALAR_N, sizeof(v));
+
+    // Invariants: x1 * a = u, x2 * a = v (mod n)
+    while (!(u[0] == 1 && !(u[1] | u[2] | u[3])) && !(v[0] == 1 && !(v[1] | v[2] | v[3])))
+    {
+        while (!(u[0] & 1))
+        {
+            shr1(u, 0);
+            if (x1[0] & 1)
+                shr1(x1, add256(x1, x1, SCALAR_N));
+            else
+                shr1(x1, 0);
+        }
+        while (!(v[0] & 1))
+        {
+            shr1(v, 0);
+            if (x2[0] & 1)
+                shr1(x2, add256(x2, x2, SCALAR_N));
+            else
+                shr1(x2, 0);
+        }
+        if (cmp256(u, v) >= 0)
+        {
+            sub256(u, u, v);
+            if (sub256(x1, x1, x2))
+                add256(x1, x1, SCALAR_N);
+        }
+        else
+        {
+            sub256(v, v, u);
+            if (sub256(x2, x2, x1))
+                add256(x2, x2, SCALAR_N);
+        }
+    }
+
+    memcpy(r.n, (u[0] == 1 && !(u[1] | u[2] | u[3])) ? x1 : x2, sizeof(r.n));
+}
+
+// GLV endomorphism: lambda * (x, y) = (beta * x, y)
+const scalar SCALAR_LAMBDA = {{ 0xDF02967C1B23BD72ULL, 0x122E22EA20816678ULL, 0xA5261C028812645AULL, 0x5363AD4CC05C30E0ULL }};
+const fe FIELD_BETA = {{ 0xC1396C28719501EEULL, 0x9CF0497512F58995ULL, 0x6E64479EAC3434E9ULL, 0x7AE96A2B657C0710ULL }};
+
+// Rounded (2^384 * b2 / n) and (2^384 * -b1 / n) for the lattice basis
+//   a1 = 0x3086d221a7d46bcde86c90e49284eb15, b1 = -0xe4437ed6010e88286f547fa90abfe4c3,
+//   a2 = 0x114ca50f7a8e2f3f657c1108d9d44cfd8, b2 = a1
+const uint64_t GLV_G1[4] = { 0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL };
+const uint64_t GLV_G2[4] = { 0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL };
+const scalar GLV_MINUS_B1 = {{ 0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0, 0 }};
+const scalar GLV_MINUS_B2 = {{ 0xD765CDA83DB1562CULL, 0x8A280AC50774346DULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL }};
+
+// r = round(a * g / 2^384)
+void mul_shift_384(scalar& r, const scalar& a, const uint64_t g[4])
+{
+    uint64_t t[8];
+    mul512(t, a.n, g);
+    uint64_t round = (t[5] >> 63) & 1;
+    r.n[0] = t[6]; r.n[1] = t[7]; r.n[2] = 0; r.n[3] = 0;
+    uint64_t one[4] = { round, 0, 0, 0 };
+    add256(r.n, r.n, one);
+}
+
+// Split k into k1 + k2 * lambda, with both halves about 128 bits long
+void scalar_split_lambda(scalar& k1, scalar& k2, const scalar& k)
+{
+    scalar c1, c2;
+    mul_shift_384(c1, k, GLV_G1);
+    mul_shift_384(c2, k, GLV_G2);
+    scalar_mul(c1, c1, GLV_MINUS_B1);
+    scalar_mul(c2, c2, GLV_MINUS_B2);
+    scalar_add(k2, c1, c2);
+
+    scalar t;
+    scalar_mul(t, k2, SCALAR_LAMBDA);
+    scalar_negate(t, t);
+    scalar_add(k1, k, t);
+}
+
+//
+// Points
+//
+
+struct ge      // affine
+{
+    fe x, y;
+};
+
+struct gej     // jacobian, (X / Z^2, Y / Z^3)
+{
+    fe x, y, z;
+    bool fInfinity;
+};
+
+inline void gej_set_ge(gej& r, const ge& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    fe_set_int(r.z, 1);
+    r.fInfinity = false;
+}
+
+void gej_double(gej& r, const gej& a)
+{
+    if (a.fInfinity || fe_is_zero(a.y))
+    {
+        r.fInfinity = true;
+        return;
+    }
+
+    fe yy, s, m, t, x3, y3, z3;
+    fe_sqr(yy, a.y);                                    // Y^2
+    fe_mul(s, a.x, yy); fe_add(s, s, s); fe_add(s, s, s); // S = 4 X Y^2
+    fe_sqr(t, a.x); fe_add(m, t, t); fe_add(m, m, t);   // M = 3 X^2
+    fe_sqr(x3, m); fe_sub(x3, x3, s); fe_sub(x3, x3, s); // X' = M^2 - 2 S
+    fe_sqr(t, yy); fe_add(t, t, t); fe_add(t, t, t); fe_add(t, t, t); // 8 Y^4
+    fe_sub(y3, s, x3); fe_mul(y3, y3, m); fe_sub(y3, y3, t); // Y' = M (S - X') - 8 Y^4
+    fe_mul(z3, a.y, a.z); fe_add(z3, z3, z3);           // Z' = 2 Y Z
+
+    r.x = x3; r.y = y3; r.z = z3;
+    r.fInfinity = false;
+}
+
+// r = a + b, where b has coordinates (bx, by, bz) and fAffine tells that bz = 1
+void gej_add_var(gej& r, const gej& a, const fe& bx, const fe& by, const fe& bz, bool fAffine)
+{
+    if (a.fInfinity)
+    {
+        r.x = bx; r.y = by; r.z = bz;
+        r.fInfinity = false;
+        return;
+    }
+
+    fe z1z1, u1, u2, s1, s2, t;
+    fe_sqr(z1z1, a.z);
+    if (fAffine)
+    {
+        u1 = a.x;
+        s1 = a.y;
+    }
+    else
+    {
+        fe z2z2;
+        fe_sqr(z2z2, bz);
+        fe_mul(u1, a.x, z2z2);
+        fe_mul(s1, a.y, z2z2); fe_mul(s1, s1, bz);
+    }
+    fe_mul(u2, bx, z1z1);
+    fe_mul(s2, by, z1z1); fe_mul(s2, s2, a.z);
+
+    fe h, rr;
+    fe_sub(h, u2, u1);
+    fe_sub(rr, s2, s1);
+    if (fe_is_zero(h))
+    {
+        if (fe_is_zero(rr))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+
+    fe hh, hhh, v, x3, y3, z3;
+    fe_sqr(hh, h);
+    fe_mul(hhh, hh, h);
+    fe_mul(v, u1, hh);
+    fe_sqr(x3, rr); fe_sub(x3, x3, hhh); fe_sub(x3, x3, v); fe_sub(x3, x3, v); // X3 = R^2 - H^3 - 2 U1 H^2
+    fe_sub(y3, v, x3); fe_mul(y3, y3, rr); fe_mul(t, s1, hhh); fe_sub(y3, y3, t); // Y3 = R (U1 H^2 - X3) - S1 H^3
+    fe_mul(z3, a.z, h);                                                           // Z3 = Z1 Z2 H
+    if (!fAffine)
+        fe_mul(z3, z3, bz);
+
+    r.x = x3; r.y = y3; r.z = z3;
+    r.fInfinity = false;
+}
+
+//
+// wNAF multiplication
+//
+
+// Window of the generator tables, 2^(WINDOW_G - 2) odd multiples
+const int WINDOW_G = 12;
+const int TABLE_G = 1 << (WINDOW_G - 2);
+// Window of the public key tables
+const int WINDOW_A = 5;
+const int TABLE_A = 1 << (WINDOW_A - 2);
+// Halves of a split scalar fit into 129 bits, wNAF adds one digit
+const int WNAF_BITS = 130;
+
+// Window NAF of a split scalar half, returns the number of digits
+int wnaf(int digits[WNAF_BITS], const scalar& k, int w)
+{
+    uint64_t a[5] = { k.n[0], k.n[1], k.n[2], k.n[3], 0 };
+    int nLen = 0;
+    memset(digits, 0, sizeof(int) * WNAF_BITS);
+
+    for (int i = 0; (a[0] | a[1] | a[2] | a[3] | a[4]) && i < WNAF_BITS; i++)
+    {
+        if (a[0] & 1)
+        {
+            int d = (int)(a[0] & ((1U << w) - 1));
+            if (d >= (1 << (w - 1)))
+            {
+                d -= (1 << w);
+                // a -= d, i.e. a += -d
+                uint128_t c = (uint128_t)a[0] + (uint64_t)(-d);
+                a[0] = (uint64_t)c;
+                for (int j = 1; j < 5 && (c >> 64); j++)
+                {
+                    c = (uint128_t)a[j] + 1;
+                    a[j] = (uint64_t)c;
+                }
+            }
+            else
+                a[0] -= d;
+            digits[i] = d;
+            nLen = i + 1;
+        }
+        for (int j = 0; j < 4; j++)
+            a[j] = (a[j] >> 1) | (a[j + 1] << 63);
+        a[4] >>= 1;
+    }
+    return nLen;
+}
+
+// Odd multiples G, 3G, 5G ... of the generator and of lambda * G
+struct CGeneratorTables
+{
+    std::vector<ge> vG;
+    std::vector<ge> vLambdaG;
+};
+
+const CGeneratorTables& GetGeneratorTables()
+{
+    static CGeneratorTables tables;
+    static std::once_flag flag;
+    std::call_once(flag, []() {
+        ge g;
+        const unsigned char gx[32] = {
+            0x79,0xBE,0x66,0x7E,0xF9,0xDC,0xBB,0xAC,0x55,0xA0,0x62,0x95,0xCE,0x87,0x0B,0x07,
+            0x02,0x9B,0xFC,0xDB,0x2D,0xCE,0x28,0xD9,0x59,0xF2,0x81,0x5B,0x16,0xF8,0x17,0x98 };
+        const unsigned char gy[32] = {
+            0x48,0x3A,0xDA,0x77,0x26,0xA3,0xC4,0x65,0x5D,0xA4,0xFB,0xFC,0x0E,0x11,0x08,0xA8,
+            0xFD,0x17,0xB4,0x48,0xA6,0x85,0x54,0x19,0x9C,0x47,0xD0,0x8F,0xFB,0x10,0xD4,0xB8 };
+        read_be256(g.x.n, gx);
+        read_be256(g.y.n, gy);
+
+        gej p, g2;
+        gej_set_ge(p, g);
+        gej_double(g2, p);
+
+        tables.vG.resize(TABLE_G);
+        tables.vLambdaG.resize(TABLE_G);
+        for (int i = 0; i < TABLE_G; i++)
+        {
+            fe zi, zi2, zi3;
+            fe_inv(zi, p.z);
+            fe_sqr(zi2, zi);
+            fe_mul(zi3, zi2, zi);
+            fe_mul(tables.vG[i].x, p.x, zi2);
+            fe_mul(tables.vG[i].y, p.y, zi3);
+            fe_mul(tables.vLambdaG[i].x, tables.vG[i].x, FIELD_BETA);
+            tables.vLambdaG[i].y = tables.vG[i].y;
+            gej_add_var(p, p, g2.x, g2.y, g2.z, false);
+        }
+    });
+    return tables;
+}
+
+// Add table entry for wNAF digit d to r, negating it if fNeg is set
+inline void add_digit_ge(gej& r, const std::vector<ge>& vTable, int d, bool fNeg)
+{
+    const ge& p = vTable[(d > 0 ? d : -d) / 2];
+    fe y = p.y;
+    if ((d < 0) != fNeg)
+        fe_negate(y, y);
+    fe one;
+    fe_set_int(one, 1);
+    gej_add_var(r, r, p.x, y, one, true);
+}
+
+inline void add_digit_gej(gej& r, const gej* pTable, int d, bool fNeg)
+{
+    const gej& p = pTable[(d > 0 ? d : -d) / 2];
+    fe y = p.y;
+    if ((d < 0) != fNeg)
+        fe_negate(y, y);
+    gej_add_var(r, r, p.x, y, p.z, false);
+}
+
+// Scalar half which is "negative" (above n / 2) is negated, the flag tells to
+//   negate the point instead
+inline bool normalize_half(scalar& k)
+{
+    if (cmp256(k.n, SCALAR_N_HALF) > 0)
+    {
+        scalar_negate(k, k);
+        return true;
+    }
+    return false;
+}
+
+// r = na * a + ng * G
+void ecmult(gej& r, const ge& a, const scalar& na, const scalar& ng)
+{
+    const CGeneratorTables& tables = GetGeneratorTables();
+
+    scalar na1, na2, ng1, ng2;
+    scalar_split_lambda(na1, na2, na);
+    scalar_split_lambda(ng1, ng2, ng);
+    bool fNegA1 = normalize_half(na1), fNegA2 = normalize_half(na2);
+    bool fNegG1 = normalize_half(ng1), fNegG2 = normalize_half(ng2);
+
+    int wnaf_a1[WNAF_BITS], wnaf_a2[WNAF_BITS], wnaf_g1[WNAF_BITS], wnaf_g2[WNAF_BITS];
+    int nLen = 0;
+    nLen = std::max(nLen, wnaf(wnaf_a1, na1, WINDOW_A));
+    nLen = std::max(nLen, wnaf(wnaf_a2, na2, WINDOW_A));
+    nLen = std::max(nLen, wnaf(wnaf_g1, ng1, WINDOW_G));
+    nLen = std::max(nLen, wnaf(wnaf_g2, ng2, WINDOW_G));
+
+    // Odd multiples of a and lambda * a
+    gej tableA[TABLE_A], tableLambdaA[TABLE_A];
+    gej a2;
+    gej_set_ge(tableA[0], a);
+    gej_double(a2, tableA[0]);
+    for (int i = 1; i < TABLE_A; i++)
+        gej_add_var(tableA[i], tableA[i - 1], a2.x, a2.y, a2.z, false);
+    for (int i = 0; i < TABLE_A; i++)
+    {
+        tableLambdaA[i] = tableA[i];
+        fe_mul(tableLambdaA[i].x, tableA[i].x, FIELD_BETA);
+    }
+
+    r.fInfinity = true;
+    for (int i = nLen - 1; i >= 0; i--)
+    {
+        gej_double(r, r);
+        if (wnaf_a1[i])
+            add_digit_gej(r, tableA, wnaf_a1[i], fNegA1);
+        if (wnaf_a2[i])
+            add_digit_gej(r, tableLambdaA, wnaf_a2[i], fNegA2);
+        if (wnaf_g1[i])
+            add_digit_ge(r, tables.vG, wnaf_g1[i], fNegG1);
+        if (wnaf_g2[i])
+            add_digit_ge(r, tables.vLambdaG, wnaf_g2[i], fNegG2);
+    }
+}
+
+bool pubkey_parse(ge& r, const unsigned char *pubkey, size_t nLen)
+{
+    fe seven, t;
+    fe_set_int(seven, 7);
+
+    if (nLen == 33 && (pubkey[0] == 0x02 || pubkey[0] == 0x03))
+    {
+        read_be256(r.x.n, pubkey + 1);
+        if (cmp256(r.x.n, FIELD_P) >= 0)
+            return false;
+        fe_sqr(t, r.x); fe_mul(t, t, r.x); fe_add(t, t, seven);
+        if (!fe_sqrt(r.y, t))
+            return false;
+        if (fe_is_odd(r.y) != (pubkey[0] == 0x03))
+            fe_negate(r.y, r.y);
+        return true;
+    }
+
+    if (nLen == 65 && (pubkey[0] == 0x04 || pubkey[0] == 0x06 || pubkey[0] == 0x07))
+    {
+        read_be256(r.x.n, pubkey + 1);
+        read_be256(r.y.n, pubkey + 33);
+        if (cmp256(r.x.n, FIELD_P) >= 0 || cmp256(r.y.n, FIELD_P) >= 0)
+            return false;
+        // Hybrid encoding repeats the parity of y in the header
+        if (pubkey[0] != 0x04 && fe_is_odd(r.y) != (pubkey[0] == 0x07))
+            return false;
+        fe yy;
+        fe_sqr(yy, r.y);
+        fe_sqr(t, r.x); fe_mul(t, t, r.x); fe_add(t, t, seven);
+        return fe_equal(yy, t);
+    }
+
+    return false;
+}
+
+} // namespace
+
+bool secp256k1_pubkey_valid(const unsigned char *pubkey, size_t nLen)
+{
+    ge q;
+    return pubkey_parse(q, pubkey, nLen);
+}
+
+bool secp256k1_parse_der_strict(const unsigned char *sig, size_t nLen, unsigned char r[32], unsigned char s[32])
+{
+    // 0x30 <total len> 0x02 <len R> <R> 0x02 <len S> <S>
+    if (nLen < 8 || nLen > 72)
+        return false;
+    if (sig[0] != 0x30 || sig[1] != nLen - 2)
+        return false;
+    size_t nLenR = sig[3];
+    if (5 + nLenR >= nLen)
+        return false;
+    size_t nLenS = sig[5 + nLenR];
+    if (nLenR + nLenS + 6 != nLen)
+        return false;
+
+    const unsigned char *R = &sig[4], *S = &sig[6 + nLenR];
+    const unsigned char *vInt[2] = { R, S };
+    size_t vLen[2] = { nLenR, nLenS };
+    unsigned char *vOut[2] = { r, s };
+    for (int i = 0; i < 2; i++)
+    {
+        const unsigned char *p = vInt[i];
+        size_t n = vLen[i];
+        if (p[-2] != 0x02 || n == 0 || (p[0] & 0x80))
+            return false;
+        if (n > 1 && p[0] == 0x00 && !(p[1] & 0x80))
+            return false;
+        // Single leading zero keeps the value positive
+        if (p[0] == 0x00)
+        {
+            p++;
+            n--;
+        }
+        if (n > 32)
+            return false;
+        memset(vOut[i], 0, 32 - n);
+        memcpy(vOut[i] + 32 - n, p, n);
+    }
+    return true;
+}
+
+bool secp256k1_verify(const unsigned char *pubkey, size_t nLen, const unsigned char hash[32], const unsigned char r[32], const unsigned char s[32])
+{
+    ge q;
+    if (!pubkey_parse(q, pubkey, nLen))
+        return false;
+
+    scalar sr, ss, e;
+    read_be256(sr.n, r);
+    read_be256(ss.n, s);
+    if (scalar_is_zero(sr) || cmp256(sr.n, SCALAR_N) >= 0)
+        return false;
+    if (scalar_is_zero(ss) || cmp256(ss.n, SCALAR_N) >= 0)
+        return false;
+
+    // Hash is as long as the order, so it is only reduced
+    read_be256(e.n, hash);
+    if (cmp256(e.n, SCALAR_N) >= 0)
+        sub256(e.n, e.n, SCALAR_N);
+
+    scalar w, u1, u2;
+    scalar_inv(w, ss);
+    scalar_mul(u1, e, w);
+    scalar_mul(u2, sr, w);
+
+    gej p;
+    ecmult(p, q, u2, u1);
+    if (p.fInfinity)
+        return false;
+
+    // Compare x = X / Z^2 mod n with r without an inversion. As n < p, x mod n
+    //   is r when x = r or x = r + n.
+    fe zz, xr;
+    fe_sqr(zz, p.z);
+    memcpy(xr.n, sr.n, sizeof(xr.n));
+    fe_mul(xr, xr, zz);
+    if (fe_equal(xr, p.x))
+        return true;
+
+    uint64_t rn[4];
+    if (add256(rn, sr.n, SCALAR_N) || cmp256(rn, FIELD_P) >= 0)
+        return false;
+    memcpy(xr.n, rn, sizeof(xr.n));
+    fe_mul(xr, xr, zz);
+    return fe_equal(xr, p.x);
+}
+
+#endif // HAVE_NATIVE_SECP256K1
@@ -0,0 +1,64 @@
+/*
+ * Eight lane AVX2 implementation of the proof-of-stake kernel hashing and
+ * of the double SHA256 of 64 byte messages.
+ * This file is compiled with AVX2 code generation enabled and is only
+ * called after the CPU support has been checked at runtime.
+ */
+
+#include <immintrin.h>
+
+#include "sha256.h"
+
+namespace {
+
+inline __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+inline __m256i Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+inline __m256i And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+inline __m256i Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+inline __m256i Shr(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+inline __m256i Shl(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+
+template<typename V> inline V Set1(uint32_t x);
+template<> inline __m256i Set1<__m256i>(uint32_t x) { return _mm256_set1_epi32((int)x); }
+
+} // namespace
+
+#include "crypto/sha256/sha256-lanes.h"
+
+void sha256_kernel_hash8_avx2(const sha256_kernel_ctx *ctx, uint32_t nTimeTx, uint32_t hashes[KERNEL_SHA256_LANES][8])
+{
+    __m256i vTime = _mm256_set_epi32(
+        (int)sha256_bswap32(nTimeTx + 7), (int)sha256_bswap32(nTimeTx + 6),
+        (int)sha256_bswap32(nTimeTx + 5), (int)sha256_bswap32(nTimeTx + 4),
+        (int)sha256_bswap32(nTimeTx + 3), (int)sha256_bswap32(nTimeTx + 2),
+        (int)sha256_bswap32(nTimeTx + 1), (int)sha256_bswap32(nTimeTx));
+
+    __m256i out[8];
+    KernelHash(ctx, vTime, out);
+
+    uint32_t words[8][8];
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)words[i], out[i]);
+    for (int j = 0; j < KERNEL_SHA256_LANES; j++)
+        for (int i = 0; i < 8; i++)
+            hashes[j][i] = sha256_bswap32(words[i][j]);
+}
+
+void sha256d64_avx2(unsigned char *out, const unsigned char *in)
+{
+    __m256i w[16], h[8];
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm256_set_epi32(
+            (int)ReadBE32(in + 448 + 4 * i), (int)ReadBE32(in + 384 + 4 * i),
+            (int)ReadBE32(in + 320 + 4 * i), (int)ReadBE32(in + 256 + 4 * i),
+            (int)ReadBE32(in + 192 + 4 * i), (int)ReadBE32(in + 128 + 4 * i),
+            (int)ReadBE32(in + 64 + 4 * i), (int)ReadBE32(in + 4 * i));
+    D64Hash(w, h);
+
+    uint32_t words[8][8];
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)words[i], h[i]);
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + 32 * j + 4 * i, words[i][j]);
+}
@@ -0,0 +1,122 @@
+/*
+ * Multi-lane SHA256 compression, used for the proof-of-stake kernel
+ * scanner and for batches of merkle tree nodes.
+ *
+ * Every lane holds an independent message, lane type V is either plain
+ * uint32_t or a SIMD vector of 32-bit integers. For each lane type the
+ * including file has to define Add, Xor, And, Or, Shr, Shl and a Set1<V>
+ * specialization before this header is included.
+ *
+ * All functions have internal linkage: this header is compiled into
+ * translation units with different instruction set flags.
+ */
+
+#ifndef NOVACOIN_SHA256_LANES_H
+#define NOVACOIN_SHA256_LANES_H
+
+#include "crypto/sha256/sha256-common.h"
+
+namespace {
+
+template<typename V> inline V Rotr(V x, int n) { return Or(Shr(x, n), Shl(x, 32 - n)); }
+template<typename V> inline V Ch(V x, V y, V z) { return Xor(z, And(x, Xor(y, z))); }
+template<typename V> inline V Maj(V x, V y, V z) { return Or(And(x, y), And(z, Or(x, y))); }
+template<typename V> inline V Sigma0(V x) { return Xor(Rotr(x, 2), Xor(Rotr(x, 13), Rotr(x, 22))); }
+template<typename V> inline V Sigma1(V x) { return Xor(Rotr(x, 6), Xor(Rotr(x, 11), Rotr(x, 25))); }
+template<typename V> inline V sigma0(V x) { return Xor(Rotr(x, 7), Xor(Rotr(x, 18), Shr(x, 3))); }
+template<typename V> inline V sigma1(V x) { return Xor(Rotr(x, 17), Xor(Rotr(x, 19), Shr(x, 10))); }
+
+// Run rounds nFirst..nLast-1 over state s with message words w, which are
+//   replaced by the message schedule on the way.
+template<typename V>
+inline void Rounds(V s[8], V w[16], int nFirst, int nLast = 64)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int i = nFirst; i < nLast; i++)
+    {
+        if (i >= 16)
+            w[i & 15] = Add(Add(sigma1(w[(i - 2) & 15]), w[(i - 7) & 15]), Add(sigma0(w[(i - 15) & 15]), w[i & 15]));
+
+        V t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), Add(Set1<V>(sha256_k[i]), w[i & 15])));
+        V t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g; g = f; f = e; e = Add(d, t1);
+        d = c; c = b; b = a; a = Add(t1, t2);
+    }
+
+    s[0] = a; s[1] = b; s[2] = c; s[3] = d; s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+}
+
+// SHA256 of 32 byte messages, which are big endian words in[0..7]
+template<typename V>
+inline void Hash32(const V in[8], V out[8])
+{
+    V w[16];
+    for (int i = 0; i < 8; i++)
+        w[i] = in[i];
+    w[8] = Set1<V>(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = Set1<V>(0);
+    w[15] = Set1<V>(32 * 8);
+
+    for (int i = 0; i < 8; i++)
+        out[i] = Set1<V>(sha256_iv[i]);
+    Rounds(out, w, 0);
+    for (int i = 0; i < 8; i++)
+        out[i] = Add(out[i], Set1<V>(sha256_iv[i]));
+}
+
+// Double SHA256 of 64 byte messages given as big endian words in w,
+//   which are clobbered.
+template<typename V>
+inline void D64Hash(V w[16], V out[8])
+{
+    V s[8], t[8];
+
+    for (int i = 0; i < 8; i++)
+        s[i] = Set1<V>(sha256_iv[i]);
+    Rounds(s, w, 0);
+    for (int i = 0; i < 8; i++)
+        t[i] = s[i] = Add(s[i], Set1<V>(sha256_iv[i]));
+
+    // Padding block of 64 byte message
+    w[0] = Set1<V>(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = Set1<V>(0);
+    w[15] = Set1<V>(64 * 8);
+    Rounds(t, w, 0);
+    for (int i = 0; i < 8; i++)
+        t[i] = Add(t[i], s[i]);
+
+    Hash32(t, out);
+}
+
+// Double SHA256 of the kernel, where vTime holds the byte-swapped nTimeTx
+//   for every lane. Output words are in SHA256 (big endian) order.
+template<typename V>
+inline void KernelHash(const sha256_kernel_ctx *ctx, V vTime, V out[8])
+{
+    V w[16], s[8];
+
+    // First pass: 28 byte message, padded to the single block
+    for (int i = 0; i < 6; i++)
+        w[i] = Set1<V>(ctx->w[i]);
+    w[6] = vTime;
+    w[7] = Set1<V>(0x80000000);
+    for (int i = 8; i < 15; i++)
+        w[i] = Set1<V>(0);
+    w[15] = Set1<V>(28 * 8);
+
+    for (int i = 0; i < 8; i++)
+        s[i] = Set1<V>(ctx->state[i]);
+    Rounds(s, w, 6);
+    for (int i = 0; i < 8; i++)
+        s[i] = Add(s[i], Set1<V>(sha256_iv[i]));
+
+    // Second pass over the 32 byte digest
+    Hash32(s, out);
+}
+
+} // namespace
+
+#endif // NOVACOIN_SHA256_LANES_H
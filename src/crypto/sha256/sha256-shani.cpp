@@ -0,0 +1,61 @@
+/*
+ * SHA256 block transform using the Intel SHA extensions. This file is
+ * compiled with SHA-NI code generation enabled and is only called after
+ * the CPU support has been checked at runtime.
+ */
+
+#include <immintrin.h>
+#include <stddef.h>
+
+#include "crypto/sha256/sha256-common.h"
+
+void sha256_transform_shani(uint32_t *s, const unsigned char *chunk, size_t nBlocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // State is kept as ABEF and CDGH
+    __m128i TMP = _mm_loadu_si128((const __m128i *)&s[0]);
+    __m128i STATE1 = _mm_loadu_si128((const __m128i *)&s[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);                 // CDAB
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);           // EFGH
+    __m128i STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);   // ABEF
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);        // CDGH
+
+    while (nBlocks--)
+    {
+        const __m128i ABEF_SAVE = STATE0;
+        const __m128i CDGH_SAVE = STATE1;
+
+        __m128i MSGS[4];
+        for (int i = 0; i < 4; i++)
+            MSGS[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(chunk + 16 * i)), MASK);
+
+        // Four rounds per group, message schedule runs a few groups ahead
+        for (int g = 0; g < 16; g++)
+        {
+            __m128i MSG = _mm_add_epi32(MSGS[g & 3], _mm_loadu_si128((const __m128i *)&sha256_k[4 * g]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            if (g >= 3 && g <= 14)
+            {
+                TMP = _mm_alignr_epi8(MSGS[g & 3], MSGS[(g - 1) & 3], 4);
+                MSGS[(g + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(MSGS[(g + 1) & 3], TMP), MSGS[g & 3]);
+            }
+            MSG = _mm_shuffle_epi32(MSG, 0x0E);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+            if (g >= 1 && g <= 12)
+                MSGS[(g - 1) & 3] = _mm_sha256msg1_epu32(MSGS[(g - 1) & 3], MSGS[g & 3]);
+        }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        chunk += 64;
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);              // FEBA
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);           // DCHG
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);        // DCBA
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);           // ABEF -> HGFE
+
+    _mm_storeu_si128((__m128i *)&s[0], STATE0);
+    _mm_storeu_si128((__m128i *)&s[4], STATE1);
+}
@@ -0,0 +1,512 @@
+/*
+ * SHA256: generic and SSE2 (NEON through sse2neon.h) implementations of
+ * the block transform, double SHA256 of 64 byte messages and proof-of-stake
+ * kernel hashing, plus runtime selection of the SHA-NI and AVX2 ones.
+ */
+
+#ifdef USE_INTRIN
+#ifdef __ARM_NEON
+#include <sse2neon.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
+#if defined(USE_AVX2) || defined(USE_SHANI)
+#include <cpuid.h>
+#include <mutex>
+#endif
+
+#include <string.h>
+#include <vector>
+
+#include "sha256.h"
+
+namespace {
+
+// Generic single lane operations
+
+inline uint32_t Add(uint32_t x, uint32_t y) { return x + y; }
+inline uint32_t Xor(uint32_t x, uint32_t y) { return x ^ y; }
+inline uint32_t And(uint32_t x, uint32_t y) { return x & y; }
+inline uint32_t Or(uint32_t x, uint32_t y) { return x | y; }
+inline uint32_t Shr(uint32_t x, int n) { return x >> n; }
+inline uint32_t Shl(uint32_t x, int n) { return x << n; }
+
+template<typename V> inline V Set1(uint32_t x);
+template<> inline uint32_t Set1<uint32_t>(uint32_t x) { return x; }
+
+#ifdef USE_INTRIN
+// Four lane SSE2 operations
+
+inline __m128i Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+inline __m128i Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+inline __m128i And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+inline __m128i Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+inline __m128i Shr(__m128i x, int n) { return _mm_srli_epi32(x, n); }
+inline __m128i Shl(__m128i x, int n) { return _mm_slli_epi32(x, n); }
+
+template<> inline __m128i Set1<__m128i>(uint32_t x) { return _mm_set1_epi32((int)x); }
+#endif
+
+} // namespace
+
+#include "crypto/sha256/sha256-lanes.h"
+
+#if defined(USE_SHANI)
+// Implemented in sha256-shani.cpp
+void sha256_transform_shani(uint32_t *s, const unsigned char *chunk, size_t nBlocks);
+#endif
+
+#if defined(USE_AVX2)
+// Implemented in sha256-avx2.cpp
+void sha256d64_avx2(unsigned char *out, const unsigned char *in);
+void sha256_kernel_hash8_avx2(const sha256_kernel_ctx *ctx, uint32_t nTimeTx, uint32_t hashes[KERNEL_SHA256_LANES][8]);
+#endif
+
+//
+// Block transform
+//
+
+static void sha256_transform_generic(uint32_t *s, const unsigned char *chunk, size_t nBlocks)
+{
+    while (nBlocks--)
+    {
+        uint32_t w[16], t[8];
+        for (int i = 0; i < 16; i++)
+            w[i] = ReadBE32(chunk + 4 * i);
+        for (int i = 0; i < 8; i++)
+            t[i] = s[i];
+        Rounds(t, w, 0);
+        for (int i = 0; i < 8; i++)
+            s[i] += t[i];
+        chunk += 64;
+    }
+}
+
+//
+// Double SHA256 of 64 byte messages, one, four and eight at a time
+//
+
+static void sha256d64_generic(unsigned char *out, const unsigned char *in)
+{
+    uint32_t w[16], h[8];
+    for (int i = 0; i < 16; i++)
+        w[i] = ReadBE32(in + 4 * i);
+    D64Hash(w, h);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, h[i]);
+}
+
+#ifdef USE_INTRIN
+static void sha256d64_sse2(unsigned char *out, const unsigned char *in)
+{
+    __m128i w[16], h[8];
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set_epi32(
+            (int)ReadBE32(in + 192 + 4 * i), (int)ReadBE32(in + 128 + 4 * i),
+            (int)ReadBE32(in + 64 + 4 * i), (int)ReadBE32(in + 4 * i));
+    D64Hash(w, h);
+
+    uint32_t words[8][4];
+    for (int i = 0; i < 8; i++)
+        _mm_storeu_si128((__m128i *)words[i], h[i]);
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + 32 * j + 4 * i, words[i][j]);
+}
+#endif
+
+//
+// Proof-of-stake kernel
+//
+
+void sha256_kernel_init(sha256_kernel_ctx *ctx, const uint8_t *prefix)
+{
+    uint32_t w[16];
+    for (int i = 0; i < 6; i++)
+        ctx->w[i] = w[i] = ReadBE32(prefix + 4 * i);
+
+    // These rounds don't depend on nTimeTx
+    for (int i = 0; i < 8; i++)
+        ctx->state[i] = sha256_iv[i];
+    Rounds(ctx->state, w, 0, 6);
+}
+
+static void sha256_kernel_hash8_generic(const sha256_kernel_ctx *ctx, uint32_t nTimeTx, uint32_t hashes[KERNEL_SHA256_LANES][8])
+{
+    for (int nLane = 0; nLane < KERNEL_SHA256_LANES; nLane++)
+    {
+        uint32_t out[8];
+        KernelHash(ctx, sha256_bswap32(nTimeTx + nLane), out);
+        for (int i = 0; i < 8; i++)
+            hashes[nLane][i] = sha256_bswap32(out[i]);
+    }
+}
+
+#ifdef USE_INTRIN
+static void sha256_kernel_hash8_sse2(const sha256_kernel_ctx *ctx, uint32_t nTimeTx, uint32_t hashes[KERNEL_SHA256_LANES][8])
+{
+    for (int nLane = 0; nLane < KERNEL_SHA256_LANES; nLane += 4)
+    {
+        __m128i vTime = _mm_set_epi32(
+            (int)sha256_bswap32(nTimeTx + nLane + 3), (int)sha256_bswap32(nTimeTx + nLane + 2),
+            (int)sha256_bswap32(nTimeTx + nLane + 1), (int)sha256_bswap32(nTimeTx + nLane));
+
+        __m128i out[8];
+        KernelHash(ctx, vTime, out);
+
+        uint32_t words[8][4];
+        for (int i = 0; i < 8; i++)
+            _mm_storeu_si128((__m128i *)words[i], out[i]);
+        for (int j = 0; j < 4; j++)
+            for (int i = 0; i < 8; i++)
+                hashes[nLane + j][i] = sha256_bswap32(words[i][j]);
+    }
+}
+#endif
+
+//
+// Runtime selection
+//
+
+typedef void (*transform_fn)(uint32_t *, const unsigned char *, size_t);
+typedef void (*d64_fn)(unsigned char *, const unsigned char *);
+typedef void (*kernel_hash8_fn)(const sha256_kernel_ctx *, uint32_t, uint32_t[KERNEL_SHA256_LANES][8]);
+
+// Defaults are valid before SHA256AutoDetect() has been called
+static transform_fn transform = sha256_transform_generic;
+static d64_fn d64_4way = nullptr;
+static d64_fn d64_8way = nullptr;
+#ifdef USE_INTRIN
+static kernel_hash8_fn kernel_hash8 = sha256_kernel_hash8_sse2;
+#ifdef __ARM_NEON
+static const char* pszKernelImpl = "neon";
+#else
+static const char* pszKernelImpl = "sse2";
+#endif
+#else
+static kernel_hash8_fn kernel_hash8 = sha256_kernel_hash8_generic;
+static const char* pszKernelImpl = "generic";
+#endif
+
+#if defined(USE_AVX2) || defined(USE_SHANI)
+static bool fHaveSHANI = false;
+static bool fHaveAVX2 = false;
+
+static void DetectCPUFeatures()
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return;
+    bool fSSSE3 = (ecx >> 9) & 1;
+    bool fSSE41 = (ecx >> 19) & 1;
+    bool fAVX = false;
+    if (((ecx >> 27) & 1) && ((ecx >> 28) & 1))
+    {
+        // OSXSAVE and AVX, check that the OS saves YMM registers
+        uint32_t a, d;
+        __asm__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+        fAVX = (a & 6) == 6;
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return;
+    fHaveAVX2 = fAVX && ((ebx >> 5) & 1);
+    fHaveSHANI = fSSSE3 && fSSE41 && ((ebx >> 29) & 1);
+}
+
+static void DetectCPUFeaturesOnce()
+{
+    static std::once_flag detected;
+    std::call_once(detected, DetectCPUFeatures);
+}
+#endif
+
+bool CPUSupportsAVX2()
+{
+#if defined(USE_AVX2)
+    DetectCPUFeaturesOnce();
+    return fHaveAVX2;
+#else
+    return false;
+#endif
+}
+
+std::string SHA256AutoDetect()
+{
+    std::string strRet = "generic";
+#if defined(USE_AVX2) || defined(USE_SHANI)
+    DetectCPUFeaturesOnce();
+#endif
+
+#if defined(USE_SHANI)
+    if (fHaveSHANI)
+    {
+        // A single SHA-NI stream outruns the interleaved lanes
+        transform = sha256_transform_shani;
+        strRet = "shani(1way)";
+    }
+#endif
+
+    if (transform == sha256_transform_generic)
+    {
+#ifdef USE_INTRIN
+        d64_4way = sha256d64_sse2;
+        strRet += ",sse2(4way)";
+#endif
+#if defined(USE_AVX2)
+        if (fHaveAVX2)
+        {
+            d64_8way = sha256d64_avx2;
+            strRet += ",avx2(8way)";
+        }
+#endif
+    }
+
+#if defined(USE_AVX2)
+    if (fHaveAVX2)
+    {
+        kernel_hash8 = sha256_kernel_hash8_avx2;
+        pszKernelImpl = "avx2";
+    }
+#endif
+
+    return strRet + "; kernel " + pszKernelImpl;
+}
+
+//
+// Public interface
+//
+
+CSHA256::CSHA256()
+{
+    Reset();
+}
+
+CSHA256& CSHA256::Reset()
+{
+    memcpy(s, sha256_iv, sizeof(s));
+    bytes = 0;
+    return *this;
+}
+
+CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    size_t nBufSize = bytes % 64;
+    if (nBufSize && nBufSize + len >= 64)
+    {
+        // Complete the buffered block
+        memcpy(buf + nBufSize, data, 64 - nBufSize);
+        bytes += 64 - nBufSize;
+        data += 64 - nBufSize;
+        transform(s, buf, 1);
+        nBufSize = 0;
+    }
+    if (end - data >= 64)
+    {
+        size_t nBlocks = (end - data) / 64;
+        transform(s, data, nBlocks);
+        data += 64 * nBlocks;
+        bytes += 64 * nBlocks;
+    }
+    if (end > data)
+    {
+        memcpy(buf + nBufSize, data, end - data);
+        bytes += end - data;
+    }
+    return *this;
+}
+
+void CSHA256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    static const unsigned char pad[64] = {0x80};
+    unsigned char sizedesc[8];
+    WriteBE32(sizedesc, (uint32_t)(bytes >> 29));
+    WriteBE32(sizedesc + 4, (uint32_t)(bytes << 3));
+    Write(pad, 1 + ((119 - (bytes % 64)) % 64));
+    Write(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + 4 * i, s[i]);
+}
+
+void SHA256Hash32(unsigned char out[32], const unsigned char in[32])
+{
+    unsigned char block[64] = {0};
+    memcpy(block, in, 32);
+    block[32] = 0x80;
+    block[62] = 0x01; // 256 bits
+
+    uint32_t h[8];
+    memcpy(h, sha256_iv, sizeof(h));
+    transform(h, block, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, h[i]);
+}
+
+static void sha256d64_transform(transform_fn fn, unsigned char *out, const unsigned char *in)
+{
+    static const unsigned char pad[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0}; // 512 bits
+    unsigned char block[64] = {0};
+    uint32_t h[8];
+
+    memcpy(h, sha256_iv, sizeof(h));
+    fn(h, in, 1);
+    fn(h, pad, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(block + 4 * i, h[i]);
+    block[32] = 0x80;
+    block[62] = 0x01;
+
+    memcpy(h, sha256_iv, sizeof(h));
+    fn(h, block, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, h[i]);
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks)
+{
+    if (d64_8way)
+    {
+        for (; nBlocks >= 8; nBlocks -= 8, out += 256, in += 512)
+            d64_8way(out, in);
+    }
+    if (d64_4way)
+    {
+        for (; nBlocks >= 4; nBlocks -= 4, out += 128, in += 256)
+            d64_4way(out, in);
+    }
+    for (; nBlocks > 0; nBlocks--, out += 32, in += 64)
+        sha256d64_transform(transform, out, in);
+}
+
+void sha256_kernel_hash8(const sha256_kernel_ctx *ctx, uint32_t nTimeTx, uint32_t hashes[KERNEL_SHA256_LANES][8])
+{
+    kernel_hash8(ctx, nTimeTx, hashes);
+}
+
+const char* sha256_kernel_impl()
+{
+    return pszKernelImpl;
+}
+
+//
+// Self test
+//
+
+// SHA256 of a short message (up to 119 bytes) with the given transform
+static void sha256_short(transform_fn fn, const unsigned char *data, size_t len, unsigned char out[32])
+{
+    unsigned char block[128] = {0};
+    size_t nBlocks = len < 56 ? 1 : 2;
+    memcpy(block, data, len);
+    block[len] = 0x80;
+    WriteBE32(block + 64 * nBlocks - 4, (uint32_t)(len << 3));
+
+    uint32_t h[8];
+    memcpy(h, sha256_iv, sizeof(h));
+    fn(h, block, nBlocks);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, h[i]);
+}
+
+static bool SelfTestTransform(transform_fn fn)
+{
+    static const struct { const char *pszMsg; unsigned char hash[32]; } vectors[] = {
+        {"", {0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+              0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55}},
+        {"abc", {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+                 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad}},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            {0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+             0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1}},
+    };
+
+    for (const auto& v : vectors)
+    {
+        unsigned char hash[32];
+        sha256_short(fn, (const unsigned char *)v.pszMsg, strlen(v.pszMsg), hash);
+        if (memcmp(hash, v.hash, 32) != 0)
+            return false;
+    }
+    return true;
+}
+
+bool SHA256SelfTest()
+{
+    // Generic transform is checked against the published vectors, then
+    //   serves as the reference for everything else.
+    if (!SelfTestTransform(sha256_transform_generic))
+        return false;
+#if defined(USE_SHANI)
+    if (fHaveSHANI && !SelfTestTransform(sha256_transform_shani))
+        return false;
+#endif
+
+    // Eight different 64 byte messages
+    unsigned char data[8 * 64], expected[8 * 32], out[8 * 32];
+    for (int i = 0; i < 8 * 64; i++)
+        data[i] = (unsigned char)(i * 0x9d + (i >> 6));
+    for (int i = 0; i < 8; i++)
+        sha256d64_transform(sha256_transform_generic, expected + 32 * i, data + 64 * i);
+
+    for (int i = 0; i < 8; i++)
+        sha256d64_generic(out + 32 * i, data + 64 * i);
+    if (memcmp(out, expected, sizeof(out)) != 0)
+        return false;
+#ifdef USE_INTRIN
+    sha256d64_sse2(out, data);
+    sha256d64_sse2(out + 128, data + 256);
+    if (memcmp(out, expected, sizeof(out)) != 0)
+        return false;
+#endif
+#if defined(USE_AVX2)
+    if (fHaveAVX2)
+    {
+        sha256d64_avx2(out, data);
+        if (memcmp(out, expected, sizeof(out)) != 0)
+            return false;
+    }
+#endif
+    // Whatever SHA256D64 dispatches to, including the tail
+    memset(out, 0, sizeof(out));
+    SHA256D64(out, data, 8);
+    if (memcmp(out, expected, sizeof(out)) != 0)
+        return false;
+    SHA256D64(out, data, 7);
+    if (memcmp(out, expected, 7 * 32) != 0)
+        return false;
+
+    // Kernel lanes against the plain double SHA256 of the kernel
+    unsigned char kernels[KERNEL_SHA256_LANES][32];
+    uint32_t nTimeTx = 0x5f5e1000;
+    for (int nLane = 0; nLane < KERNEL_SHA256_LANES; nLane++)
+    {
+        unsigned char kernel[28], hash1[32];
+        uint32_t nTime = nTimeTx + nLane;
+        memcpy(kernel, data, 24);
+        memcpy(kernel + 24, &nTime, 4);
+        sha256_short(sha256_transform_generic, kernel, sizeof(kernel), hash1);
+        sha256_short(sha256_transform_generic, hash1, sizeof(hash1), kernels[nLane]);
+    }
+
+    std::vector<kernel_hash8_fn> vKernelImpl = { sha256_kernel_hash8_generic, kernel_hash8 };
+#ifdef USE_INTRIN
+    vKernelImpl.push_back(sha256_kernel_hash8_sse2);
+#endif
+    sha256_kernel_ctx ctx;
+    sha256_kernel_init(&ctx, data);
+    for (kernel_hash8_fn fn : vKernelImpl)
+    {
+        uint32_t hashes[KERNEL_SHA256_LANES][8];
+        fn(&ctx, nTimeTx, hashes);
+        if (memcmp(hashes, kernels, sizeof(kernels)) != 0)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,132 @@
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_DIGESTCACHE_H
+#define NOVACOIN_DIGESTCACHE_H
+
+#include "uint256.h"
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+/** Fixed-memory set of 256-bit digests.
+ *
+ * Entries are kept in 8-way buckets of a flat table, a full bucket drops
+ * a victim picked from the key bits and an insertion counter. Keys must be
+ * salted hashes: the table is indexed by key bits directly, which also keeps
+ * the eviction order unpredictable for anyone who doesn't know the salt.
+ *
+ * Buckets are guarded by a fixed array of lock stripes, lookups only take
+ * a shared lock of a single stripe.
+ */
+class CDigestCache
+{
+public:
+    static const unsigned int WAYS = 8;
+    static const unsigned int STRIPES = 64;
+
+private:
+    struct CBucket
+    {
+        uint256 entries[WAYS];
+    };
+
+    std::vector<CBucket> vBuckets;
+    mutable std::shared_mutex csStripes[STRIPES];
+
+    mutable std::atomic<uint64_t> nHits;
+    mutable std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nInserts;
+    std::atomic<uint64_t> nEvictions;
+    std::atomic<uint32_t> nCounter;
+
+    size_t BucketIndex(const uint256& key) const
+    {
+        // Multiply-shift reduction, bucket count doesn't have to be a power of two
+        return (size_t)(((uint64_t)key.Get32(0) * vBuckets.size()) >> 32);
+    }
+
+public:
+    CDigestCache() : nHits(0), nMisses(0), nInserts(0), nEvictions(0), nCounter(0) { }
+
+    // Reallocate the table for at most nBytes of memory, dropping all
+    //   entries. Not thread safe, must be called before the cache is shared.
+    //   Returns the number of entries that fit into the table.
+    size_t Resize(size_t nBytes)
+    {
+        std::vector<CBucket> vNew(nBytes / sizeof(CBucket));
+        vBuckets.swap(vNew);
+        return vBuckets.size() * WAYS;
+    }
+
+    bool Contains(const uint256& key) const
+    {
+        if (vBuckets.empty())
+            return false;
+
+        size_t nBucket = BucketIndex(key);
+        const CBucket& bucket = vBuckets[nBucket];
+        {
+            std::shared_lock<std::shared_mutex> lock(csStripes[nBucket % STRIPES]);
+            for (unsigned int i = 0; i < WAYS; i++)
+                if (bucket.entries[i] == key)
+                {
+                    nHits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+        }
+        nMisses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void Insert(const uint256& key)
+    {
+        // Zero marks an empty slot
+        if (vBuckets.empty() || key == 0)
+            return;
+
+        size_t nBucket = BucketIndex(key);
+        CBucket& bucket = vBuckets[nBucket];
+        std::unique_lock<std::shared_mutex> lock(csStripes[nBucket % STRIPES]);
+
+        int nFree = -1;
+        for (unsigned int i = 0; i < WAYS; i++)
+        {
+            if (bucket.entries[i] == key)
+                return;
+            if (nFree < 0 && bucket.entries[i] == 0)
+                nFree = i;
+        }
+
+        if (nFree < 0)
+        {
+            nFree = (key.Get32(1) + nCounter.fetch_add(1, std::memory_order_relaxed)) % WAYS;
+            nEvictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        bucket.entries[nFree] = key;
+        nInserts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Erase(const uint256& key)
+    {
+        if (vBuckets.empty())
+            return;
+
+        size_t nBucket = BucketIndex(key);
+        CBucket& bucket = vBuckets[nBucket];
+        std::unique_lock<std::shared_mutex> lock(csStripes[nBucket % STRIPES]);
+        for (unsigned int i = 0; i < WAYS; i++)
+            if (bucket.entries[i] == key)
+                bucket.entries[i] = 0;
+    }
+
+    size_t Capacity() const { return vBuckets.size() * WAYS; }
+    size_t MemoryUsage() const { return vBuckets.size() * sizeof(CBucket); }
+    uint64_t Hits() const { return nHits.load(std::memory_order_relaxed); }
+    uint64_t Misses() const { return nMisses.load(std::memory_order_relaxed); }
+    uint64_t Inserts() const { return nInserts.load(std::memory_order_relaxed); }
+    uint64_t Evictions() const { return nEvictions.load(std::memory_order_relaxed); }
+};
+
+#endif // NOVACOIN_DIGESTCACHE_H
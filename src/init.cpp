@@ -14,6 +14,9 @@
 #include "ipcollector.h"
 #include "interface.h"
 #include "checkpoints.h"
+#include "miner.h"
+#include "kernel_worker.h"
+#include "scrypt.h"
 
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -90,6 +93,8 @@ void Shutdown(void* parg)
         bitdb.Flush(false);
         StopRPCServer();
         StopNode();
+        WaitKernelScanThreads();
+        CTxDB::Flush();
         bitdb.Flush(true);
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
@@ -238,7 +243,10 @@ std::string HelpMessage()
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -wallet=<file>         " + _("Specify wallet file (within data directory)") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -dbflush=<n>           " + _("Write cached database changes once they take <n> megabytes, at most 3/8 of -dbcache (default: 3/8 of -dbcache)") + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
+        "  -mapblockfiles         " + _("Map finished block files into memory for reading (default: 1 on 64-bit systems)") + "\n" +
+        "  -sigcachesize=<n>      " + _("Set signature and script cache size in megabytes (default: 32, maximum: 1024)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -300,7 +308,11 @@ std::string HelpMessage()
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
+        "  -checktargetarith      " + _("Verify fixed-width target arithmetic against bignum results (slow, for testing)") + "\n" +
         "  -par=N                 " + _("Set the number of script verification threads (1-16, 0=auto, default: 0)") + "\n" +
+        "  -stakerthreads=N       " + _("Set the number of stake scanner threads (0=auto, default: 0)") + "\n" +
+        "  -gen                   " + _("Generate proof-of-work blocks (default: 0)") + "\n" +
+        "  -genproclimit=<n>      " + _("Set the number of proof-of-work miner threads (-1=auto, default: -1)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
@@ -370,7 +382,9 @@ bool AppInit2()
 
     nNodeLifespan = GetArgUInt("-addrlifespan", 7);
     fUseFastIndex = GetBoolArg("-fastindex", true);
+    fCheckTargetArith = GetBoolArg("-checktargetarith");
     fUseMemoryLog = GetBoolArg("-memorylog", true);
+    blockFilePool.SetMapFiles(GetBoolArg("-mapblockfiles", sizeof(void*) >= 8));
 
     // Ping and address broadcast intervals
     nPingInterval = std::max<int64_t>(10 * 60, GetArg("-keepalive", 30 * 60));
@@ -444,6 +458,22 @@ bool AppInit2()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -sigcachesize is in megabytes, 0 disables the caches. Memory is
+    // split evenly between signature and script execution caches.
+    int64_t nMaxSigCacheSize = GetArg("-sigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+    nMaxSigCacheSize = std::max<int64_t>(0, std::min(nMaxSigCacheSize, MAX_MAX_SIG_CACHE_SIZE));
+    size_t nSigCacheBytes = (size_t)nMaxSigCacheSize << 19;
+    if (mapArgs.count("-maxsigcachesize") && !mapArgs.count("-sigcachesize"))
+    {
+        // Deprecated, the number of signatures to cache. An entry takes
+        // 32 bytes in each of the caches now.
+        int64_t nEntries = std::max<int64_t>(0, std::min(GetArg("-maxsigcachesize", 0), MAX_MAX_SIG_CACHE_SIZE << 14));
+        nSigCacheBytes = (size_t)nEntries * 32;
+        printf("Warning: -maxsigcachesize is deprecated, use -sigcachesize in megabytes. Caching %" PRId64 " entries.\n", nEntries);
+    }
+    size_t nSigCacheEntries = InitSignatureCache(nSigCacheBytes);
+    size_t nScriptCacheEntries = InitScriptExecutionCache(nSigCacheBytes);
+
     fDebug = GetBoolArg("-debug");
 
     // -debug implies fDebug*
@@ -542,6 +572,10 @@ bool AppInit2()
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("NovaCoin version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    printf("Using SHA256 implementation: %s\n", SHA256AutoDetect().c_str());
+    printf("Using scrypt batch implementation: %s\n", scrypt_batch_impl());
+    if (!SHA256SelfTest())
+        return InitError(_("SHA256 self-test failed, refusing to start with a broken hash implementation."));
     if (!fLogTimestamps)
         printf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
@@ -551,6 +585,7 @@ bool AppInit2()
     if (fDaemon)
         fprintf(stdout, "NovaCoin server starting\n");
 
+    printf("Using %" PRId64 " MiB for signature and script caches (%" PRIszu " signatures, %" PRIszu " transactions)\n", (int64_t)(nSigCacheBytes >> 19), nSigCacheEntries, nScriptCacheEntries);
     if (nScriptCheckThreads) {
         printf("Using %u threads for script verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
@@ -928,6 +963,9 @@ bool AppInit2()
 
     // ********************************************************* Step 9: import blocks
 
+    uiInterface.InitMessage(_("Replaying blocks..."));
+    ReplayBlockFiles();
+
     if (mapArgs.count("-loadblock"))
     {
         uiInterface.InitMessage(_("Importing blockchain data file."));
@@ -989,6 +1027,10 @@ bool AppInit2()
     if (fServer)
         StartRPCServer();
 
+    // Generate proof-of-work blocks, mostly useful on test networks
+    if (GetBoolArg("-gen"))
+        GeneratePoWBlocks(true, GetArgInt("-genproclimit", -1), pwalletMain);
+
     // ********************************************************* Step 13: IP collection thread
     strCollectorCommand = GetArg("-peercollector", "");
     if (!fTestNet && strCollectorCommand != "")
@@ -132,49 +132,62 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
-static bool SelectBlockFromCandidates(vector<pair<int64_t, uint256> >& vSortedByTimestamp, map<uint256, const CBlockIndex*>& mapSelectedBlocks,
-    int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev, const CBlockIndex** pindexSelected)
+// Candidate block for the stake modifier selection
+struct CModifierCandidate
+{
+    int64_t nTime;
+    uint256 hashBlock;
+    const CBlockIndex* pindex;
+    uint256 hashSelection;
+    bool fSelected;
+
+    // Same order as sorting of (time, hash) pairs
+    friend bool operator<(const CModifierCandidate& a, const CModifierCandidate& b)
+    {
+        return a.nTime < b.nTime || (a.nTime == b.nTime && a.hashBlock < b.hashBlock);
+    }
+};
+
+// compute the selection hash by hashing the block's proof-hash and the
+// previous proof-of-stake modifier
+static uint256 GetSelectionHash(const CBlockIndex* pindex, uint64_t nStakeModifierPrev)
+{
+    // Same bytes as serialization of (hashProof, nStakeModifierPrev)
+    unsigned char pchData[sizeof(uint256) + sizeof(uint64_t)];
+    uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
+    memcpy(pchData, hashProof.begin(), sizeof(uint256));
+    memcpy(pchData + sizeof(uint256), &nStakeModifierPrev, sizeof(uint64_t));
+    uint256 hashSelection = Hash(pchData, pchData + sizeof(pchData));
+    // the selection hash is divided by 2**32 so that proof-of-stake block
+    // is always favored over proof-of-work block. this is to preserve
+    // the energy efficiency property
+    if (pindex->IsProofOfStake())
+        hashSelection >>= 32;
+    return hashSelection;
+}
+
+// select a block from the candidate blocks in vCandidates sorted by timestamp,
+// excluding already selected blocks, and with timestamp up to
+// nSelectionIntervalStop. Selection hashes of the candidates are computed
+// in advance as they don't depend on the round.
+static bool SelectBlockFromCandidates(vector<CModifierCandidate>& vCandidates, int64_t nSelectionIntervalStop, CModifierCandidate** ppSelected)
 {
     bool fSelected = false;
-    uint256 hashBest = 0;
-    *pindexSelected = (const CBlockIndex*) 0;
-    for (const auto& item : vSortedByTimestamp)
+    *ppSelected = NULL;
+    for (auto& candidate : vCandidates)
     {
-        if (!mapBlockIndex.count(item.second))
-            return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString().c_str());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+        if (fSelected && candidate.nTime > nSelectionIntervalStop)
             break;
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+        if (candidate.fSelected)
             continue;
-        // compute the selection hash by hashing its proof-hash and the
-        // previous proof-of-stake modifier
-        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
-        CDataStream ss(SER_GETHASH, 0);
-        ss << hashProof << nStakeModifierPrev;
-        uint256 hashSelection = Hash(ss.begin(), ss.end());
-        // the selection hash is divided by 2**32 so that proof-of-stake block
-        // is always favored over proof-of-work block. this is to preserve
-        // the energy efficiency property
-        if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-        if (fSelected && hashSelection < hashBest)
-        {
-            hashBest = hashSelection;
-            *pindexSelected = pindex;
-        }
-        else if (!fSelected)
+        if (!fSelected || candidate.hashSelection < (*ppSelected)->hashSelection)
         {
             fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = pindex;
+            *ppSelected = &candidate;
         }
     }
     if (fDebug && GetBoolArg("-printstakemodifier"))
-        printf("SelectBlockFromCandidates: selection hash=%s\n", hashBest.ToString().c_str());
+        printf("SelectBlockFromCandidates: selection hash=%s\n", (fSelected ? (*ppSelected)->hashSelection : uint256(0)).ToString().c_str());
     return fSelected;
 }
 
@@ -240,35 +253,44 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     }
 
     // Sort candidate blocks by timestamp
-    vector<pair<int64_t, uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * nModifierInterval / nStakeTargetSpacing);
+    vector<CModifierCandidate> vCandidates;
+    vCandidates.reserve(64 * nModifierInterval / nStakeTargetSpacing);
     int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / nModifierInterval) * nModifierInterval - nSelectionInterval;
     const CBlockIndex* pindex = pindexPrev;
     while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
     {
-        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
+        CModifierCandidate candidate;
+        candidate.nTime = pindex->GetBlockTime();
+        candidate.hashBlock = pindex->GetBlockHash();
+        candidate.pindex = pindex;
+        candidate.hashSelection = GetSelectionHash(pindex, nStakeModifier);
+        candidate.fSelected = false;
+        vCandidates.push_back(candidate);
         pindex = pindex->pprev;
     }
     int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    reverse(vCandidates.begin(), vCandidates.end());
+    sort(vCandidates.begin(), vCandidates.end());
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    map<uint256, const CBlockIndex*> mapSelectedBlocks;
-    for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
+    vector<const CBlockIndex*> vSelectedBlocks;
+    for (int nRound=0; nRound<min(64, (int)vCandidates.size()); nRound++)
     {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        CModifierCandidate* pSelected;
+        if (!SelectBlockFromCandidates(vCandidates, nSelectionIntervalStop, &pSelected))
             return error("ComputeNextStakeModifier: unable to select block at round %d", nRound);
+        pindex = pSelected->pindex;
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
-        // add the selected block from candidates to selected list
-        mapSelectedBlocks.insert(make_pair(pindex->GetBlockHash(), pindex));
+        // exclude the selected block from further rounds
+        pSelected->fSelected = true;
+        vSelectedBlocks.push_back(pindex);
         if (fDebug && GetBoolArg("-printstakemodifier"))
             printf("ComputeNextStakeModifier: selected round %d stop=%s height=%d bit=%d\n", nRound, DateTimeStrFormat(nSelectionIntervalStop).c_str(), pindex->nHeight, pindex->GetStakeEntropyBit());
     }
@@ -287,11 +309,11 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
                 strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, "=");
             pindex = pindex->pprev;
         }
-        for (const auto& item : mapSelectedBlocks)
+        for (const CBlockIndex* pindexSelected : vSelectedBlocks)
         {
             // 'S' indicates selected proof-of-stake blocks
             // 'W' indicates selected proof-of-work blocks
-            strSelectionMap.replace(item.second->nHeight - nHeightFirstCandidate, 1, item.second->IsProofOfStake()? "S" : "W");
+            strSelectionMap.replace(pindexSelected->nHeight - nHeightFirstCandidate, 1, pindexSelected->IsProofOfStake()? "S" : "W");
         }
         printf("ComputeNextStakeModifier: selection height [%d, %d] map %s\n", nHeightFirstCandidate, pindexPrev->nHeight, strSelectionMap.c_str());
     }
@@ -305,11 +327,49 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     return true;
 }
 
+// Kernel stake modifiers found by GetKernelStakeModifier(). An entry depends
+// on the main chain from the block up to nLastHeight, where the search has
+// stopped, so it's dropped when any of these blocks is disconnected.
+struct CKernelStakeModifier
+{
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+    int nLastHeight;
+};
+
+static const size_t MAX_STAKE_MODIFIER_CACHE_SIZE = 100000;
+static std::map<uint256, CKernelStakeModifier> mapKernelStakeModifiers;
+static CCriticalSection cs_mapKernelStakeModifiers;
+
+void InvalidateKernelStakeModifiers(int nHeight)
+{
+    LOCK(cs_mapKernelStakeModifiers);
+    for (auto it = mapKernelStakeModifiers.begin(); it != mapKernelStakeModifiers.end(); )
+    {
+        if (it->second.nLastHeight >= nHeight)
+            mapKernelStakeModifiers.erase(it++);
+        else
+            it++;
+    }
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 static bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
+    {
+        LOCK(cs_mapKernelStakeModifiers);
+        auto mi = mapKernelStakeModifiers.find(hashBlockFrom);
+        if (mi != mapKernelStakeModifiers.end())
+        {
+            nStakeModifier = mi->second.nStakeModifier;
+            nStakeModifierHeight = mi->second.nStakeModifierHeight;
+            nStakeModifierTime = mi->second.nStakeModifierTime;
+            return true;
+        }
+    }
     if (!mapBlockIndex.count(hashBlockFrom))
         return error("GetKernelStakeModifier() : block not indexed");
     const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
@@ -336,6 +396,16 @@ static bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifi
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+
+    // Only blocks of the main chain may be cached, the search above doesn't
+    //   leave the block it has started from otherwise
+    if (pindexFrom->IsInMainChain())
+    {
+        LOCK(cs_mapKernelStakeModifiers);
+        if (mapKernelStakeModifiers.size() >= MAX_STAKE_MODIFIER_CACHE_SIZE)
+            mapKernelStakeModifiers.erase(mapKernelStakeModifiers.begin());
+        mapKernelStakeModifiers[hashBlockFrom] = {nStakeModifier, nStakeModifierHeight, nStakeModifierTime, pindex->nHeight};
+    }
     return true;
 }
 
@@ -348,6 +418,7 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier)
 }
 
 
+
 // ppcoin kernel protocol
 // coinstake must meet hash target according to the protocol:
 // kernel (input 0) must meet the formula
@@ -378,15 +449,14 @@ bool CheckStakeKernelHash(uint32_t nBits, const CBlock& blockFrom, uint32_t nTxP
     if (nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
         return error("CheckStakeKernelHash() : min age violation");
 
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 targetPerCoinDay;
+    targetPerCoinDay.SetCompact(nBits, &fNegative, &fOverflow);
     int64_t nValueIn = txPrev.vout[prevout.n].nValue;
+    int64_t nTimeWeight = GetWeight((int64_t)txPrev.nTime, (int64_t)nTimeTx);
 
     uint256 hashBlockFrom = blockFrom.GetHash();
 
-    CBigNum bnCoinDayWeight = CBigNum(nValueIn) * GetWeight((int64_t)txPrev.nTime, (int64_t)nTimeTx) / COIN / nOneDay;
-    targetProofOfStake = (bnCoinDayWeight * bnTargetPerCoinDay).getuint256();
-
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
     uint64_t nStakeModifier = 0;
@@ -399,6 +469,20 @@ bool CheckStakeKernelHash(uint32_t nBits, const CBlock& blockFrom, uint32_t nTxP
 
     ss << nTimeBlockFrom << nTxPrevOffset << txPrev.nTime << prevout.n << nTimeTx;
     hashProofOfStake = Hash(ss.begin(), ss.end());
+
+    // Encodings which don't fit into 256 bits are left to bignum arithmetic
+    bool fMeetsTarget;
+    if (fNegative || fOverflow)
+    {
+        CBigNum bnTargetPerCoinDay;
+        bnTargetPerCoinDay.SetCompact(nBits);
+        CBigNum bnTargetProofOfStake = CBigNum(nValueIn) * nTimeWeight / COIN / nOneDay * bnTargetPerCoinDay;
+        targetProofOfStake = bnTargetProofOfStake.getuint256();
+        fMeetsTarget = CBigNum(hashProofOfStake) <= bnTargetProofOfStake;
+    }
+    else
+        fMeetsTarget = CheckKernelTarget(hashProofOfStake, targetPerCoinDay, nValueIn, nTimeWeight, &targetProofOfStake);
+
     if (fPrintProofOfStake)
     {
         printf("CheckStakeKernelHash() : using modifier 0x%016" PRIx64 " at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
@@ -413,7 +497,7 @@ bool CheckStakeKernelHash(uint32_t nBits, const CBlock& blockFrom, uint32_t nTxP
     }
 
     // Now check if proof-of-stake hash meets target protocol
-    if (CBigNum(hashProofOfStake) > bnCoinDayWeight * bnTargetPerCoinDay)
+    if (!fMeetsTarget)
         return false;
     if (fDebug && !fPrintProofOfStake)
     {
@@ -430,51 +514,6 @@ bool CheckStakeKernelHash(uint32_t nBits, const CBlock& blockFrom, uint32_t nTxP
     return true;
 }
 
-// Scan given kernel for solution
-bool ScanKernelForward(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, std::pair<uint32_t, uint32_t> &SearchInterval, std::vector<std::pair<uint256, uint32_t> > &solutions)
-{
-    // TODO: custom threads amount
-
-    uint32_t nThreads = boost::thread::hardware_concurrency();
-    if (nThreads == 0)
-    {
-       nThreads = 1;
-       printf("Warning: hardware_concurrency() failed in %s:%d\n", __FILE__, __LINE__);
-    }
-    uint32_t nPart = (SearchInterval.second - SearchInterval.first) / nThreads;
-
-    KernelWorker *workers = new KernelWorker[nThreads];
-
-    boost::thread_group group;
-    for(size_t i = 0; i < nThreads; i++)
-    {
-        uint32_t nBegin = SearchInterval.first + nPart * i;
-        uint32_t nEnd = SearchInterval.first + nPart * (i + 1);
-        workers[i] = KernelWorker(kernel, nBits, nInputTxTime, nValueIn, nBegin, nEnd);
-        boost::function<void()> workerFnc = boost::bind(&KernelWorker::Do, &workers[i]);
-        group.create_thread(workerFnc);
-    }
-
-    group.join_all();
-    solutions.clear();
-
-    for(size_t i = 0; i < nThreads; i++)
-    {
-        std::vector<std::pair<uint256, uint32_t> > ws = workers[i].GetSolutions();
-        solutions.insert(solutions.end(), ws.begin(), ws.end());
-    }
-
-    delete [] workers;
-
-    if (solutions.size() == 0)
-    {
-        // no solutions
-        return false;
-    }
-
-    return true;
-}
-
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(const CTransaction& tx, unsigned int nBits, uint256& hashProofOfStake, uint256& targetProofOfStake)
 {
@@ -33,10 +33,21 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
 // modifier about a selection interval later than the coin generating the kernel
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier);
 
+// Forget cached kernel stake modifiers which depend on the blocks at
+// nHeight and above, called when these blocks leave the main chain
+void InvalidateKernelStakeModifiers(int nHeight);
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, uint32_t nTxPrevOffset, const CTransaction& txPrev, const COutPoint& prevout, uint32_t nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake=false);
 
+// Maximum target which could be met by nValueIn coins at full weight
+uint256 GetKernelMaxTarget(const uint256& targetPerCoinDay, int64_t nValueIn);
+
+// Check whether kernel hash meets the per coin-day target for given value and time weight
+// Sets *ptargetProofOfStake to the resulting target if given
+bool CheckKernelTarget(const uint256& hashProofOfStake, const uint256& targetPerCoinDay, int64_t nValueIn, int64_t nTimeWeight, uint256* ptargetProofOfStake=NULL);
+
 // Scan given kernel for solutions
 bool ScanKernelForward(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, std::pair<uint32_t, uint32_t> &SearchInterval, std::vector<std::pair<uint256, uint32_t> > &solutions);
 
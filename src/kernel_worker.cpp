@@ -2,14 +2,66 @@
 #include "uint256.h"
 #include "kernel.h"
 #include "kernel_worker.h"
+#include "main.h"
+#include "sha256.h"
 #include "util.h"
 
-#include <openssl/sha.h>
+#include <thread>
 
 using namespace std;
 
-KernelWorker::KernelWorker(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, uint32_t nIntervalBegin, uint32_t nIntervalEnd) 
-        : kernel(kernel), nBits(nBits), nInputTxTime(nInputTxTime), bnValueIn(nValueIn), nIntervalBegin(nIntervalBegin), nIntervalEnd(nIntervalEnd)
+// Maximum target which could be met by nValueIn coins at full weight, the
+//   result is saturated at 2^256-1 so that it never filters out a valid hash
+uint256 GetKernelMaxTarget(const uint256& targetPerCoinDay, int64_t nValueIn)
+{
+    uint512 nMaxTarget(targetPerCoinDay);
+    nMaxTarget *= uint512((uint64_t)max(nValueIn, (int64_t)0));
+    nMaxTarget *= nStakeMaxAge;
+    nMaxTarget /= (uint32_t)COIN;
+    nMaxTarget /= (uint32_t)nOneDay;
+
+    if (fCheckTargetArith)
+    {
+        CBigNum bnMaxTarget = CBigNum(targetPerCoinDay) * nValueIn * nStakeMaxAge / COIN / nOneDay;
+        uint256 nMaxTargetCheck = bnMaxTarget > CBigNum(~uint256(0)) ? ~uint256(0) : bnMaxTarget.getuint256();
+        CheckTargetArith(nMaxTarget.saturate256() == nMaxTargetCheck, "GetKernelMaxTarget()");
+    }
+
+    return nMaxTarget.saturate256();
+}
+
+// Check whether hash of a kernel spending nValueIn coins with nTimeWeight
+//   seconds of age meets the per coin-day target
+bool CheckKernelTarget(const uint256& hashProofOfStake, const uint256& targetPerCoinDay, int64_t nValueIn, int64_t nTimeWeight, uint256* ptargetProofOfStake)
+{
+    // Coin-day weight, floor(floor(x / COIN) / nOneDay) == floor(x / (COIN * nOneDay))
+    uint256 nCoinDayWeight((uint64_t)max(nValueIn, (int64_t)0));
+    nCoinDayWeight *= (uint32_t)max(nTimeWeight, (int64_t)0);
+    nCoinDayWeight /= (uint32_t)COIN;
+    nCoinDayWeight /= (uint32_t)nOneDay;
+
+    uint512 nTarget(targetPerCoinDay);
+    nTarget *= uint512(nCoinDayWeight);
+    if (ptargetProofOfStake)
+        *ptargetProofOfStake = nTarget.trim256();
+
+    bool fMeets = uint512(hashProofOfStake) <= nTarget;
+
+    if (fCheckTargetArith)
+    {
+        CBigNum bnTarget = CBigNum(nValueIn) * nTimeWeight / COIN / nOneDay * CBigNum(targetPerCoinDay);
+        bool fMatch = fMeets == (CBigNum(hashProofOfStake) <= bnTarget);
+        if (ptargetProofOfStake)
+            fMatch = fMatch && *ptargetProofOfStake == bnTarget.getuint256();
+        CheckTargetArith(fMatch, "CheckKernelTarget()");
+    }
+
+    return fMeets;
+}
+
+
+KernelWorker::KernelWorker(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, uint32_t nIntervalBegin, uint32_t nIntervalEnd, const std::atomic<bool> *pfCancel) 
+        : kernel(kernel), nBits(nBits), nInputTxTime(nInputTxTime), nValueIn(nValueIn), nIntervalBegin(nIntervalBegin), nIntervalEnd(nIntervalEnd), pfCancel(pfCancel)
     {
         solutions = vector<std::pair<uint256,uint32_t> >();
     }
@@ -18,46 +70,46 @@ void KernelWorker::Do_generic()
 {
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
+    bool fNegative, fOverflow;
+    uint256 targetPerCoinDay;
+    targetPerCoinDay.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow)
+        return;
+
     // Compute maximum possible target to filter out majority of obviously insufficient hashes
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
-    uint256 nMaxTarget = (bnTargetPerCoinDay * bnValueIn * nStakeMaxAge / COIN / nOneDay).getuint256();
+    uint256 nMaxTarget = GetKernelMaxTarget(targetPerCoinDay, nValueIn);
 
-    SHA256_CTX ctx, workerCtx;
-    // Init new sha256 context and update it
-    //   with first 24 bytes of kernel
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, kernel, 8 + 16);
-    workerCtx = ctx; // save context
+    // Precompute the part of kernel hash which doesn't depend
+    //   on timestamp, the first 24 bytes of kernel
+    sha256_kernel_ctx ctx;
+    sha256_kernel_init(&ctx, kernel);
 
-    // Sha256 result buffer
-    uint32_t hashProofOfStake[8];
-    uint256 *pnHashProofOfStake = (uint256 *)&hashProofOfStake;
+    // Sha256 result buffers, one per timestamp
+    uint32_t hashes[KERNEL_SHA256_LANES][8];
 
     // Search forward in time from the given timestamp
     // Stopping search in case of shutting down
-    for (uint32_t nTimeTx=nIntervalBegin, nMaxTarget32 = nMaxTarget.Get32(7); nTimeTx<nIntervalEnd && !fShutdown; nTimeTx++)
+    for (uint32_t nTimeBase=nIntervalBegin, nMaxTarget32 = nMaxTarget.Get32(7); nTimeBase<nIntervalEnd && !fShutdown && !(pfCancel && *pfCancel); nTimeBase += KERNEL_SHA256_LANES)
     {
-        // Complete first hashing iteration
-        uint256 hash1;
-        SHA256_Update(&ctx, (unsigned char*)&nTimeTx, 4);
-        SHA256_Final((unsigned char*)&hash1, &ctx);
+        // Calculate kernel hashes for the next few timestamps at once
+        sha256_kernel_hash8(&ctx, nTimeBase, hashes);
 
-        // Restore context
-        ctx = workerCtx;
-
-        // Finally, calculate kernel hash
-        SHA256((unsigned char*)&hash1, sizeof(hashProofOfStake), (unsigned char*)&hashProofOfStake);
+        for (uint32_t nLane = 0; nLane < KERNEL_SHA256_LANES; nLane++)
+        {
+            uint32_t nTimeTx = nTimeBase + nLane;
+            if (nTimeTx >= nIntervalEnd)
+                break;
 
-        // Skip if hash doesn't satisfy the maximum target
-        if (hashProofOfStake[7] > nMaxTarget32)
-            continue;
+            uint32_t *hashProofOfStake = hashes[nLane];
+            uint256 *pnHashProofOfStake = (uint256 *)hashProofOfStake;
 
-        CBigNum bnCoinDayWeight = bnValueIn * GetWeight((int64_t)nInputTxTime, (int64_t)nTimeTx) / COIN / nOneDay;
-        CBigNum bnTargetProofOfStake = bnCoinDayWeight * bnTargetPerCoinDay;
+            // Skip if hash doesn't satisfy the maximum target
+            if (hashProofOfStake[7] > nMaxTarget32)
+                continue;
 
-        if (bnTargetProofOfStake >= CBigNum(*pnHashProofOfStake))
-            solutions.push_back(std::pair<uint256,uint32_t>(*pnHashProofOfStake, nTimeTx));
+            if (CheckKernelTarget(*pnHashProofOfStake, targetPerCoinDay, nValueIn, GetWeight((int64_t)nInputTxTime, (int64_t)nTimeTx)))
+                solutions.push_back(std::pair<uint256,uint32_t>(*pnHashProofOfStake, nTimeTx));
+        }
     }
 }
 
@@ -71,55 +123,235 @@ vector<pair<uint256,uint32_t> >& KernelWorker::GetSolutions()
     return solutions;
 }
 
-// Scan given kernel for solutions
+// Length of the interval chunk scanned by one KernelWorker, small enough
+//   to report progress and to balance the load between threads
+static const uint32_t KERNEL_SCAN_CHUNK = nOneDay;
 
-bool ScanKernelBackward(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, std::pair<uint32_t, uint32_t> &SearchInterval, std::pair<uint256, uint32_t> &solution)
+// Threads of all scans, which are detached and waited for at shutdown
+static mutex csScanThreads;
+static condition_variable condScanThreads;
+static unsigned int nScanThreads = 0;
+
+static void ScanThreadExited()
 {
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+    lock_guard<mutex> lock(csScanThreads);
+    if (--nScanThreads == 0)
+        condScanThreads.notify_all();
+}
 
-    CBigNum bnValueIn(nValueIn);
+void WaitKernelScanThreads()
+{
+    unique_lock<mutex> lock(csScanThreads);
+    condScanThreads.wait(lock, [] { return nScanThreads == 0; });
+}
+
+KernelScan::KernelScan(uint32_t nBits, uint32_t nIntervalBegin, uint32_t nIntervalEnd)
+        : nBits(nBits), nIntervalBegin(nIntervalBegin), nIntervalEnd(max(nIntervalBegin, nIntervalEnd)),
+          fCancel(false), nNextItem(0), nItemsDone(0), nRunning(0)
+{
+    nChunks = (uint32_t)(((uint64_t)this->nIntervalEnd - nIntervalBegin + KERNEL_SCAN_CHUNK - 1) / KERNEL_SCAN_CHUNK);
+}
+
+KernelScan::~KernelScan()
+{
+    // Threads hold a reference to the scan, nothing can be running here
+    assert(nRunning == 0);
+}
+
+void KernelScan::AddInput(const unsigned char *kernel, uint32_t nInputTxTime, int64_t nValueIn)
+{
+    Input input;
+    memcpy(input.kernel, kernel, KERNEL_SIZE);
+    input.nInputTxTime = nInputTxTime;
+    input.nValueIn = nValueIn;
+    vInputs.push_back(input);
+}
+
+void KernelScan::Start(unsigned int nThreads)
+{
+    unsigned int nCores = max(std::thread::hardware_concurrency(), 1u);
+    if (nThreads == 0 || nThreads > nCores)
+        nThreads = nCores;
+
+    uint64_t nItems = (uint64_t)vInputs.size() * nChunks;
+    nThreads = (unsigned int)min((uint64_t)nThreads, nItems);
+
+    // Each thread keeps the scan alive until it exits. Threads are counted
+    //   before they are started, a fast one may be done before the
+    //   constructor returns.
+    for (unsigned int i = 0; i < nThreads; i++)
+    {
+        {
+            lock_guard<mutex> lock(cs);
+            nRunning++;
+        }
+        {
+            lock_guard<mutex> lock(csScanThreads);
+            nScanThreads++;
+        }
+
+        try {
+            std::thread(&KernelScan::ThreadScan, shared_from_this()).detach();
+        }
+        catch (const std::system_error& e) {
+            ScanThreadExited();
+            {
+                lock_guard<mutex> lock(cs);
+                if (--nRunning == 0)
+                    condDone.notify_all();
+            }
+            if (i == 0)
+                throw;
+            printf("KernelScan::Start() : started %u of %u threads, %s\n", i, nThreads, e.what());
+            break;
+        }
+    }
+}
+
+void KernelScan::ThreadScan()
+{
+    RenameThread("novacoin-scan");
+
+    uint64_t nItems = (uint64_t)vInputs.size() * nChunks;
+    for (uint64_t nItem = nNextItem++; nItem < nItems && !fCancel && !fShutdown; nItem = nNextItem++)
+    {
+        // Chunk major order, so that early solutions of all inputs come first
+        Input& input = vInputs[nItem % vInputs.size()];
+        uint32_t nChunk = (uint32_t)(nItem / vInputs.size());
+        uint32_t nBegin = nIntervalBegin + nChunk * KERNEL_SCAN_CHUNK;
+        uint32_t nEnd = (uint32_t)min((uint64_t)nBegin + KERNEL_SCAN_CHUNK, (uint64_t)nIntervalEnd);
+
+        KernelWorker worker(input.kernel, nBits, input.nInputTxTime, input.nValueIn, nBegin, nEnd, &fCancel);
+        worker.Do();
+
+        lock_guard<mutex> lock(cs);
+        for (const auto& solution : worker.GetSolutions())
+        {
+            KernelScanSolution item;
+            item.nTime = solution.second;
+            item.hashProofOfStake = solution.first;
+            item.nInput = (int)(nItem % vInputs.size());
+            vSolutions.push_back(item);
+        }
+        // Interrupted chunks aren't counted
+        if (!fCancel && !fShutdown)
+            nItemsDone++;
+    }
+
+    {
+        lock_guard<mutex> lock(cs);
+        if (--nRunning == 0)
+            condDone.notify_all();
+    }
+    ScanThreadExited();
+}
+
+void KernelScan::Cancel()
+{
+    fCancel = true;
+}
+
+void KernelScan::Wait()
+{
+    unique_lock<mutex> lock(cs);
+    condDone.wait(lock, [this] { return nRunning == 0; });
+}
+
+bool KernelScan::IsRunning() const
+{
+    lock_guard<mutex> lock(cs);
+    return nRunning != 0;
+}
+
+double KernelScan::GetProgress() const
+{
+    uint64_t nItems = (uint64_t)vInputs.size() * nChunks;
+    if (nItems == 0)
+        return 1.0;
+    return (double)nItemsDone / nItems;
+}
+
+vector<KernelScanSolution> KernelScan::GetSolutions() const
+{
+    vector<KernelScanSolution> vResult;
+    {
+        lock_guard<mutex> lock(cs);
+        vResult = vSolutions;
+    }
+    sort(vResult.begin(), vResult.end());
+    return vResult;
+}
+
+// Scan given kernel for solutions, forward in time
+bool ScanKernelForward(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, std::pair<uint32_t, uint32_t> &SearchInterval, std::vector<std::pair<uint256, uint32_t> > &solutions)
+{
+    std::shared_ptr<KernelScan> scan = std::make_shared<KernelScan>(nBits, SearchInterval.first, SearchInterval.second);
+    scan->AddInput(kernel, nInputTxTime, nValueIn);
+    scan->Start();
+    scan->Wait();
+
+    solutions.clear();
+    for (const auto& solution : scan->GetSolutions())
+        solutions.push_back(std::make_pair(solution.hashProofOfStake, solution.nTime));
+
+    return !solutions.empty();
+}
+
+// Scan given kernel for solutions, backward in time
+
+bool ScanKernelBackward(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, std::pair<uint32_t, uint32_t> &SearchInterval, std::pair<uint256, uint32_t> &solution)
+{
+    bool fNegative, fOverflow;
+    uint256 targetPerCoinDay;
+    targetPerCoinDay.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow)
+        return false;
 
     // Get maximum possible target to filter out the majority of obviously insufficient hashes
-    uint256 nMaxTarget = (bnTargetPerCoinDay * bnValueIn * nStakeMaxAge / COIN / nOneDay).getuint256();
+    uint256 nMaxTarget = GetKernelMaxTarget(targetPerCoinDay, nValueIn);
 
-    SHA256_CTX ctx, workerCtx;
-    // Init new sha256 context and update it
-    //   with first 24 bytes of kernel
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, kernel, 8 + 16);
-    workerCtx = ctx; // save context
+    // Precompute the part of kernel hash which doesn't depend
+    //   on timestamp, the first 24 bytes of kernel
+    sha256_kernel_ctx ctx;
+    sha256_kernel_init(&ctx, kernel);
+
+    // Sha256 result buffers, one per timestamp
+    uint32_t hashes[KERNEL_SHA256_LANES][8];
 
     // Search backward in time from the given timestamp
     // Stopping search in case of shutting down
-    for (uint32_t nTimeTx=SearchInterval.first; nTimeTx>SearchInterval.second && !fShutdown; nTimeTx--)
+    for (uint32_t nTimeTop=SearchInterval.first; nTimeTop>SearchInterval.second && !fShutdown; )
     {
-        // Complete first hashing iteration
-        uint256 hash1;
-        SHA256_Update(&ctx, (unsigned char*)&nTimeTx, 4);
-        SHA256_Final((unsigned char*)&hash1, &ctx);
+        // Calculate kernel hashes for timestamps nTimeTop - 7 .. nTimeTop at once
+        uint32_t nTimeBase = nTimeTop - (KERNEL_SHA256_LANES - 1);
+        sha256_kernel_hash8(&ctx, nTimeBase, hashes);
 
-        // Restore context
-        ctx = workerCtx;
+        // Walk through them in descending order
+        for (int nLane = KERNEL_SHA256_LANES - 1; nLane >= 0; nLane--)
+        {
+            uint32_t nTimeTx = nTimeBase + nLane;
+            if (nTimeTx <= SearchInterval.second || nTimeTx > nTimeTop)
+                break;
 
-        // Finally, calculate kernel hash
-        uint256 hashProofOfStake;
-        SHA256((unsigned char*)&hash1, sizeof(hashProofOfStake), (unsigned char*)&hashProofOfStake);
+            uint256 hashProofOfStake;
+            memcpy(hashProofOfStake.begin(), hashes[nLane], hashProofOfStake.size());
 
-        // Skip if hash doesn't satisfy the maximum target
-        if (hashProofOfStake > nMaxTarget)
-            continue;
+            // Skip if hash doesn't satisfy the maximum target
+            if (hashProofOfStake > nMaxTarget)
+                continue;
 
-        CBigNum bnCoinDayWeight = bnValueIn * GetWeight((int64_t)nInputTxTime, (int64_t)nTimeTx) / COIN / nOneDay;
-        CBigNum bnTargetProofOfStake = bnCoinDayWeight * bnTargetPerCoinDay;
+            if (CheckKernelTarget(hashProofOfStake, targetPerCoinDay, nValueIn, GetWeight((int64_t)nInputTxTime, (int64_t)nTimeTx)))
+            {
+                solution.first = hashProofOfStake;
+                solution.second = nTimeTx;
 
-        if (bnTargetProofOfStake >= CBigNum(hashProofOfStake))
-        {
-            solution.first = hashProofOfStake;
-            solution.second = nTimeTx;
-
-            return true;
+                return true;
+            }
         }
+
+        if (nTimeTop - SearchInterval.second <= KERNEL_SHA256_LANES)
+            break;
+        nTimeTop -= KERNEL_SHA256_LANES;
     }
 
     return false;
@@ -1,19 +1,22 @@
 #ifndef NOVACOIN_KERNELWORKER_H
 #define NOVACOIN_KERNELWORKER_H
 
-#include "bignum.h"
+#include "uint256.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <vector>
 
-class uint256;
 
 class KernelWorker
 {
 public:
     KernelWorker()
     { }
-    KernelWorker(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, uint32_t nIntervalBegin, uint32_t nIntervalEnd);
+    KernelWorker(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, uint32_t nIntervalBegin, uint32_t nIntervalEnd, const std::atomic<bool> *pfCancel=NULL);
     void Do();
     std::vector<std::pair<uint256,uint32_t> >& GetSolutions();
 
@@ -28,13 +31,89 @@ private:
     uint8_t *kernel;
     uint32_t nBits;
     uint32_t nInputTxTime;
-    CBigNum  bnValueIn;
+    int64_t  nValueIn;
 
     // Interval boundaries.
     uint32_t nIntervalBegin;
     uint32_t nIntervalEnd;
+
+    // Stop flag, checked along with fShutdown.
+    const std::atomic<bool> *pfCancel;
+};
+
+// Kernel solution found by KernelScan
+struct KernelScanSolution
+{
+    uint32_t nTime;
+    uint256 hashProofOfStake;
+    int nInput; // Index of the input, in the order of AddInput() calls
+
+    friend bool operator<(const KernelScanSolution& a, const KernelScanSolution& b)
+    {
+        return a.nTime < b.nTime || (a.nTime == b.nTime && a.nInput < b.nInput);
+    }
 };
 
+// Forward scan of several kernels over the same interval. The interval is cut
+//   into chunks, pool threads claim (input, chunk) pairs and run a KernelWorker
+//   on each of them. Solutions found so far are available while the scan runs,
+//   and the scan may be cancelled at any moment.
+class KernelScan : public std::enable_shared_from_this<KernelScan>
+{
+public:
+    // Kernel prefix is 24 bytes long: stake modifier, block time, tx offset, tx time and output number
+    static const unsigned int KERNEL_SIZE = 24;
+
+    KernelScan(uint32_t nBits, uint32_t nIntervalBegin, uint32_t nIntervalEnd);
+    ~KernelScan();
+
+    // Inputs can only be added before Start()
+    void AddInput(const unsigned char *kernel, uint32_t nInputTxTime, int64_t nValueIn);
+
+    // Run the scan on nThreads background threads, 0 means one per core
+    //   and more than that aren't started. Throws if no thread can be
+    //   started at all.
+    void Start(unsigned int nThreads=0);
+    void Cancel();
+    void Wait();
+
+    bool IsRunning() const;
+    bool IsCancelled() const { return fCancel; }
+    // Fraction of the work done, 0 to 1
+    double GetProgress() const;
+    // Solutions found so far, in time order
+    std::vector<KernelScanSolution> GetSolutions() const;
+
+private:
+    struct Input
+    {
+        unsigned char kernel[KERNEL_SIZE];
+        uint32_t nInputTxTime;
+        int64_t nValueIn;
+    };
+
+    void ThreadScan();
+
+    uint32_t nBits;
+    uint32_t nIntervalBegin;
+    uint32_t nIntervalEnd;
+    uint32_t nChunks;
+    std::vector<Input> vInputs;
+
+    std::atomic<bool> fCancel;
+    std::atomic<uint64_t> nNextItem;
+    std::atomic<uint64_t> nItemsDone;
+
+    mutable std::mutex cs;
+    std::condition_variable condDone;
+    unsigned int nRunning;
+    std::vector<KernelScanSolution> vSolutions;
+};
+
+// Wait until the threads of all kernel scans have exited, they stop
+//   at the next chunk once fShutdown is set
+void WaitKernelScanThreads();
+
 // Scan given kernel for solutions
 bool ScanKernelBackward(unsigned char *kernel, uint32_t nBits, uint32_t nInputTxTime, int64_t nValueIn, std::pair<uint32_t, uint32_t> &SearchInterval, std::pair<uint256, uint32_t> &solution);
 
@@ -3,6 +3,9 @@
 #include "wallet.h"
 #include "base58.h"
 
+#include <cmath>
+#include <limits>
+
 using namespace std;
 
 bool KernelRecord::showTransaction(const CWalletTx &wtx)
@@ -53,6 +56,7 @@ vector<KernelRecord> KernelRecord::decomposeOutput(const CWallet *wallet, const
                 }
 
                 parts.push_back(KernelRecord(hash, nTime, addrStr, txOut.nValue, wtx.IsSpent(nOut)));
+                parts.back().idx = nOut;
             }
         }
     }
@@ -107,29 +111,159 @@ double KernelRecord::getProbToMintWithinNMinutes(double difficulty, int minutes)
 {
     if(difficulty != prevDifficulty || minutes != prevMinutes)
     {
-        double prob = 1;
-        double p;
-        int d = minutes / (60 * 24); // Number of full days
-        int m = minutes % (60 * 24); // Number of minutes in the last day
-        int i, timeOffset;
-
-        // Probabilities for the first d days
-        for(i = 0; i < d; i++)
+        prevProbability = MintingEstimator(difficulty, 0, minutes, GetAdjustedTime()).getProbability(nValue, nTime);
+        prevDifficulty = difficulty;
+        prevMinutes = minutes;
+    }
+    return prevProbability;
+}
+
+// Above this chance per second the series for log(1 - p) are not precise
+//   enough and the linear piece is summed day by day
+static const double MINT_PROB_SERIES_MAX = 0.01;
+
+// From this many coin-days on, rounding them down changes the chances by
+//   less than one in a million and the series may use unrounded weights
+static const double MINT_PROB_SERIES_MIN_COINDAYS = 1000000;
+
+// log(1 - p) for the chance p to mint a kernel during one second
+static inline double LogMissChance(double p)
+{
+    return (p >= 1) ? -std::numeric_limits<double>::infinity() : log1p(-p);
+}
+
+// Chance per second to mint a kernel for an output of nValue with nWeight
+//   seconds of time weight. The kernel target check rounds the weight down
+//   to whole coin-days, so young and small outputs have less chance than
+//   their exact coin age suggests.
+static inline double GetMintChance(double dScale, int64_t nValue, int64_t nWeight)
+{
+    if (nWeight <= 0)
+        return 0;
+    return dScale * floor((double)nValue * nWeight / ((double)COIN * nOneDay));
+}
+
+/*
+ * Logarithm of the chance to mint nothing within given number of minutes,
+ * for an output of nValue and nAge seconds, dScale is the chance to mint
+ * per second and coin-day. As in the day by day computation this replaces,
+ * time weight is taken at the beginning of each day and kept for the whole
+ * day.
+ */
+static double GetMissLogWithinNMinutes(double dScale, int64_t nValue, int64_t nAge, int minutes)
+{
+    const int64_t nDays = minutes / (60 * 24);     // Number of full days
+    const int64_t nRest = minutes % (60 * 24);     // Number of minutes in the last day
+    const int64_t nFullAge = (int64_t)nStakeMinAge + nStakeMaxAge;
+
+    // Days [0, nBegin) are too young to stake, days [nBegin, nEnd) are
+    //   gaining weight and days [nEnd, nDays) have full weight
+    int64_t nBegin = (nAge > nStakeMinAge) ? 0 : (nStakeMinAge - nAge) / nOneDay + 1;
+    int64_t nEnd = (nAge >= nFullAge) ? 0 : (nFullAge - nAge + nOneDay - 1) / nOneDay;
+    nBegin = min(nBegin, nDays);
+    nEnd = min(max(nEnd, nBegin), nDays);
+
+    double dMissLog = 0;
+
+    int64_t n = nEnd - nBegin;
+    if (n > 0)
+    {
+        // Chances per second grow by dStep each day
+        int64_t nWeightBegin = nAge + nBegin * nOneDay - nStakeMinAge;
+        double dRate = dScale * nValue / ((double)COIN * nOneDay);
+        double p0 = dRate * nWeightBegin;
+        double dStep = dRate * nOneDay;
+
+        if (p0 + (n - 1) * dStep <= MINT_PROB_SERIES_MAX &&
+            (double)nValue * nWeightBegin >= MINT_PROB_SERIES_MIN_COINDAYS * COIN * nOneDay)
         {
-            timeOffset = i * nOneDay;
-            p = pow(1 - getProbToMintStake(difficulty, timeOffset), nOneDay);
-            prob *= p;
+            // log(1 - p) = -(p + p^2/2 + p^3/3 + ...), power sums of an
+            //   arithmetic progression are polynomials of its length
+            double k1 = (double)n * (n - 1) / 2;
+            double k2 = (double)(n - 1) * n * (2 * n - 1) / 6;
+            double k3 = k1 * k1;
+
+            double s1 = n * p0 + dStep * k1;
+            double s2 = n * p0 * p0 + 2 * p0 * dStep * k1 + dStep * dStep * k2;
+            double s3 = n * p0 * p0 * p0 + 3 * p0 * p0 * dStep * k1 + 3 * p0 * dStep * dStep * k2 + dStep * dStep * dStep * k3;
+
+            dMissLog -= nOneDay * (s1 + s2 / 2 + s3 / 3);
         }
+        else
+        {
+            // At most nStakeMaxAge / nOneDay + 1 days
+            for (int64_t i = 0; i < n; i++)
+                dMissLog += nOneDay * LogMissChance(GetMintChance(dScale, nValue, nWeightBegin + i * nOneDay));
+        }
+    }
 
-        // Probability for the m minutes of the last day
-        timeOffset = d * nOneDay;
-        p = pow(1 - getProbToMintStake(difficulty, timeOffset), 60 * m);
-        prob *= p;
+    if (nDays > nEnd)
+        dMissLog += (nDays - nEnd) * nOneDay * LogMissChance(GetMintChance(dScale, nValue, nStakeMaxAge));
 
-        prob = 1 - prob;
-        prevProbability = prob;
-        prevDifficulty = difficulty;
-        prevMinutes = minutes;
+    // Minutes of the last day
+    int64_t nWeight = min(nAge + nDays * nOneDay, nFullAge) - nStakeMinAge;
+    if (nRest > 0 && nWeight > 0)
+        dMissLog += 60 * nRest * LogMissChance(GetMintChance(dScale, nValue, nWeight));
+
+    return dMissLog;
+}
+
+MintingEstimator::MintingEstimator() :
+    difficulty(0), nBits(0), minutes(0), nTime(0), dScale(0), nRewardCoinYearBegin(0), nRewardCoinYearEnd(0)
+{
+}
+
+MintingEstimator::MintingEstimator(double difficulty, unsigned int nBits, int minutes, int64_t nTime) :
+    difficulty(difficulty), nBits(nBits), minutes(minutes), nTime(nTime), nRewardCoinYearBegin(0), nRewardCoinYearEnd(0)
+{
+    dScale = (difficulty > 0) ? 1 / (pow(static_cast<double>(2), 32) * difficulty) : 0;
+
+    // Coin-year reward depends on the target limit for the given time
+    //   and nothing else, so it is found once for both ends of the window
+    if (nBits != 0)
+    {
+        nRewardCoinYearBegin = GetProofOfStakeReward(0, nBits, nTime, true);
+        nRewardCoinYearEnd = GetProofOfStakeReward(0, nBits, nTime + minutes * 60, true);
     }
-    return prevProbability;
+}
+
+double MintingEstimator::getProbability(int64_t nValue, int64_t nTimeTx) const
+{
+    if (nValue <= 0 || dScale <= 0 || minutes <= 0)
+        return 0;
+
+    return -expm1(GetMissLogWithinNMinutes(dScale, nValue, nTime - nTimeTx, minutes));
+}
+
+int64_t MintingEstimator::getReward(int64_t nValue, int64_t nTimeTx, bool fEnd) const
+{
+    int64_t nWeight = nTime - nTimeTx + (fEnd ? minutes * 60 : 0);
+    if (nWeight < nStakeMinAge)
+        return 0;
+    uint64_t coinAge = (nValue * nWeight) / (COIN * nOneDay);
+    return GetProofOfStakeRewardAtRate(coinAge, fEnd ? nRewardCoinYearEnd : nRewardCoinYearBegin);
+}
+
+MintingEstimate MintingEstimator::estimate(int64_t nValue, int64_t nTimeTx) const
+{
+    MintingEstimate result;
+    result.probability = getProbability(nValue, nTimeTx);
+    result.nRewardBegin = getReward(nValue, nTimeTx, false);
+    result.nRewardEnd = getReward(nValue, nTimeTx, true);
+    return result;
+}
+
+void MintingEstimator::estimate(const std::vector<KernelRecord>& records, std::vector<MintingEstimate>& estimates) const
+{
+    estimates.resize(records.size());
+    for (size_t i = 0; i < records.size(); i++)
+        estimates[i] = estimate(records[i].nValue, records[i].nTime);
+}
+
+double MintingEstimator::getCombinedProbability(const std::vector<MintingEstimate>& estimates)
+{
+    double dMissLog = 0;
+    for (const MintingEstimate& est : estimates)
+        dMissLog += LogMissChance(est.probability);
+    return -expm1(dMissLog);
 }
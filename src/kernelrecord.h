@@ -3,25 +3,77 @@
 
 #include "uint256.h"
 
+#include <vector>
+
 class CWallet;
 class CWalletTx;
+class KernelRecord;
+
+/** Minting forecast for a single output */
+struct MintingEstimate
+{
+    double probability;     // Chance to mint within the time window
+    int64_t nRewardBegin;   // Reward if minted at the beginning of the window
+    int64_t nRewardEnd;     // Reward if minted at the end of the window
+
+    MintingEstimate() : probability(0), nRewardBegin(0), nRewardEnd(0) { }
+};
+
+/** Closed-form minting estimator.
+ *
+ * Holds everything which is common to all outputs for given difficulty,
+ * target bits, time window and current time, so that forecasting an output
+ * takes a few floating point operations and no big number arithmetic.
+ *
+ * Each second an output mints with probability p, proportional to its
+ * coin age. Coin age is zero until nStakeMinAge, grows linearly during
+ * nStakeMaxAge and stays constant afterwards, so log(1 - p) is summed
+ * over these pieces as series instead of being multiplied out day by day.
+ */
+class MintingEstimator
+{
+public:
+    MintingEstimator();
+    MintingEstimator(double difficulty, unsigned int nBits, int minutes, int64_t nTime);
+
+    double getProbability(int64_t nValue, int64_t nTimeTx) const;
+    int64_t getReward(int64_t nValue, int64_t nTimeTx, bool fEnd) const;
+    MintingEstimate estimate(int64_t nValue, int64_t nTimeTx) const;
+    void estimate(const std::vector<KernelRecord>& records, std::vector<MintingEstimate>& estimates) const;
+
+    // Chance that at least one of the outputs mints within the window
+    static double getCombinedProbability(const std::vector<MintingEstimate>& estimates);
+
+    double difficulty;
+    unsigned int nBits;
+    int minutes;
+    int64_t nTime;
+
+private:
+    double dScale;
+    int64_t nRewardCoinYearBegin;
+    int64_t nRewardCoinYearEnd;
+};
 
 class KernelRecord
 {
 public:
     KernelRecord():
-        hash(), nTime(0), address(""), nValue(0), idx(0), spent(false), prevMinutes(0), prevDifficulty(0), prevProbability(0)
+        hash(), nTime(0), address(""), nValue(0), idx(0), spent(false),
+        nEstimateBits(0), nEstimateMinutes(0), nEstimateTime(0), prevMinutes(0), prevDifficulty(0), prevProbability(0)
     {
     }
 
     KernelRecord(uint256 hash, int64_t nTime):
-            hash(hash), nTime(nTime), address(""), nValue(0), idx(0), spent(false), prevMinutes(0), prevDifficulty(0), prevProbability(0)
+            hash(hash), nTime(nTime), address(""), nValue(0), idx(0), spent(false),
+        nEstimateBits(0), nEstimateMinutes(0), nEstimateTime(0), prevMinutes(0), prevDifficulty(0), prevProbability(0)
     {
     }
 
     KernelRecord(uint256 hash, int64_t nTime, const std::string &address, int64_t nValue, bool spent):
         hash(hash), nTime(nTime), address(address), nValue(nValue),
-        idx(0), spent(spent), prevMinutes(0), prevDifficulty(0), prevProbability(0)
+        idx(0), spent(spent),
+        nEstimateBits(0), nEstimateMinutes(0), nEstimateTime(0), prevMinutes(0), prevDifficulty(0), prevProbability(0)
     {
     }
 
@@ -42,6 +94,12 @@ public:
     double getProbToMintStake(double difficulty, int timeOffset = 0) const;
     double getProbToMintWithinNMinutes(double difficulty, int minutes);
     int64_t getPoSReward(int nBits, int timeOffset);
+
+    // Last estimate stored by the minting table, see MintingEstimator
+    MintingEstimate estimate;
+    unsigned int nEstimateBits;
+    int nEstimateMinutes;
+    int64_t nEstimateTime;
 protected:
     int prevMinutes;
     double prevDifficulty;
@@ -243,6 +243,13 @@ bool CPubKey::ReserealizeSignature(std::vector<unsigned char>& vchSig)
     if (vchSig.empty())
         return false;
 
+#ifdef HAVE_NATIVE_SECP256K1
+    // Strict DER is what i2d_ECDSA_SIG() would produce anyway
+    unsigned char r[32], s[32];
+    if (secp256k1_parse_der_strict(&vchSig[0], vchSig.size(), r, s))
+        return true;
+#endif
+
     unsigned char *pos = &vchSig[0];
     ECDSA_SIG *sig = d2i_ECDSA_SIG(NULL, (const unsigned char **)&pos, vchSig.size());
     if (sig == NULL)
@@ -531,6 +538,15 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     if (vchSig.empty() || !IsValid())
         return false;
 
+#ifdef HAVE_NATIVE_SECP256K1
+    // Strictly encoded signatures, which is nearly all of them, are checked
+    //   natively. Other encodings keep going through OpenSSL, which defines
+    //   the lax forms accepted so far.
+    unsigned char r[32], s[32];
+    if (secp256k1_parse_der_strict(&vchSig[0], vchSig.size(), r, s))
+        return secp256k1_verify(vbytes, size(), (const unsigned char*)&hash, r, s);
+#endif
+
     EC_KEY *pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
     ECDSA_SIG *norm_sig = ECDSA_SIG_new();
 
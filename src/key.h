@@ -12,6 +12,7 @@
 #include "serialize.h"
 #include "uint256.h"
 #include "bignum.h"
+#include "secp256k1.h"
 
 #include <openssl/ec.h> // for EC_KEY definition
 #include <openssl/obj_mac.h>
@@ -176,6 +177,9 @@ public:
     //! fully validate whether this is a valid public key (more expensive than IsValid())
     bool IsFullyValid() const
     {
+#ifdef HAVE_NATIVE_SECP256K1
+        return secp256k1_pubkey_valid(vbytes, size());
+#else
         const unsigned char* pbegin = &vbytes[0];
         EC_KEY *pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
         if (o2i_ECPublicKey(&pkey, &pbegin, size()))
@@ -184,6 +188,7 @@ public:
             return true;
         }
         return false;
+#endif
     }
 
     //! Check whether this is a compressed public key.
@@ -15,11 +15,18 @@
 #include "random.h"
 #include "wallet.h"
 #include "scrypt.h"
+#include "digestcache.h"
+#include "sha256.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <regex>
+#include <thread>
 
 
 CCriticalSection cs_setpwalletRegistered;
@@ -58,6 +65,7 @@ uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64_t nTimeBestReceived = 0;
 int nScriptCheckThreads = 0;
+bool fCheckTargetArith = false;
 
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
 
@@ -260,16 +268,49 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 // CTransaction and CTxIndex
 //
 
+CTransaction::CTransaction() : hash(0), nVersion(CTransaction::CURRENT_VERSION), nTime((uint32_t) GetAdjustedTime()), vin(), vout(), nLockTime(0), nDoS(0) { }
+
+CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), nTime(tx.nTime), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), nDoS(0)
+{
+    UpdateHash();
+}
+
+CTransaction& CTransaction::operator=(const CTransaction &tx)
+{
+    *const_cast<int*>(&nVersion) = tx.nVersion;
+    *const_cast<uint32_t*>(&nTime) = tx.nTime;
+    *const_cast<std::vector<CTxIn>*>(&vin) = tx.vin;
+    *const_cast<std::vector<CTxOut>*>(&vout) = tx.vout;
+    *const_cast<uint32_t*>(&nLockTime) = tx.nLockTime;
+    *const_cast<uint256*>(&hash) = tx.hash;
+    nDoS = tx.nDoS;
+    return *this;
+}
+
+void CTransaction::UpdateHash() const
+{
+    *const_cast<uint256*>(&hash) = SerializeHash(*this);
+}
+
+CMutableTransaction::CMutableTransaction() : nVersion(CTransaction::CURRENT_VERSION), nTime((uint32_t) GetAdjustedTime()), nLockTime(0) { }
+
+CMutableTransaction::CMutableTransaction(const CTransaction& tx) : nVersion(tx.nVersion), nTime(tx.nTime), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime) { }
+
+uint256 CMutableTransaction::GetHash() const
+{
+    return SerializeHash(*this);
+}
+
 bool CTransaction::ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet)
 {
-    SetNull();
+    *this = CTransaction();
     if (!txdb.ReadTxIndex(prevout.hash, txindexRet))
         return false;
     if (!ReadFromDisk(txindexRet.pos))
         return false;
     if (prevout.n >= vout.size())
     {
-        SetNull();
+        *this = CTransaction();
         return false;
     }
     return true;
@@ -724,10 +765,15 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1,1,1), pindexBest, false, false, true, STRICT_FLAGS))
+        unsigned int nFlags = GetScriptVerifyFlags(tx.nTime);
+        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1,1,1), pindexBest, false, false, true, STRICT_FLAGS | nFlags))
         {
             return error("CTxMemPool::accept() : ConnectInputs failed %s", hash.ToString().substr(0,10).c_str());
         }
+
+        // Standard flags are stricter than the consensus ones, so these
+        // scripts don't have to be run again when the block is connected.
+        AddScriptExecutionCache(hash, nFlags);
     }
 
     // Store transaction in memory
@@ -935,6 +981,86 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return pblockindex;
 }
 
+bool ReadBlockBytesFromDisk(const CBlockIndex* pindex, CBlockFileBytes& bytes)
+{
+    if (pindex->nBlockPos < 8)
+        return error("ReadBlockBytesFromDisk() : bad block position");
+
+    // Index header in front of the block
+    unsigned int nSize;
+    if (!bytes.Read(pindex->nFile, pindex->nBlockPos - 8, 8))
+        return error("ReadBlockBytesFromDisk() : can't read index header");
+    if (memcmp(bytes.begin(), pchMessageStart, sizeof(pchMessageStart)) != 0)
+        return error("ReadBlockBytesFromDisk() : bad index header");
+    memcpy(&nSize, bytes.begin() + 4, sizeof(nSize));
+    if (nSize < 80 || nSize > MAX_SIZE)
+        return error("ReadBlockBytesFromDisk() : bad block size %u", nSize);
+
+    if (!bytes.Read(pindex->nFile, pindex->nBlockPos, nSize))
+        return error("ReadBlockBytesFromDisk() : can't read block");
+
+    // Stored header has to be the indexed one, this is much cheaper than
+    // hashing it
+    CDataStream ssHeader(SER_DISK | SER_BLOCKHEADERONLY, CLIENT_VERSION);
+    ssHeader << pindex->GetBlockHeader();
+    if (ssHeader.size() > bytes.size() || memcmp(&ssHeader[0], bytes.begin(), ssHeader.size()) != 0)
+    {
+        bytes.clear();
+        return error("ReadBlockBytesFromDisk() : block header doesn't match index");
+    }
+    return true;
+}
+
+// Recently served blocks as they are stored, with their message checksum
+struct CRawBlock
+{
+    std::vector<char> vch;
+    uint32_t nChecksum;
+};
+
+typedef std::list<std::pair<uint256, std::shared_ptr<const CRawBlock> > > RawBlockList;
+
+static CCriticalSection cs_rawBlockCache;
+static RawBlockList lruRawBlocks;
+static std::map<uint256, RawBlockList::iterator> mapRawBlocks;
+static size_t nRawBlockCacheSize = 0;
+
+static std::shared_ptr<const CRawBlock> GetRawBlock(const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs_rawBlockCache);
+        auto mi = mapRawBlocks.find(hash);
+        if (mi != mapRawBlocks.end())
+        {
+            lruRawBlocks.splice(lruRawBlocks.begin(), lruRawBlocks, mi->second);
+            return mi->second->second;
+        }
+    }
+
+    CBlockFileBytes bytes;
+    if (!ReadBlockBytesFromDisk(pindex, bytes))
+        return std::shared_ptr<const CRawBlock>();
+    std::shared_ptr<CRawBlock> rawBlock(new CRawBlock);
+    rawBlock->vch.assign(bytes.begin(), bytes.end());
+    rawBlock->nChecksum = GetMessageChecksum(bytes.begin(), bytes.end());
+
+    LOCK(cs_rawBlockCache);
+    if (!mapRawBlocks.count(hash))
+    {
+        lruRawBlocks.push_front(std::make_pair(hash, rawBlock));
+        mapRawBlocks[hash] = lruRawBlocks.begin();
+        nRawBlockCacheSize += rawBlock->vch.size();
+        while (nRawBlockCacheSize > RAW_BLOCK_CACHE_SIZE && lruRawBlocks.size() > 1)
+        {
+            nRawBlockCacheSize -= lruRawBlocks.back().second->vch.size();
+            mapRawBlocks.erase(lruRawBlocks.back().first);
+            lruRawBlocks.pop_back();
+        }
+    }
+    return rawBlock;
+}
+
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
 {
     if (!fReadTransactions)
@@ -1021,9 +1147,25 @@ int64_t GetProofOfWorkReward(unsigned int nBits)
 }
 
 // miner's coin stake reward based on nBits and coin age spent (coin-days)
+int64_t GetProofOfStakeRewardAtRate(int64_t nCoinAge, int64_t nRewardCoinYear)
+{
+    int64_t nSubsidy, nSubsidyLimit = 10 * COIN;
+
+    nSubsidy = nCoinAge * nRewardCoinYear * 33 / (365 * 33 + 8);
+
+    // Set reasonable reward limit for large inputs
+    //
+    // This will stimulate large holders to use smaller inputs, that's good for the network protection
+
+    if (fDebug && GetBoolArg("-printcreation") && nSubsidyLimit < nSubsidy)
+        printf("GetProofOfStakeReward(): %s is greater than %s, coinstake reward will be truncated\n", FormatMoney(nSubsidy).c_str(), FormatMoney(nSubsidyLimit).c_str());
+
+    return std::min(nSubsidy, nSubsidyLimit);
+}
+
 int64_t GetProofOfStakeReward(int64_t nCoinAge, unsigned int nBits, int64_t nTime, bool bCoinYearOnly)
 {
-    int64_t nRewardCoinYear, nSubsidy, nSubsidyLimit = 10 * COIN;
+    int64_t nRewardCoinYear, nSubsidy;
 
     // Stage 2 of emission process is mostly PoS-based.
 
@@ -1066,16 +1208,7 @@ int64_t GetProofOfStakeReward(int64_t nCoinAge, unsigned int nBits, int64_t nTim
     if(bCoinYearOnly)
         return nRewardCoinYear;
 
-    nSubsidy = nCoinAge * nRewardCoinYear * 33 / (365 * 33 + 8);
-
-    // Set reasonable reward limit for large inputs
-    //
-    // This will stimulate large holders to use smaller inputs, that's good for the network protection
-
-    if (fDebug && GetBoolArg("-printcreation") && nSubsidyLimit < nSubsidy)
-        printf("GetProofOfStakeReward(): %s is greater than %s, coinstake reward will be truncated\n", FormatMoney(nSubsidy).c_str(), FormatMoney(nSubsidyLimit).c_str());
-
-    nSubsidy = std::min(nSubsidy, nSubsidyLimit);
+    nSubsidy = GetProofOfStakeRewardAtRate(nCoinAge, nRewardCoinYear);
 
     if (fDebug && GetBoolArg("-printcreation"))
         printf("GetProofOfStakeReward(): create=%s nCoinAge=%" PRId64 " nBits=%d\n", FormatMoney(nSubsidy).c_str(), nCoinAge, nBits);
@@ -1143,6 +1276,28 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfSta
     return pindex;
 }
 
+// Fixed-width target arithmetic self-test, see -checktargetarith
+void CheckTargetArith(bool fMatch, const char* pszFunction)
+{
+    if (!fMatch)
+        throw std::runtime_error(strprintf("%s : fixed-width target arithmetic doesn't match bignum result", pszFunction));
+}
+
+// Retarget step of GetNextTargetRequired() done with bignums, which also
+//   handles previous targets with negative or overflowed encoding
+static unsigned int GetNextTargetBigNum(unsigned int nBitsPrev, int64_t nNumerator, int64_t nDenominator, const CBigNum& bnTargetLimit)
+{
+    CBigNum bnNew;
+    bnNew.SetCompact(nBitsPrev);
+    bnNew *= nNumerator;
+    bnNew /= nDenominator;
+
+    if (bnNew > bnTargetLimit)
+        bnNew = bnTargetLimit;
+
+    return bnNew.GetCompact();
+}
+
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake)
 {
     if (pindexLast == NULL)
@@ -1161,17 +1316,32 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
     // ppcoin: target change every block
     // ppcoin: retarget with exponential moving toward target spacing
-    CBigNum bnNew;
-    bnNew.SetCompact(pindexPrev->nBits);
     int64_t nTargetSpacing = fProofOfStake? nStakeTargetSpacing : std::min(GetTargetSpacingWorkMax(pindexLast->nHeight, pindexLast->nTime), (int64_t) nStakeTargetSpacing * (1 + pindexLast->nHeight - pindexPrev->nHeight));
     int64_t nInterval = nTargetTimespan / nTargetSpacing;
-    bnNew *= ((nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing);
-    bnNew /= ((nInterval + 1) * nTargetSpacing);
+    int64_t nNumerator = (nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing;
+    int64_t nDenominator = (nInterval + 1) * nTargetSpacing;
 
-    if (bnNew > bnTargetLimit)
-        bnNew = bnTargetLimit;
+    bool fNegative, fOverflow;
+    uint256 nTargetPrev;
+    nTargetPrev.SetCompact(pindexPrev->nBits, &fNegative, &fOverflow);
 
-    return bnNew.GetCompact();
+    // Negative values can't be represented with unsigned fixed-width numbers
+    if (fNegative || fOverflow || nNumerator < 0)
+        return GetNextTargetBigNum(pindexPrev->nBits, nNumerator, nDenominator, bnTargetLimit);
+
+    uint512 nNew(nTargetPrev);
+    nNew *= uint512((uint64_t)nNumerator);
+    nNew /= uint512((uint64_t)nDenominator);
+
+    uint512 nTargetLimit(bnTargetLimit.getuint256());
+    if (nNew > nTargetLimit)
+        nNew = nTargetLimit;
+
+    unsigned int nBitsNew = nNew.trim256().GetCompact();
+    if (fCheckTargetArith)
+        CheckTargetArith(nBitsNew == GetNextTargetBigNum(pindexPrev->nBits, nNumerator, nDenominator, bnTargetLimit), "GetNextTargetRequired()");
+
+    return nBitsNew;
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
@@ -1237,12 +1407,51 @@ void static InvalidChainFound(CBlockIndex* pindexNew)
 
 uint256 CBlock::GetHash() const
 {
-    return scrypt_blockhash((const uint8_t*)&nVersion);
+    // Header fields are public and get modified in place by the miner and
+    // deserialization, so the cached value is only trusted while the
+    // 80 bytes it was computed from are unchanged.
+    const uint8_t* pHeader = (const uint8_t*)&nVersion;
+    static_assert(sizeof(pchHeaderCached) == 80, "block header must be 80 bytes long");
+    if (fHashCached && memcmp(pchHeaderCached, pHeader, sizeof(pchHeaderCached)) == 0)
+        return hashCached;
+
+    hashCached = scrypt_blockhash(pHeader);
+    memcpy(pchHeaderCached, pHeader, sizeof(pchHeaderCached));
+    fHashCached = true;
+    nHashEvaluations++;
+
+    return hashCached;
+}
+
+void CBlock::PrecomputeHashes(const std::vector<CBlock*>& vpblock)
+{
+    std::vector<CBlock*> vTodo;
+    std::vector<uint8_t> vHeaders;
+    for (CBlock* pblock : vpblock)
+    {
+        const uint8_t* pHeader = (const uint8_t*)&pblock->nVersion;
+        if (pblock->fHashCached && memcmp(pblock->pchHeaderCached, pHeader, sizeof(pblock->pchHeaderCached)) == 0)
+            continue;
+        vTodo.push_back(pblock);
+        vHeaders.insert(vHeaders.end(), pHeader, pHeader + sizeof(pblock->pchHeaderCached));
+    }
+
+    std::vector<uint256> vHash(vTodo.size());
+    scrypt_blockhash_batch(vHeaders.data(), vHash.data(), vTodo.size());
+    for (size_t i = 0; i < vTodo.size(); i++)
+    {
+        CBlock* pblock = vTodo[i];
+        pblock->hashCached = vHash[i];
+        memcpy(pblock->pchHeaderCached, &vHeaders[80 * i], sizeof(pblock->pchHeaderCached));
+        pblock->fHashCached = true;
+        pblock->nHashEvaluations++;
+    }
 }
 
 void CBlock::UpdateTime(const CBlockIndex* pindexPrev)
 {
     nTime = std::max(GetBlockTime(), GetAdjustedTime());
+    InvalidateHash();
 }
 
 
@@ -1410,7 +1619,7 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
 
 bool CScriptCheck::operator()() const {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, pcache.get()))
         return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString().substr(0,10).c_str());
     return true;
 }
@@ -1420,6 +1629,56 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     return CScriptCheck(txFrom, txTo, nIn, flags, nHashType)();
 }
 
+unsigned int GetScriptVerifyFlags(unsigned int nTime)
+{
+    unsigned int nFlags = SCRIPT_VERIFY_P2SH;
+    if (nTime >= CHECKLOCKTIMEVERIFY_SWITCH_TIME)
+        nFlags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    if (nTime >= CHECKSEQUENCEVERIFY_SWITCH_TIME)
+        nFlags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    return nFlags;
+}
+
+// Transactions with all input scripts verified on memory pool acceptance.
+// Entries are salted hashes of (txid, flags): txid commits to every input
+// script and to the spent outputs, and a change of verification flags
+// gives a different entry, so stale results are never used.
+static CDigestCache scriptExecutionCache;
+static unsigned char scriptExecutionCacheNonce[32];
+
+static uint256 ScriptExecutionCacheEntry(const uint256& hashTx, unsigned int flags)
+{
+    uint256 entry;
+    flags &= ~SCRIPT_VERIFY_NOCACHE;
+    CSHA256()
+        .Write(scriptExecutionCacheNonce, sizeof(scriptExecutionCacheNonce))
+        .Write(hashTx.begin(), hashTx.size())
+        .Write((const unsigned char*)&flags, sizeof(flags))
+        .Finalize(entry.begin());
+    return entry;
+}
+
+size_t InitScriptExecutionCache(size_t nMaxBytes)
+{
+    GetRandBytes(scriptExecutionCacheNonce, sizeof(scriptExecutionCacheNonce));
+    return scriptExecutionCache.Resize(nMaxBytes);
+}
+
+const CDigestCache& GetScriptExecutionCache()
+{
+    return scriptExecutionCache;
+}
+
+void AddScriptExecutionCache(const uint256& hashTx, unsigned int flags)
+{
+    scriptExecutionCache.Insert(ScriptExecutionCacheEntry(hashTx, flags));
+}
+
+bool HaveScriptExecutionCache(const uint256& hashTx, unsigned int flags)
+{
+    return scriptExecutionCache.Contains(ScriptExecutionCacheEntry(hashTx, flags));
+}
+
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
     const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fScriptChecks, unsigned int flags, std::vector<CScriptCheck> *pvChecks)
 {
@@ -1432,6 +1691,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256
     {
         int64_t nValueIn = 0;
         int64_t nFees = 0;
+        std::shared_ptr<const CSignatureHashCache> pcache;
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1483,8 +1743,12 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256
             // still computed and checked, and any change will be caught at the next checkpoint.
             if (fScriptChecks)
             {
+                // Signature hashes of all inputs share most of the serialized transaction
+                if (!pcache && vin.size() > 1)
+                    pcache = std::make_shared<const CSignatureHashCache>(*this);
+
                 // Verify signature
-                CScriptCheck check(txPrev, *this, i, flags, 0);
+                CScriptCheck check(txPrev, *this, i, flags, 0, pcache);
                 if (pvChecks)
                 {
                     pvChecks->push_back(CScriptCheck());
@@ -1718,18 +1982,13 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (!tx.IsCoinStake())
                 nFees += nTxValueIn - nTxValueOut;
 
-            unsigned int nFlags = SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_P2SH;
-
-            if (tx.nTime >= CHECKLOCKTIMEVERIFY_SWITCH_TIME) {
-                nFlags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-            }
+            unsigned int nFlags = SCRIPT_VERIFY_NOCACHE | GetScriptVerifyFlags(tx.nTime);
 
-            if (tx.nTime >= CHECKSEQUENCEVERIFY_SWITCH_TIME) {
-                nFlags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
-            }
+            // Skip scripts already verified on memory pool acceptance
+            bool fTxScriptChecks = fScriptChecks && !HaveScriptExecutionCache(hashTx, nFlags);
 
             std::vector<CScriptCheck> vChecks;
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fScriptChecks, nFlags, nScriptCheckThreads ? &vChecks : NULL))
+            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fTxScriptChecks, nFlags, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
@@ -1867,6 +2126,7 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
     for (CBlockIndex* pindex : vDisconnect)
         if (pindex->pprev)
             pindex->pprev->pnext = NULL;
+    InvalidateKernelStakeModifiers(pfork->nHeight + 1);
 
     // Connect longer branch
     for (CBlockIndex* pindex : vConnect)
@@ -2182,6 +2442,11 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
     // These are checks that are independent of context
     // that can be verified before saving an orphan block.
 
+    // The memo only holds while the header and signature it was computed
+    // for are unchanged, getwork modifies kept blocks in place
+    if (fChecked && memcmp(pchHeaderChecked, &nVersion, sizeof(pchHeaderChecked)) == 0 && vchBlockSigChecked == vchBlockSig)
+        return true;
+
     std::set<uint256> uniqueTx; // tx hashes
     unsigned int nSigOps = 0; // total sigops
 
@@ -2285,6 +2550,13 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
     if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
         return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
 
+    if (fCheckPOW && fCheckMerkleRoot && fCheckSig)
+    {
+        fChecked = true;
+        memcpy(pchHeaderChecked, &nVersion, sizeof(pchHeaderChecked));
+        vchBlockSigChecked = vchBlockSig;
+    }
+
     return true;
 }
 
@@ -2343,13 +2615,16 @@ bool CBlock::AcceptBlock()
         !std::equal(expect.begin(), expect.end(), vtx[0].vin[0].scriptSig.begin()))
         return DoS(100, error("AcceptBlock() : block height mismatch in coinbase"));
 
-    // Write block to history file
-    if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION)))
-        return error("AcceptBlock() : out of disk space");
-    unsigned int nFile = std::numeric_limits<unsigned int>::max();
-    unsigned int nBlockPos = 0;
-    if (!WriteToDisk(nFile, nBlockPos))
-        return error("AcceptBlock() : WriteToDisk failed");
+    // Write block to history file, unless it is replayed from there
+    unsigned int nFile = nStoredFile;
+    unsigned int nBlockPos = nStoredBlockPos;
+    if (nFile == std::numeric_limits<unsigned int>::max())
+    {
+        if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION)))
+            return error("AcceptBlock() : out of disk space");
+        if (!WriteToDisk(nFile, nBlockPos))
+            return error("AcceptBlock() : WriteToDisk failed");
+    }
     if (!AddToBlockIndex(nFile, nBlockPos))
         return error("AcceptBlock() : AddToBlockIndex failed");
 
@@ -2369,12 +2644,69 @@ bool CBlock::AcceptBlock()
     return true;
 }
 
+// Trust score for a block meeting the target nBits, 2^256 / (target + 1)
+static uint256 GetTargetTrust(unsigned int nBits)
+{
+    bool fNegative, fOverflow;
+    uint256 nTarget;
+    nTarget.SetCompact(nBits, &fNegative, &fOverflow);
+
+    uint256 nTrust = 0;
+    // Overflowed targets are above 2^256 and get no trust
+    if (!fNegative && !fOverflow && nTarget != 0)
+    {
+        // 2^256 doesn't fit into 256 bits, but 2^256 / (x + 1) == ~x / (x + 1) + 1
+        nTrust = ~nTarget / (nTarget + 1);
+        nTrust += 1;
+    }
+
+    if (fCheckTargetArith)
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        uint256 nTrustCheck = bnTarget <= 0 ? 0 : ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
+        CheckTargetArith(nTrust == nTrustCheck, "GetTargetTrust()");
+    }
+
+    return nTrust;
+}
+
+// Amount of work for a proof-of-work block meeting the target nBits, at least 1
+static uint256 GetWorkTrust(unsigned int nBits)
+{
+    bool fNegative, fOverflow;
+    uint256 nTarget;
+    nTarget.SetCompact(nBits, &fNegative, &fOverflow);
+
+    uint256 nTrust = 0;
+    if (!fNegative && !fOverflow)
+        nTrust = nPoWBase / (nTarget + 1);
+    if (nTrust == 0)
+        nTrust = 1;
+
+    if (fCheckTargetArith)
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        if (bnTarget > 0)
+        {
+            CBigNum bnPoWTrust = CBigNum(nPoWBase) / (bnTarget+1);
+            if (bnPoWTrust < 1)
+                bnPoWTrust = 1;
+            CheckTargetArith(nTrust == bnPoWTrust.getuint256(), "GetWorkTrust()");
+        }
+    }
+
+    return nTrust;
+}
+
 uint256 CBlockIndex::GetBlockTrust() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 nTarget;
+    nTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
-    if (bnTarget <= 0)
+    if (fNegative || (nTarget == 0 && !fOverflow))
         return 0;
 
     // Return 1 for the first 12 blocks
@@ -2385,11 +2717,11 @@ uint256 CBlockIndex::GetBlockTrust() const
 
     if(IsProofOfStake())
     {
-        CBigNum bnNewTrust = (CBigNum(1)<<256) / (bnTarget+1);
+        uint256 nNewTrust = GetTargetTrust(nBits);
 
         // Return 1/3 of score if parent block is not the PoW block
         if (!pprev->IsProofOfWork())
-            return (bnNewTrust / 3).getuint256();
+            return nNewTrust / 3;
 
         int nPoWCount = 0;
 
@@ -2403,24 +2735,23 @@ uint256 CBlockIndex::GetBlockTrust() const
 
         // Return 1/3 of score if less than 3 PoW blocks found
         if (nPoWCount < 3)
-            return (bnNewTrust / 3).getuint256();
+            return nNewTrust / 3;
 
-        return bnNewTrust.getuint256();
+        return nNewTrust;
     }
     else
     {
-        // Calculate work amount for block
-        CBigNum bnPoWTrust = CBigNum(nPoWBase) / (bnTarget+1);
+        // Calculate work amount for block, 1 if PoW difficulty is too low
+        uint256 nPoWTrust = GetWorkTrust(nBits);
 
-        // Set nPowTrust to 1 if PoW difficulty is too low
-        if (bnPoWTrust < 1)
-            bnPoWTrust = 1;
-
-        CBigNum bnLastBlockTrust = CBigNum(pprev->nChainTrust - pprev->pprev->nChainTrust);
+        // 2/3 of previous block score, doubling may overflow 256 bits
+        uint512 nLastBlockTrust(pprev->nChainTrust - pprev->pprev->nChainTrust);
+        nLastBlockTrust *= 2;
+        nLastBlockTrust /= 3;
 
         // Return nPoWTrust + 2/3 of previous block score if two parent blocks are not PoS blocks
         if (!(pprev->IsProofOfStake() && pprev->pprev->IsProofOfStake()))
-            return (bnPoWTrust + 2 * bnLastBlockTrust / 3).getuint256();
+            return (uint512(nPoWTrust) + nLastBlockTrust).trim256();
 
         int nPoSCount = 0;
 
@@ -2434,17 +2765,15 @@ uint256 CBlockIndex::GetBlockTrust() const
 
         // Return nPoWTrust + 2/3 of previous block score if less than 7 PoS blocks found
         if (nPoSCount < 7)
-            return (bnPoWTrust + 2 * bnLastBlockTrust / 3).getuint256();
+            return (uint512(nPoWTrust) + nLastBlockTrust).trim256();
 
-        bnTarget.SetCompact(pprev->nBits);
+        nTarget.SetCompact(pprev->nBits, &fNegative, &fOverflow);
 
-        if (bnTarget <= 0)
+        if (fNegative || (nTarget == 0 && !fOverflow))
             return 0;
 
-        CBigNum bnNewTrust = (CBigNum(1)<<256) / (bnTarget+1);
-
         // Return nPoWTrust + full trust score for previous block nBits
-        return (bnPoWTrust + bnNewTrust).getuint256();
+        return nPoWTrust + GetTargetTrust(pprev->nBits);
     }
 }
 
@@ -2505,6 +2834,7 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     if (!IsCanonicalBlockSignature(pblock)) {
         if (!ReserealizeBlockSignature(pblock))
             printf("WARNING: ProcessBlock() : ReserealizeBlockSignature FAILED\n");
+        pblock->InvalidateHash();
     }
 
     // Preliminary checks
@@ -2637,6 +2967,8 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     }
 
     printf("ProcessBlock: ACCEPTED\n");
+    if (fDebug)
+        printf("ProcessBlock: %u scrypt evaluation(s) for block %s\n", pblock->nHashEvaluations, hash.ToString().substr(0,20).c_str());
 
     // ppcoin: if responsible for sync-checkpoint send it
     if (pfrom && !CSyncCheckpoint::strMasterPrivKey.empty())
@@ -2686,17 +3018,11 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes)
     return true;
 }
 
-static boost::filesystem::path BlockFilePath(unsigned int nFile)
-{
-    std::string strBlockFn = strprintf("blk%04u.dat", nFile);
-    return GetDataDir() / strBlockFn;
-}
-
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
 {
     if ((nFile < 1) || (nFile == std::numeric_limits<uint32_t>::max()))
         return NULL;
-    FILE* file = fopen(BlockFilePath(nFile).string().c_str(), pszMode);
+    FILE* file = fopen(GetBlockFilePath(nFile).string().c_str(), pszMode);
     if (!file)
         return NULL;
     if (nBlockPos != 0 && !strchr(pszMode, 'a') && !strchr(pszMode, 'w'))
@@ -2725,6 +3051,7 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
         // FAT32 file size max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
         if (ftell(file) < (long)(0x7F000000 - MAX_SIZE))
         {
+            blockFilePool.SetWriteFile(nCurrentBlockFile);
             nFileRet = nCurrentBlockFile;
             return file;
         }
@@ -2733,6 +3060,19 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
     }
 }
 
+void CommitBlockFile()
+{
+    // The previous file may have been left without a sync when it filled up
+    for (unsigned int nFile = (nCurrentBlockFile > 1 ? nCurrentBlockFile - 1 : 1); nFile <= nCurrentBlockFile; nFile++)
+    {
+        FILE* file = OpenBlockFile(nFile, 0, "ab");
+        if (!file)
+            continue;
+        FileCommit(file);
+        fclose(file);
+    }
+}
+
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
@@ -2795,7 +3135,7 @@ bool LoadBlockIndex(bool fAllowNew)
         //  vMerkleTree: 4cb33b3b6a
 
         const std::string strTimestamp = "https://bitcointalk.org/index.php?topic=134179.msg1502196#msg1502196";
-        CTransaction txNew;
+        CMutableTransaction txNew;
         txNew.nTime = 1360105017;
         txNew.vin.resize(1);
         txNew.vout.resize(1);
@@ -2947,66 +3287,272 @@ void PrintBlockTree()
     }
 }
 
-bool LoadExternalBlockFile(FILE* fileIn)
+// Context-free checks of imported blocks, run by worker threads ahead of
+//   ProcessBlock(). Only a passing check is memoized in the block, a block
+//   that fails here is checked again and rejected by ProcessBlock(), so the
+//   failure is logged once, by ProcessBlock().
+static void ThreadPreCheckBlocks(const std::vector<CBlock*>* pvpblock, std::atomic<size_t>* pnNext)
 {
-    int64_t nStart = GetTimeMillis();
+    // Eight headers fill the widest scrypt batch
+    const size_t nBatch = 8;
+    std::vector<CBlock*> vBatch;
+    CSilentErrors silent;
+    try
+    {
+        for (size_t n = pnNext->fetch_add(nBatch); n < pvpblock->size(); n = pnNext->fetch_add(nBatch))
+        {
+            vBatch.assign(pvpblock->begin() + n, pvpblock->begin() + std::min(n + nBatch, pvpblock->size()));
+            CBlock::PrecomputeHashes(vBatch);
+            for (CBlock* pblock : vBatch)
+            {
+                int nDoS = pblock->nDoS;
+                pblock->CheckBlock(true, true, (pblock->nTime > Checkpoints::GetLastCheckpointTime()));
+                pblock->nDoS = nDoS;
+            }
+        }
+    }
+    catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ThreadPreCheckBlocks()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ThreadPreCheckBlocks()");
+    }
+}
 
+static int ProcessImportedBlocks(std::vector<CBlock*>& vpblock)
+{
     int nLoaded = 0;
     {
         LOCK(cs_main);
-        try {
-            CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-            while (nPos != std::numeric_limits<uint32_t>::max() && blkdat.good() && !fRequestShutdown)
-            {
-                unsigned char pchData[65536];
-                do {
-                    fseek(blkdat, nPos, SEEK_SET);
-                    size_t nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-                    if (nRead <= 8)
-                    {
-                        nPos = std::numeric_limits<uint32_t>::max();
-                        break;
-                    }
-                    void* nFind = memchr(pchData, pchMessageStart[0], nRead+1-sizeof(pchMessageStart));
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart))==0)
-                        {
-                            nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
-                            break;
-                        }
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    }
-                    else
-                        nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
-                } while(!fRequestShutdown);
-                if (nPos == std::numeric_limits<uint32_t>::max())
-                    break;
+        for (CBlock* pblock : vpblock)
+            if (!fRequestShutdown && ProcessBlock(NULL, pblock))
+                nLoaded++;
+    }
+    for (CBlock* pblock : vpblock)
+        delete pblock;
+    vpblock.clear();
+    return nLoaded;
+}
+
+// Chunks of blocks read from a block file, handed from the reader thread
+//   of LoadExternalBlockFile() to the importing one
+struct CImportQueue
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<std::vector<CBlock*> > queue;
+    bool fDone;
+
+    CImportQueue() : fDone(false) { }
+};
+
+// Scans a block file for blocks and queues them in chunks, blocks while the
+//   importing thread is behind
+static void ThreadReadBlockFile(FILE* fileIn, unsigned int nStartPos, unsigned int nEndPos, unsigned int nStoredFile, CImportQueue* pqueue)
+{
+    // At most this many chunks are read ahead of the one being checked
+    const size_t nMaxQueued = 2;
+    const size_t nChunkBlocks = 256;
+    const size_t nChunkBytes = 32 * 1024 * 1024;
+
+    std::vector<CBlock*> vReading;
+    size_t nReadingBytes = 0;
+
+    auto push = [&]() {
+        std::unique_lock<std::mutex> lock(pqueue->cs);
+        pqueue->cond.wait(lock, [&]() { return pqueue->queue.size() < nMaxQueued; });
+        pqueue->queue.emplace_back();
+        pqueue->queue.back().swap(vReading);
+        nReadingBytes = 0;
+        pqueue->cond.notify_all();
+    };
+
+    try {
+        CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
+        unsigned int nPos = nStartPos;
+        while (nPos < nEndPos && blkdat.good() && !fRequestShutdown)
+        {
+            unsigned char pchData[65536];
+            do {
                 fseek(blkdat, nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
+                size_t nRead = fread(pchData, 1, sizeof(pchData), blkdat);
+                if (nRead <= 8)
+                {
+                    nPos = std::numeric_limits<uint32_t>::max();
+                    break;
+                }
+                void* nFind = memchr(pchData, pchMessageStart[0], nRead+1-sizeof(pchMessageStart));
+                if (nFind)
                 {
-                    CBlock block;
-                    blkdat >> block;
-                    if (ProcessBlock(NULL,&block))
+                    if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart))==0)
                     {
-                        nLoaded++;
-                        nPos += 4 + nSize;
+                        nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
+                        break;
                     }
+                    nPos += ((unsigned char*)nFind - pchData) + 1;
                 }
+                else
+                    nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
+            } while(!fRequestShutdown);
+            if (nPos >= nEndPos)
+                break;
+            fseek(blkdat, nPos, SEEK_SET);
+            unsigned int nSize;
+            blkdat >> nSize;
+            if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
+            {
+                CBlock* pblock = new CBlock();
+                try {
+                    blkdat >> *pblock;
+                }
+                catch (...) {
+                    delete pblock;
+                    throw;
+                }
+                // Blocks of our own files are indexed where they are, the
+                //   bytes must be exactly what storing the block would write
+                if (nStoredFile != std::numeric_limits<unsigned int>::max() &&
+                    ::GetSerializeSize(*pblock, SER_DISK, CLIENT_VERSION) == nSize)
+                {
+                    pblock->nStoredFile = nStoredFile;
+                    pblock->nStoredBlockPos = nPos + 4;
+                }
+                vReading.push_back(pblock);
+                nReadingBytes += nSize;
+                nPos += 4 + nSize;
             }
+
+            if (vReading.size() >= nChunkBlocks || nReadingBytes >= nChunkBytes)
+                push();
         }
-        catch (const std::exception&) {
-            printf("%s() : Deserialize or I/O error caught during load\n",
-                   BOOST_CURRENT_FUNCTION);
+    }
+    catch (const std::exception&) {
+        printf("%s() : Deserialize or I/O error caught during load\n",
+               BOOST_CURRENT_FUNCTION);
+    }
+    catch (...) {
+        PrintExceptionContinue(NULL, "ThreadReadBlockFile()");
+    }
+
+    // Blocks read before an error are still imported
+    if (!vReading.empty())
+        push();
+
+    std::lock_guard<std::mutex> lock(pqueue->cs);
+    pqueue->fDone = true;
+    pqueue->cond.notify_all();
+}
+
+bool LoadExternalBlockFile(FILE* fileIn, unsigned int nStartPos, unsigned int nEndPos, unsigned int nStoredFile)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Blocks are imported as a pipeline of chunks: while one chunk goes
+    //   through ProcessBlock() in file order, worker threads verify the
+    //   proof-of-work, merkle root and signatures of the next one, and a
+    //   reader thread scans and deserializes the chunks after that.
+    const int nThreads = std::max(nScriptCheckThreads, 1);
+
+    CImportQueue queue;
+    std::thread reader(ThreadReadBlockFile, fileIn, nStartPos, nEndPos, nStoredFile, &queue);
+
+    std::vector<CBlock*> vChecked, vChecking, vNext;
+    std::vector<std::thread> vThreads;
+    std::atomic<size_t> nNext(0);
+
+    int nLoaded = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue.cs);
+            queue.cond.wait(lock, [&]() { return queue.fDone || !queue.queue.empty(); });
+            if (queue.queue.empty())
+                break;
+            vNext.swap(queue.queue.front());
+            queue.queue.pop_front();
+            queue.cond.notify_all();
         }
+
+        for (std::thread& thread : vThreads)
+            thread.join();
+        vThreads.clear();
+
+        vChecked.swap(vChecking);
+        vChecking.swap(vNext);
+        nNext = 0;
+        for (int i = 0; i < nThreads; i++)
+            vThreads.emplace_back(ThreadPreCheckBlocks, &vChecking, &nNext);
+
+        nLoaded += ProcessImportedBlocks(vChecked);
     }
+    reader.join();
+
+    // Drain the pipeline
+    for (std::thread& thread : vThreads)
+        thread.join();
+    nLoaded += ProcessImportedBlocks(vChecking);
+
     printf("Loaded %i blocks from external file in %" PRId64 "ms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+bool ReplayBlockFiles()
+{
+    // Database changes since its last flush are lost after a crash, the
+    // blocks stored after the last indexed one are accepted again where
+    // they are
+    CBlockIndex* pindexLast = NULL;
+    {
+        LOCK(cs_main);
+        for (const auto& item : mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            if (!pindexLast || std::make_pair(pindex->nFile, pindex->nBlockPos) > std::make_pair(pindexLast->nFile, pindexLast->nBlockPos))
+                pindexLast = pindex;
+        }
+    }
+    if (!pindexLast)
+        return true;
+
+    CBlockFileBytes header;
+    if (pindexLast->nBlockPos < 8 || !header.Read(pindexLast->nFile, pindexLast->nBlockPos - 8, 8))
+        return error("ReplayBlockFiles() : can't read index header of the last block");
+    unsigned int nSize;
+    memcpy(&nSize, header.begin() + 4, sizeof(nSize));
+    header.clear();
+
+    // Only look at what's stored now, blocks which arrive meanwhile are
+    // written and indexed as usual
+    struct CRange
+    {
+        unsigned int nFile;
+        unsigned int nStartPos;
+        unsigned int nEndPos;
+    };
+    std::vector<CRange> vRanges;
+    unsigned int nStartPos = pindexLast->nBlockPos + nSize;
+    for (unsigned int nFile = pindexLast->nFile; ; nFile++)
+    {
+        FILE* file = OpenBlockFile(nFile, 0, "rb");
+        if (!file)
+            break;
+        int nFileSize = GetFilesize(file);
+        fclose(file);
+        if (nFileSize > 0 && (unsigned int)nFileSize > nStartPos)
+            vRanges.push_back(CRange{nFile, nStartPos, (unsigned int)nFileSize});
+        nStartPos = 0;
+    }
+
+    for (const CRange& range : vRanges)
+    {
+        FILE* file = OpenBlockFile(range.nFile, 0, "rb");
+        if (!file)
+            continue;
+        printf("ReplayBlockFiles() : replaying blk%04u.dat from %u to %u\n", range.nFile, range.nStartPos, range.nEndPos);
+        LoadExternalBlockFile(file, range.nStartPos, range.nEndPos, range.nFile);
+    }
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // CAlert
@@ -3414,9 +3960,10 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 auto mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-                    pfrom->PushMessage("block", block);
+                    // Stored bytes are the serialized block already
+                    std::shared_ptr<const CRawBlock> rawBlock = GetRawBlock((*mi).second);
+                    if (rawBlock)
+                        pfrom->PushRawMessage("block", &rawBlock->vch[0], &rawBlock->vch[0] + rawBlock->vch.size(), &rawBlock->nChecksum);
 
                     // Trigger them to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
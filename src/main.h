@@ -7,6 +7,7 @@
 
 #include "timestamps.h"
 #include "sync.h"
+#include "blockfile.h"
 #include "net.h"
 #include "script.h"
 
@@ -14,6 +15,7 @@
 #include <limits>
 #include <list>
 #include <map>
+#include <memory>
 
 class CWallet;
 class CBlock;
@@ -35,6 +37,7 @@ static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
 static const unsigned int MAX_INV_SZ = 50000;
+static const size_t RAW_BLOCK_CACHE_SIZE = 8 * MAX_BLOCK_SIZE;
 
 static const int64_t MIN_TX_FEE = CENT/10;
 static const int64_t MIN_RELAY_TX_FEE = CENT/50;
@@ -86,6 +89,7 @@ extern int64_t nTransactionFee;
 extern int64_t nMinimumInputValue;
 extern bool fUseFastIndex;
 extern int nScriptCheckThreads;
+extern bool fCheckTargetArith;
 extern const uint256 entropyStore[38];
 
 // Minimum disk space required - used in CheckDiskSpace()
@@ -102,7 +106,9 @@ void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL, bool f
 bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
+bool ReadBlockBytesFromDisk(const CBlockIndex* pindex, CBlockFileBytes& bytes);
 FILE* AppendBlockFile(unsigned int& nFileRet);
+void CommitBlockFile();
 
 void UnloadBlockIndex();
 bool LoadBlockIndex(bool fAllowNew=true);
@@ -110,7 +116,8 @@ void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
-bool LoadExternalBlockFile(FILE* fileIn);
+bool LoadExternalBlockFile(FILE* fileIn, unsigned int nStartPos=0, unsigned int nEndPos=std::numeric_limits<unsigned int>::max(), unsigned int nStoredFile=std::numeric_limits<unsigned int>::max());
+bool ReplayBlockFiles();
 
 // Run an instance of the script checking thread
 void ThreadScriptCheck(void* parg);
@@ -119,8 +126,10 @@ void ThreadScriptCheckQuit();
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
+void CheckTargetArith(bool fMatch, const char* pszFunction);
 int64_t GetProofOfWorkReward(unsigned int nBits);
 int64_t GetProofOfStakeReward(int64_t nCoinAge, unsigned int nBits, int64_t nTime, bool bCoinYearOnly=false);
+int64_t GetProofOfStakeRewardAtRate(int64_t nCoinAge, int64_t nRewardCoinYear);
 unsigned int ComputeMinWork(unsigned int nBase, int64_t nTime);
 unsigned int ComputeMinStake(unsigned int nBase, int64_t nTime, unsigned int nBlockTime);
 int GetNumBlocksOfPeers();
@@ -133,6 +142,15 @@ void ResendWalletTransactions(bool fForceResend=false);
 
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
 
+// Consensus script verification flags for transaction timestamp
+unsigned int GetScriptVerifyFlags(unsigned int nTime);
+
+// Cache of transactions with all input scripts verified under given flags
+size_t InitScriptExecutionCache(size_t nMaxBytes);
+const CDigestCache& GetScriptExecutionCache();
+void AddScriptExecutionCache(const uint256& hashTx, unsigned int flags);
+bool HaveScriptExecutionCache(const uint256& hashTx, unsigned int flags);
+
 
 
 
@@ -424,56 +442,61 @@ enum GetMinFee_mode
 
 typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
 
+struct CMutableTransaction;
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
+ * Its fields are immutable, transactions are built and edited as
+ * CMutableTransaction.
  */
 class CTransaction
 {
+private:
+    // memory only: transaction id, fixed when the transaction is
+    // constructed, assigned or deserialized
+    const uint256 hash;
+    void UpdateHash() const;
+
 public:
     static const int CURRENT_VERSION=1;
-    int nVersion;
-    uint32_t nTime;
-    std::vector<CTxIn> vin;
-    std::vector<CTxOut> vout;
-    uint32_t nLockTime;
+    const int nVersion;
+    const uint32_t nTime;
+    const std::vector<CTxIn> vin;
+    const std::vector<CTxOut> vout;
+    const uint32_t nLockTime;
 
     // Denial-of-service detection:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
-    CTransaction()
-    {
-        SetNull();
-    }
+    /** Construct a CTransaction that qualifies as IsNull() */
+    CTransaction();
+
+    /** Convert a CMutableTransaction into a CTransaction. */
+    CTransaction(const CMutableTransaction &tx);
+
+    CTransaction& operator=(const CTransaction& tx);
 
     IMPLEMENT_SERIALIZE
     (
-        READWRITE(this->nVersion);
+        READWRITE(*const_cast<int*>(&this->nVersion));
         nVersion = this->nVersion;
-        READWRITE(nTime);
-        READWRITE(vin);
-        READWRITE(vout);
-        READWRITE(nLockTime);
+        READWRITE(*const_cast<uint32_t*>(&nTime));
+        READWRITE(*const_cast<std::vector<CTxIn>*>(&vin));
+        READWRITE(*const_cast<std::vector<CTxOut>*>(&vout));
+        READWRITE(*const_cast<uint32_t*>(&nLockTime));
+        if (fRead)
+            UpdateHash();
     )
 
-    void SetNull()
-    {
-        nVersion = CTransaction::CURRENT_VERSION;
-        nTime = (uint32_t) GetAdjustedTime();
-        vin.clear();
-        vout.clear();
-        nLockTime = 0;
-        nDoS = 0;  // Denial-of-service prevention
-    }
-
     bool IsNull() const
     {
         return (vin.empty() && vout.empty());
     }
 
-    uint256 GetHash() const
+    const uint256& GetHash() const
     {
-        return SerializeHash(*this);
+        return hash;
     }
 
     bool IsFinal(int nBlockHeight=0, int64_t nBlockTime=0) const
@@ -600,6 +623,21 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        if (!pfileRet)
+        {
+            // Plain reads go through the shared block file handles
+            CBlockFileReader filein(pos.nFile, pos.nTxPos, SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
+            try {
+                filein >> *this;
+            }
+            catch (const std::exception&) {
+                return error("%s() : deserialize or I/O error", BOOST_CURRENT_FUNCTION);
+            }
+            return true;
+        }
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -714,6 +752,34 @@ protected:
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
 };
 
+/** A mutable version of CTransaction, for building and editing transactions. */
+struct CMutableTransaction
+{
+    int nVersion;
+    uint32_t nTime;
+    std::vector<CTxIn> vin;
+    std::vector<CTxOut> vout;
+    uint32_t nLockTime;
+
+    CMutableTransaction();
+    CMutableTransaction(const CTransaction& tx);
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(nTime);
+        READWRITE(vin);
+        READWRITE(vout);
+        READWRITE(nLockTime);
+    )
+
+    /** Compute the hash of this CMutableTransaction. This is computed on the
+     * fly, as opposed to GetHash() in CTransaction, which uses a cached result.
+     */
+    uint256 GetHash() const;
+};
+
 /** Closure representing one script verification
  *  Note that this stores references to the spending transaction */
 class CScriptCheck
@@ -724,12 +790,14 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    std::shared_ptr<const CSignatureHashCache> pcache;
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const std::shared_ptr<const CSignatureHashCache>& pcacheIn = std::shared_ptr<const CSignatureHashCache>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), pcache(pcacheIn) { }
 
     bool operator()() const;
 
@@ -739,6 +807,7 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        pcache.swap(check.pcache);
     }
 };
 
@@ -883,17 +952,40 @@ public:
     // memory only
     mutable std::vector<uint256> vMerkleTree;
 
+    // memory only: scrypt hash of the header image it was computed from,
+    // recomputed by GetHash() as soon as any header field differs
+    mutable uint256 hashCached;
+    mutable unsigned char pchHeaderCached[80];
+    mutable bool fHashCached;
+    mutable uint32_t nHashEvaluations; // number of scrypt evaluations for this block
+
+    // memory only: CheckBlock() has passed with all checks enabled for the
+    // header and signature below, so changes to them are noticed the same
+    // way as for the hash. Mutators of vtx must call InvalidateHash().
+    mutable bool fChecked;
+    mutable unsigned char pchHeaderChecked[80];
+    mutable std::vector<unsigned char> vchBlockSigChecked;
+
+    // memory only: position of the block in a block file it was replayed
+    // from, AcceptBlock() indexes it there instead of storing it again.
+    // Any change of the block forgets it.
+    mutable unsigned int nStoredFile;
+    mutable unsigned int nStoredBlockPos;
+
     // Denial-of-service detection:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
     CBlock()
     {
+        nHashEvaluations = 0;
         SetNull();
     }
 
     IMPLEMENT_SERIALIZE
     (
+        if (fRead)
+            InvalidateHash();
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(hashPrevBlock);
@@ -926,6 +1018,7 @@ public:
         vtx.clear();
         vchBlockSig.clear();
         vMerkleTree.clear();
+        InvalidateHash();
         nDoS = 0;
     }
 
@@ -936,6 +1029,17 @@ public:
 
     uint256 GetHash() const;
 
+    // Fill the hash cache of several blocks at once
+    static void PrecomputeHashes(const std::vector<CBlock*>& vpblock);
+
+    void InvalidateHash() const
+    {
+        fHashCached = false;
+        fChecked = false;
+        nStoredFile = std::numeric_limits<unsigned int>::max();
+        nStoredBlockPos = 0;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -993,18 +1097,22 @@ public:
 
     uint256 BuildMerkleTree() const
     {
+        static_assert(sizeof(uint256) == 32, "merkle tree nodes must be packed");
+
         vMerkleTree.clear();
         for (const CTransaction& tx : vtx)
             vMerkleTree.push_back(tx.GetHash());
         int j = 0;
         for (int nSize = (int)vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            // Sibling pairs are adjacent, so a whole level is hashed as
+            //   a batch of 64 byte messages
+            int nOut = (int)vMerkleTree.size();
+            vMerkleTree.resize(nOut + (nSize + 1) / 2);
+            SHA256D64(vMerkleTree[nOut].begin(), vMerkleTree[j].begin(), nSize / 2);
+            if (nSize & 1)
+                vMerkleTree.back() = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                          BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -1072,8 +1180,9 @@ public:
     {
         SetNull();
 
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
+        // Read from the shared handle of the history file, the index header
+        // in front of a full block tells how much to read at once
+        CBlockFileReader filein(nFile, fReadTransactions ? nBlockPos - 8 : nBlockPos, SER_DISK, CLIENT_VERSION, fReadTransactions ? 16 * BLOCKFILE_READ_AHEAD : BLOCKFILE_READ_AHEAD);
         if (!filein)
             return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
         if (!fReadTransactions)
@@ -1081,6 +1190,15 @@ public:
 
         // Read block
         try {
+            if (fReadTransactions)
+            {
+                unsigned char pchMessageStartFile[4];
+                unsigned int nSize;
+                filein >> FLATDATA(pchMessageStartFile) >> nSize;
+                if (memcmp(pchMessageStartFile, pchMessageStart, sizeof(pchMessageStart)) != 0 || nSize > MAX_SIZE)
+                    return error("CBlock::ReadFromDisk() : bad index header");
+                filein.Reserve(nSize);
+            }
             filein >> *this;
         }
         catch (const std::exception&) {
@@ -9,6 +9,9 @@
 #include "kernel.h"
 #include "kernel_worker.h"
 #include "wallet.h"
+#include "scrypt.h"
+
+#include <atomic>
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -112,7 +115,7 @@ std::shared_ptr<CBlock> CreateNewBlock(CWallet* pwallet, CTransaction *txCoinSta
         return nullptr;
 
     // Create coinbase tx
-    CTransaction txCoinBase;
+    CMutableTransaction txCoinBase;
     txCoinBase.vin.resize(1);
     txCoinBase.vin[0].prevout.SetNull();
     txCoinBase.vout.resize(1);
@@ -360,7 +363,9 @@ std::shared_ptr<CBlock> CreateNewBlock(CWallet* pwallet, CTransaction *txCoinSta
 
         if (!fProofOfStake)
         {
-            pblock->vtx[0].vout[0].nValue = GetProofOfWorkReward(pblock->nBits) + nFees;
+            CMutableTransaction txCoinBase(pblock->vtx[0]);
+            txCoinBase.vout[0].nValue = GetProofOfWorkReward(pblock->nBits) + nFees;
+            pblock->vtx[0] = txCoinBase;
 
             if (fDebug)
                 printf("CreateNewBlock(): PoW reward %" PRIu64 "\n", pblock->vtx[0].vout[0].nValue);
@@ -386,20 +391,28 @@ std::shared_ptr<CBlock> CreateNewBlock(CWallet* pwallet, CTransaction *txCoinSta
 
 void IncrementExtraNonce(std::shared_ptr<CBlock>& pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
-    // Update nExtraNonce
+    // Update nExtraNonce, the miner threads, the stake miner and getwork
+    //   all come here
+    static CCriticalSection cs_extraNonce;
     static uint256 hashPrevBlock;
-    if (hashPrevBlock != pblock->hashPrevBlock)
     {
-        nExtraNonce = 0;
-        hashPrevBlock = pblock->hashPrevBlock;
+        LOCK(cs_extraNonce);
+        if (hashPrevBlock != pblock->hashPrevBlock)
+        {
+            nExtraNonce = 0;
+            hashPrevBlock = pblock->hashPrevBlock;
+        }
     }
     ++nExtraNonce;
 
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
+    CMutableTransaction txCoinBase(pblock->vtx[0]);
+    txCoinBase.vin[0].scriptSig = (CScript() << nHeight << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
+    assert(txCoinBase.vin[0].scriptSig.size() <= 100);
+    pblock->vtx[0] = txCoinBase;
 
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    pblock->InvalidateHash();
 }
 
 
@@ -529,112 +542,322 @@ bool CheckStake(const std::shared_ptr<CBlock>& pblock, CWallet& wallet)
 // (txid, vout.n) => (kernel, (tx.nTime, nAmount))
 typedef std::map<std::pair<uint256, unsigned int>, std::pair<std::vector<unsigned char>, std::pair<uint32_t, uint64_t> > > MidstateMap;
 
-// Fill the inputs map with precalculated contexts and metadata
-bool FillMap(CWallet *pwallet, uint32_t nUpperTime, MidstateMap &inputsMap)
+// Wallet output which may become a stake input: everything the kernel
+//   needs except the stake modifier
+struct CStakeCandidate
 {
-    // Choose coins to use
-    int64_t nBalance = pwallet->GetBalance();
+    uint256 hashBlock;      // block containing the transaction
+    uint32_t nBlockTime;
+    uint32_t nTxOffset;     // offset of the transaction in its block
+    uint32_t nTxTime;
+    int64_t nValue;
+};
 
-    if (nBalance <= nReserveBalance)
-        return false;
+// Stake inputs of the wallet, maintained incrementally: wallet transaction
+//   notifications mark transactions for re-examination, new best blocks make
+//   waiting candidates eligible. Only new outputs are looked up in the
+//   transaction index, kernel prefix of a candidate is built once when its
+//   stake modifier becomes known.
+class CStakeInputs
+{
+private:
+    CWallet *pwallet;
 
-    uint32_t nTime = GetAdjustedTime();
+    CCriticalSection cs_pending;
+    std::set<uint256> setPendingTx;
+    bool fRescan;
 
-    CTxDB txdb("r");
+    std::map<MidstateMap::key_type, CStakeCandidate> mapCandidates;
+    MidstateMap mapReady;
+    CBlockIndex *pindexLast;
+
+    void UpdateTx(CTxDB& txdb, const uint256& hashTx);
+    void UpdateReady();
+
+public:
+    // Upper limit of the staked value, which is the balance above -reservebalance
+    int64_t nStakeLimit;
+
+    CStakeInputs(CWallet *pwalletIn) : pwallet(pwalletIn), fRescan(true), pindexLast(NULL), nStakeLimit(MAX_MONEY) { }
+
+    void NotifyTransactionChanged(CWallet *wallet, const uint256 &hashTx, ChangeType status)
     {
-        LOCK2(cs_main, pwallet->cs_wallet);
+        LOCK(cs_pending);
+        setPendingTx.insert(hashTx);
+    }
 
-        CoinsSet setCoins;
-        int64_t nValueIn = 0;
-        if (!pwallet->SelectCoinsSimple(nBalance - nReserveBalance, MIN_TX_FEE, MAX_MONEY, nUpperTime, nCoinbaseMaturity * 10, setCoins, nValueIn))
-            return error("FillMap() : SelectCoinsSimple failed");
+    // Apply pending changes, returns true if the best block has been changed
+    bool Update();
+
+    void Erase(const MidstateMap::key_type& key)
+    {
+        mapReady.erase(key);
+        mapCandidates.erase(key);
+    }
 
-        if (setCoins.empty())
-            return false;
+    // Keep the input out of scans until the next update that examines the
+    //   candidates, its kernel is built again then unless the wallet has
+    //   marked it spent meanwhile
+    void Postpone(const MidstateMap::key_type& key)
+    {
+        mapReady.erase(key);
+    }
 
-        CBlock block;
-        CTxIndex txindex;
+    const MidstateMap& Ready() const { return mapReady; }
+};
 
-        for(CoinsSet::const_iterator pcoin = setCoins.begin(); pcoin != setCoins.end(); pcoin++)
-        {
-            std::pair<uint256, uint32_t> key = {pcoin->first->GetHash(), pcoin->second};
+// Re-examine outputs of the wallet transaction, requires cs_main and cs_wallet
+void CStakeInputs::UpdateTx(CTxDB& txdb, const uint256& hashTx)
+{
+    std::map<uint256, CWalletTx>::const_iterator mi = pwallet->mapWallet.find(hashTx);
+    const CWalletTx *pcoin = mi != pwallet->mapWallet.end() ? &mi->second : NULL;
 
-            // Skip existent inputs
-            if (inputsMap.find(key) != inputsMap.end())
-                continue;
+    CBlockIndex *pindex = NULL;
+    if (pcoin && (!pcoin->IsFinal() || pcoin->GetDepthInMainChain(pindex) <= 0))
+        pcoin = NULL;
 
-            // Trying to parse scriptPubKey
+    CTxIndex txindex;
+    bool fHaveTxIndex = false;
+
+    unsigned int nOutputs = pcoin ? pcoin->vout.size() : 0;
+    for (std::map<MidstateMap::key_type, CStakeCandidate>::iterator it = mapCandidates.lower_bound({hashTx, 0}); it != mapCandidates.end() && it->first.first == hashTx; it++)
+        nOutputs = std::max(nOutputs, it->first.second + 1);
+
+    for (unsigned int i = 0; i < nOutputs; i++)
+    {
+        MidstateMap::key_type key = {hashTx, i};
+
+        bool fStakeable = pcoin && i < pcoin->vout.size() && !pcoin->IsSpent(i) &&
+            pwallet->IsMine(pcoin->vout[i]) == MINE_SPENDABLE &&
+            pcoin->vout[i].nValue >= MIN_TX_FEE && pcoin->vout[i].nValue < MAX_MONEY;
+
+        // Only support pay to public key and pay to address
+        if (fStakeable)
+        {
             txnouttype whichType;
             std::vector<valtype> vSolutions;
-            if (!Solver(pcoin->first->vout[pcoin->second].scriptPubKey, whichType, vSolutions))
-                continue;
+            fStakeable = Solver(pcoin->vout[i].scriptPubKey, whichType, vSolutions) &&
+                (whichType == TX_PUBKEY || whichType == TX_PUBKEYHASH);
+        }
 
-            // Only support pay to public key and pay to address
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
-                continue;
+        if (!fStakeable)
+        {
+            Erase(key);
+            continue;
+        }
 
-            // Load transaction index item
-            if (!txdb.ReadTxIndex(pcoin->first->GetHash(), txindex))
-                continue;
+        // Known candidate which has stayed in the same block
+        std::map<MidstateMap::key_type, CStakeCandidate>::iterator it = mapCandidates.find(key);
+        if (it != mapCandidates.end() && it->second.hashBlock == pindex->GetBlockHash())
+            continue;
 
-            // Read block header
-            if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
-                continue;
+        if (!fHaveTxIndex && !(fHaveTxIndex = txdb.ReadTxIndex(hashTx, txindex)))
+        {
+            Erase(key);
+            continue;
+        }
 
-            // Only load coins meeting min age requirement
-            if (nStakeMinAge + block.nTime > nTime - nMaxStakeSearchInterval)
-                continue;
+        CStakeCandidate candidate;
+        candidate.hashBlock = pindex->GetBlockHash();
+        candidate.nBlockTime = pindex->nTime;
+        candidate.nTxOffset = txindex.pos.nTxPos - txindex.pos.nBlockPos;
+        candidate.nTxTime = pcoin->nTime;
+        candidate.nValue = pcoin->vout[i].nValue;
 
-            // Get stake modifier
-            uint64_t nStakeModifier = 0;
-            if (!GetKernelStakeModifier(block.GetHash(), nStakeModifier))
-                continue;
+        mapReady.erase(key);
+        mapCandidates[key] = candidate;
+    }
+}
+
+// Build kernels of the candidates which are eligible now and drop the ones
+//   disconnected from the main chain, requires cs_main
+void CStakeInputs::UpdateReady()
+{
+    uint32_t nTime = GetAdjustedTime();
 
-            // Build static part of kernel
-            CDataStream ssKernel(SER_GETHASH, 0);
-            ssKernel << nStakeModifier;
-            ssKernel << block.nTime << (txindex.pos.nTxPos - txindex.pos.nBlockPos) << pcoin->first->nTime << pcoin->second;
+    for (std::map<MidstateMap::key_type, CStakeCandidate>::iterator it = mapCandidates.begin(); it != mapCandidates.end(); )
+    {
+        const MidstateMap::key_type& key = it->first;
+        const CStakeCandidate& candidate = it->second;
 
-            // (txid, vout.n) => (kernel, (tx.nTime, nAmount))
-            inputsMap[key] = {std::vector<unsigned char>(ssKernel.begin(), ssKernel.end()), {pcoin->first->nTime, pcoin->first->vout[pcoin->second].nValue}};
+        std::map<uint256, CBlockIndex*>::const_iterator mi = mapBlockIndex.find(candidate.hashBlock);
+        if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+        {
+            // Examine it again when the wallet learns about the new block
+            {
+                LOCK(cs_pending);
+                setPendingTx.insert(key.first);
+            }
+            mapReady.erase(key);
+            mapCandidates.erase(it++);
+            continue;
         }
 
-        nStakeInputsMapSize = inputsMap.size();
+        if (mapReady.count(key) == 0)
+        {
+            // Confirmations required by SelectCoinsSimple() in the previous
+            //   implementation, these also cover coinbase and coinstake maturity.
+            // Only load coins meeting min age requirement.
+            int nDepth = nBestHeight - mi->second->nHeight + 1;
+            uint64_t nStakeModifier = 0;
+            if (nDepth >= nCoinbaseMaturity * 10 && candidate.nTxTime <= nTime &&
+                nStakeMinAge + candidate.nBlockTime <= nTime - nMaxStakeSearchInterval &&
+                GetKernelStakeModifier(candidate.hashBlock, nStakeModifier))
+            {
+                // Build static part of kernel
+                CDataStream ssKernel(SER_GETHASH, 0);
+                ssKernel << nStakeModifier;
+                ssKernel << candidate.nBlockTime << candidate.nTxOffset << candidate.nTxTime << key.second;
 
-        if (fDebug)
-            printf("FillMap() : Map of %" PRIu64 " precalculated contexts has been created by stake miner\n", nStakeInputsMapSize);
+                // (txid, vout.n) => (kernel, (tx.nTime, nAmount))
+                mapReady[key] = {std::vector<unsigned char>(ssKernel.begin(), ssKernel.end()), {candidate.nTxTime, (uint64_t)candidate.nValue}};
+            }
+        }
+
+        it++;
     }
+}
 
-    return true;
+bool CStakeInputs::Update()
+{
+    std::set<uint256> setTx;
+    bool fFullRescan;
+    {
+        LOCK(cs_pending);
+        setTx.swap(setPendingTx);
+        fFullRescan = fRescan;
+        fRescan = false;
+    }
+
+    bool fNewBlock = pindexLast != pindexBest;
+    if (setTx.empty() && !fFullRescan && !fNewBlock)
+        return false;
+
+    CTxDB txdb("r");
+    {
+        LOCK2(cs_main, pwallet->cs_wallet);
+
+        if (fFullRescan)
+            for (std::map<uint256, CWalletTx>::const_iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); it++)
+                setTx.insert(it->first);
+
+        for (const uint256& hashTx : setTx)
+            UpdateTx(txdb, hashTx);
+
+        UpdateReady();
+        pindexLast = pindexBest;
+
+        nStakeLimit = MAX_MONEY;
+        if (nReserveBalance > 0)
+            nStakeLimit = pwallet->GetBalance() - nReserveBalance;
+    }
+
+    nStakeInputsMapSize = mapReady.size();
+
+    if (fDebug)
+        printf("CStakeInputs::Update() : %" PRIszu " transactions examined, %" PRIu64 " of %" PRIszu " stake inputs are ready\n", setTx.size(), nStakeInputsMapSize, mapCandidates.size());
+
+    return fNewBlock;
+}
+
+// Inputs are handed out to the scanner threads in chunks of this size
+static const size_t STAKE_SCAN_CHUNK = 64;
+
+// Shared state of the inputs map scan
+struct CStakeScan
+{
+    std::vector<MidstateMap::const_iterator> vInputs;
+    std::pair<uint32_t, uint32_t> interval;
+    uint32_t nBits;
+
+    std::atomic<size_t> nNext;   // first input of the next unclaimed chunk
+    std::atomic<size_t> nFound;  // lowest input with a solution so far
+
+    CCriticalSection cs;
+    std::pair<uint256, uint32_t> solution;
+
+    CStakeScan() : nNext(0), nFound(std::numeric_limits<size_t>::max()) { }
+};
+
+// Claim chunks of inputs and scan them until there is nothing left. Chunks
+//   are claimed in map order, and inputs behind the lowest solution found
+//   so far are skipped, so the result is the same as of sequential scan.
+static void ScanMapWorker(CStakeScan *scan)
+{
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    size_t nInputs = scan->vInputs.size();
+    while (!fShutdown)
+    {
+        size_t nBegin = scan->nNext.fetch_add(STAKE_SCAN_CHUNK);
+        if (nBegin >= nInputs || nBegin >= scan->nFound.load())
+            break;
+
+        size_t nEnd = std::min(nBegin + STAKE_SCAN_CHUNK, nInputs);
+        for (size_t i = nBegin; i < nEnd && i < scan->nFound.load() && !fShutdown; i++)
+        {
+            MidstateMap::const_iterator input = scan->vInputs[i];
+            unsigned char *kernel = (unsigned char *) &input->second.first[0];
+            std::pair<uint32_t, uint32_t> interval = scan->interval;
+            std::pair<uint256, uint32_t> solution;
+
+            // scan(State, Bits, Time, Amount, ...)
+            if (ScanKernelBackward(kernel, scan->nBits, input->second.second.first, input->second.second.second, interval, solution))
+            {
+                LOCK(scan->cs);
+                if (i < scan->nFound.load())
+                {
+                    scan->nFound = i;
+                    scan->solution = solution;
+                }
+                break;
+            }
+        }
+    }
 }
 
 // Scan inputs map in order to find a solution
-bool ScanMap(const MidstateMap &inputsMap, uint32_t nBits, MidstateMap::key_type &LuckyInput, std::pair<uint256, uint32_t> &solution)
+bool ScanMap(const MidstateMap &inputsMap, int64_t nStakeLimit, uint32_t nBits, unsigned int nThreads, MidstateMap::key_type &LuckyInput, std::pair<uint256, uint32_t> &solution)
 {
     static uint32_t nLastCoinStakeSearchTime = GetAdjustedTime(); // startup timestamp
     uint32_t nSearchTime = GetAdjustedTime();
 
-    if (inputsMap.size() > 0 && nSearchTime > nLastCoinStakeSearchTime)
+    if (inputsMap.size() > 0 && nStakeLimit > 0 && nSearchTime > nLastCoinStakeSearchTime)
     {
-        // Scanning interval (begintime, endtime)
-        std::pair<uint32_t, uint32_t> interval;
+        CStakeScan scan;
+        scan.nBits = nBits;
 
-        interval.first = nSearchTime;
-        interval.second = nSearchTime - std::min(nSearchTime-nLastCoinStakeSearchTime, nMaxStakeSearchInterval);
+        // Scanning interval (begintime, endtime)
+        scan.interval.first = nSearchTime;
+        scan.interval.second = nSearchTime - std::min(nSearchTime-nLastCoinStakeSearchTime, nMaxStakeSearchInterval);
 
         // (txid, nout) => (kernel, (tx.nTime, nAmount))
-        for(MidstateMap::const_iterator input = inputsMap.begin(); input != inputsMap.end(); input++)
+        // Inputs are taken until their sum reaches the staking limit
+        int64_t nValueIn = 0;
+        scan.vInputs.reserve(inputsMap.size());
+        for(MidstateMap::const_iterator input = inputsMap.begin(); input != inputsMap.end() && nValueIn < nStakeLimit; input++)
         {
-            unsigned char *kernel = (unsigned char *) &input->second.first[0];
+            scan.vInputs.push_back(input);
+            nValueIn += input->second.second.second;
+        }
 
-            // scan(State, Bits, Time, Amount, ...)
-            if (ScanKernelBackward(kernel, nBits, input->second.second.first, input->second.second.second, interval, solution))
-            {
-                // Solution found
-                LuckyInput = input->first; // (txid, nout)
+        // This thread takes part in the scan as well
+        size_t nChunks = (scan.vInputs.size() + STAKE_SCAN_CHUNK - 1) / STAKE_SCAN_CHUNK;
+        size_t nHelpers = std::min<size_t>(nThreads, nChunks) - 1;
 
-                return true;
-            }
+        boost::thread_group group;
+        for (size_t i = 0; i < nHelpers; i++)
+            group.create_thread(boost::bind(&ScanMapWorker, &scan));
+        ScanMapWorker(&scan);
+        group.join_all();
+
+        if (scan.nFound.load() < scan.vInputs.size())
+        {
+            // Solution found
+            LuckyInput = scan.vInputs[scan.nFound]->first; // (txid, nout)
+            solution = scan.solution;
+
+            return true;
         }
 
         // Inputs map iteration can be big enough to consume few seconds while scanning.
@@ -656,9 +879,16 @@ void ThreadStakeMiner(void* parg)
     RenameThread("novacoin-miner");
     CWallet* pwallet = (CWallet*)parg;
 
-    MidstateMap inputsMap;
-    if (!FillMap(pwallet, GetAdjustedTime(), inputsMap))
-        return;
+    // Stake inputs are kept up to date by wallet notifications
+    CStakeInputs stakeInputs(pwallet);
+    boost::signals2::scoped_connection notifyConnection(pwallet->NotifyTransactionChanged.connect(
+        boost::bind(&CStakeInputs::NotifyTransactionChanged, &stakeInputs, boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3)));
+    stakeInputs.Update();
+
+    // -stakerthreads=0 means one scanner thread per CPU core
+    unsigned int nThreads = std::max(GetArgInt("-stakerthreads", 0), 0);
+    if (nThreads == 0)
+        nThreads = std::max(boost::thread::hardware_concurrency(), 1u);
 
     bool fTrySync = true;
 
@@ -707,12 +937,13 @@ void ThreadStakeMiner(void* parg)
                 }
             }
 
-            if (ScanMap(inputsMap, nBits, LuckyInput, solution))
+            if (ScanMap(stakeInputs.Ready(), stakeInputs.nStakeLimit, nBits, nThreads, LuckyInput, solution))
             {
                 SetThreadPriority(THREAD_PRIORITY_NORMAL);
 
-                // Remove lucky input from the map
-                inputsMap.erase(inputsMap.find(LuckyInput));
+                // Don't scan the lucky input again, it stays a candidate in
+                //   case the block doesn't make it into the chain
+                stakeInputs.Postpone(LuckyInput);
 
                 CKey key;
                 CTransaction txCoinStake;
@@ -756,19 +987,11 @@ void ThreadStakeMiner(void* parg)
                 Sleep(500);
             }
 
-            if (pindexPrev != pindexBest)
+            // Apply wallet changes and the new best block to the inputs map
+            if (stakeInputs.Update())
             {
-                // The best block has been changed, we need to refill the map
-                if (FillMap(pwallet, GetAdjustedTime(), inputsMap))
-                {
-                    pindexPrev = pindexBest;
-                    nBits = GetNextTargetRequired(pindexPrev, true);
-                }
-                else
-                {
-                    // Clear existent data if FillMap failed
-                    inputsMap.clear();
-                }
+                pindexPrev = pindexBest;
+                nBits = GetNextTargetRequired(pindexPrev, true);
             }
 
             Sleep(500);
@@ -789,3 +1012,199 @@ void ThreadStakeMiner(void* parg)
     }
     printf("ThreadStakeMinter exiting, %d threads remaining\n", vnThreadsRunning[THREAD_MINTER]);
 }
+
+// Proof-of-work miner threads, started and stopped by GeneratePoWBlocks()
+static CCriticalSection cs_powMiner;
+static boost::thread_group *pPoWMinerThreads = NULL;
+static std::atomic<bool> fPoWMinerStop(false);
+static std::atomic<int> nPoWMinerThreads(0);
+
+// Hash meter, updated by the miner threads
+static CCriticalSection cs_hashMeter;
+static std::atomic<uint64_t> nPoWHashes(0);
+static uint64_t nHashMeterHashes = 0;
+static int64_t nHashMeterStart = 0;
+static double dPoWHashesPerSec = 0;
+
+// Headers hashed per call of scrypt_blockhash_batch(), a multiple of the
+//   lane counts of its variants
+static const unsigned int POW_BATCH_SIZE = 24;
+
+static void UpdateHashMeter(uint64_t nHashes)
+{
+    uint64_t nTotal = nPoWHashes.fetch_add(nHashes) + nHashes;
+    int64_t nNow = GetTimeMillis();
+
+    LOCK(cs_hashMeter);
+    if (nHashMeterStart == 0)
+    {
+        nHashMeterStart = nNow;
+        nHashMeterHashes = nTotal;
+    }
+    else if (nNow - nHashMeterStart > 4000)
+    {
+        dPoWHashesPerSec = 1000.0 * (nTotal - nHashMeterHashes) / (nNow - nHashMeterStart);
+        nHashMeterStart = nNow;
+        nHashMeterHashes = nTotal;
+
+        static int64_t nLogTime = 0;
+        if (GetTime() - nLogTime > 30 * 60)
+        {
+            nLogTime = GetTime();
+            printf("hashmeter %3d CPUs %6.0f hash/s\n", nPoWMinerThreads.load(), dPoWHashesPerSec);
+        }
+    }
+}
+
+// Proof-of-work miner thread, nonces of every block template are split
+//   between the threads so that they never hash the same header
+static void PoWMinerWorker(CWallet *pwallet, unsigned int nThread, unsigned int nThreads)
+{
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("novacoin-powminer");
+
+    CReserveKey reservekey(pwallet);
+    unsigned int nExtraNonce = 0;
+
+    const uint64_t nNonceRange = (UINT64_C(1) << 32) / nThreads;
+    const uint32_t nNonceBegin = nThread * nNonceRange;
+    const uint32_t nNonceEnd = (nThread + 1 == nThreads) ? std::numeric_limits<uint32_t>::max() : nNonceBegin + nNonceRange - 1;
+
+    std::vector<uint8_t> vHeaders(80 * POW_BATCH_SIZE);
+    std::vector<uint256> vHash(POW_BATCH_SIZE);
+
+    try
+    {
+        vnThreadsRunning[THREAD_MINER]++;
+
+        while (!fShutdown && !fPoWMinerStop)
+        {
+            // Test networks may be mined without peers
+            if ((!fTestNet && vNodes.empty()) || IsInitialBlockDownload())
+            {
+                Sleep(1000);
+                continue;
+            }
+
+            unsigned int nTransactionsUpdatedLast = nTransactionsUpdated;
+            CBlockIndex* pindexPrev = pindexBest;
+
+            std::shared_ptr<CBlock> pblock = CreateNewBlock(pwallet);
+            if (!pblock)
+            {
+                printf("PoWMinerWorker() : unable to create the new block\n");
+                break;
+            }
+            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+
+            uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+            int64_t nStart = GetTime();
+
+            for (uint32_t nNonce = nNonceBegin; ; )
+            {
+                unsigned int nCount = (unsigned int)std::min<uint64_t>(POW_BATCH_SIZE, (uint64_t)nNonceEnd - nNonce + 1);
+
+                const uint8_t *pHeader = (const uint8_t*)&pblock->nVersion;
+                for (unsigned int i = 0; i < nCount; i++)
+                {
+                    uint8_t *pchHeader = &vHeaders[80 * i];
+                    memcpy(pchHeader, pHeader, 76);
+                    uint32_t nHeaderNonce = nNonce + i;
+                    memcpy(pchHeader + 76, &nHeaderNonce, 4);
+                }
+                scrypt_blockhash_batch(vHeaders.data(), vHash.data(), nCount);
+                UpdateHashMeter(nCount);
+
+                bool fFound = false;
+                for (unsigned int i = 0; i < nCount && !fFound; i++)
+                {
+                    if (vHash[i] > hashTarget)
+                        continue;
+
+                    // Found a solution, the block hashes it again anyway
+                    fFound = true;
+                    pblock->nNonce = nNonce + i;
+                    if (pblock->GetHash() != vHash[i])
+                    {
+                        printf("PoWMinerWorker() : batch hash %s doesn't match block hash %s\n", vHash[i].ToString().c_str(), pblock->GetHash().ToString().c_str());
+                        continue;
+                    }
+
+                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                    CheckWork(pblock, *pwallet, reservekey);
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                }
+
+                if (fFound || fShutdown || fPoWMinerStop)
+                    break;
+                if (nNonceEnd - nNonce < nCount)
+                    break; // Nonces are exhausted, next extra nonce
+                // New transactions, also keep the time of the block close to the time of its coinbase
+                if ((nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60) || GetTime() - nStart > 10 * 60)
+                    break;
+                if (pindexPrev != pindexBest)
+                    break;
+
+                nNonce += nCount;
+
+                // Update nTime every few seconds
+                pblock->UpdateTime(pindexPrev);
+            }
+        }
+
+        vnThreadsRunning[THREAD_MINER]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[THREAD_MINER]--;
+        PrintException(&e, "PoWMinerWorker()");
+    } catch (...) {
+        vnThreadsRunning[THREAD_MINER]--;
+        PrintException(nullptr, "PoWMinerWorker()");
+    }
+}
+
+void GeneratePoWBlocks(bool fGenerate, int nThreads, CWallet* pwallet)
+{
+    LOCK(cs_powMiner);
+
+    if (pPoWMinerThreads != NULL)
+    {
+        fPoWMinerStop = true;
+        pPoWMinerThreads->join_all();
+        delete pPoWMinerThreads;
+        pPoWMinerThreads = NULL;
+        nPoWMinerThreads = 0;
+        fPoWMinerStop = false;
+        printf("Proof-of-work miner stopped\n");
+    }
+
+    {
+        LOCK(cs_hashMeter);
+        nHashMeterStart = 0;
+        dPoWHashesPerSec = 0;
+    }
+
+    if (!fGenerate || nThreads == 0)
+        return;
+
+    if (nThreads < 0)
+        nThreads = std::max(boost::thread::hardware_concurrency(), 1u);
+
+    pPoWMinerThreads = new boost::thread_group();
+    for (int i = 0; i < nThreads; i++)
+        pPoWMinerThreads->create_thread(boost::bind(&PoWMinerWorker, pwallet, i, nThreads));
+    nPoWMinerThreads = nThreads;
+
+    printf("Proof-of-work miner started with %d threads, scrypt implementation %s\n", nThreads, scrypt_batch_impl());
+}
+
+int GetPoWMinerThreads()
+{
+    return nPoWMinerThreads.load();
+}
+
+double GetPoWHashesPerSec()
+{
+    LOCK(cs_hashMeter);
+    return dPoWHashesPerSec;
+}
@@ -35,4 +35,13 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit);
 /** Stake miner thread */
 void ThreadStakeMiner(void* parg);
 
+/** Start proof-of-work miner threads or stop them, nThreads < 0 means one thread per CPU core */
+void GeneratePoWBlocks(bool fGenerate, int nThreads, CWallet* pwallet);
+
+/** Number of running proof-of-work miner threads */
+int GetPoWMinerThreads();
+
+/** Hash rate of the proof-of-work miner threads */
+double GetPoWHashesPerSec();
+
 #endif // NOVACOIN_MINER_H
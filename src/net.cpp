@@ -513,7 +513,15 @@ void CNode::Cleanup()
 {
 }
 
-void CNode::EndMessage()
+uint32_t GetMessageChecksum(const char* pbegin, const char* pend)
+{
+    uint256 hash = Hash(pbegin, pend);
+    uint32_t nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    return nChecksum;
+}
+
+void CNode::EndMessage(const uint32_t* pnChecksum)
 {
     if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
     {
@@ -532,9 +540,8 @@ void CNode::EndMessage()
     memcpy((char*)&vSend[nHeaderStart] + CMessageHeader::MESSAGE_SIZE_OFFSET, &nSize, sizeof(nSize));
 
     // Set the checksum
-    uint256 hash = Hash(vSend.begin() + nMessageStart, vSend.end());
-    uint32_t nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    const char* pchSend = &*vSend.begin();
+    uint32_t nChecksum = pnChecksum ? *pnChecksum : GetMessageChecksum(pchSend + nMessageStart, pchSend + vSend.size());
     assert(nMessageStart - nHeaderStart >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
     memcpy((char*)&vSend[nHeaderStart] + CMessageHeader::CHECKSUM_OFFSET, &nChecksum, sizeof(nChecksum));
 
@@ -547,6 +554,21 @@ void CNode::EndMessage()
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+void CNode::PushRawMessage(const char* pszCommand, const char* pbegin, const char* pend, const uint32_t* pnChecksum)
+{
+    try
+    {
+        BeginMessage(pszCommand);
+        vSend.write(pbegin, pend - pbegin);
+        EndMessage(pnChecksum);
+    }
+    catch (...)
+    {
+        AbortMessage();
+        throw;
+    }
+}
+
 void CNode::PushVersion()
 {
     int64_t nTime = GetAdjustedTime();
@@ -1865,6 +1887,7 @@ bool StopNode()
     if (vnThreadsRunning[THREAD_ADDEDCONNECTIONS] > 0) printf("ThreadOpenAddedConnections still running\n");
     if (vnThreadsRunning[THREAD_DUMPADDRESS] > 0) printf("ThreadDumpAddresses still running\n");
     if (vnThreadsRunning[THREAD_MINTER] > 0) printf("ThreadStakeMinter still running\n");
+    if (vnThreadsRunning[THREAD_MINER] > 0) printf("PoWMinerWorker still running\n");
     if (vnThreadsRunning[THREAD_SCRIPTCHECK] > 0) printf("ThreadScriptCheck still running\n");
     while (vnThreadsRunning[THREAD_MESSAGEHANDLER] > 0 || vnThreadsRunning[THREAD_RPCHANDLER] > 0 || vnThreadsRunning[THREAD_SCRIPTCHECK] > 0)
         Sleep(20);
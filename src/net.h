@@ -91,6 +91,7 @@ enum threadId
     THREAD_DUMPADDRESS,
     THREAD_RPCHANDLER,
     THREAD_MINTER,
+    THREAD_MINER,
     THREAD_SCRIPTCHECK,
     THREAD_NTP,
     THREAD_IPCOLLECTOR,
@@ -368,7 +369,7 @@ public:
             printf("(aborted)\n");
     }
 
-    void EndMessage();
+    void EndMessage(const uint32_t* pnChecksum=NULL);
 
     void EndMessageAbortIfEmpty()
     {
@@ -400,6 +401,9 @@ public:
         }
     }
 
+    // Send an already serialized payload, with its checksum if it's known
+    void PushRawMessage(const char* pszCommand, const char* pbegin, const char* pend, const uint32_t* pnChecksum=NULL);
+
     void PushGetBlocks(CBlockIndex* pindexBegin, uint256 hashEnd);
     bool IsSubscribed(unsigned int nChannel);
     void Subscribe(unsigned int nChannel, unsigned int nHops=0);
@@ -439,6 +443,9 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash);
 void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss);
 
 
+/** Checksum of a message payload as put into its header */
+uint32_t GetMessageChecksum(const char* pbegin, const char* pend);
+
 /** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
 int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 
@@ -426,7 +426,7 @@ void CoinControlDialog::updateLabels(WalletModel *model, QWidget* dialog)
     qint64 nPayAmount = 0;
     bool fLowOutput = false;
     bool fDust = false;
-    CTransaction txDummy;
+    CMutableTransaction txDummy;
     foreach(const qint64 &amount, CoinControlDialog::payAmounts)
     {
         nPayAmount += amount;
@@ -502,7 +502,7 @@ void CoinControlDialog::updateLabels(WalletModel *model, QWidget* dialog)
         // Fee
         int64_t nFee = nTransactionFee * (1 + (int64_t)nBytes / 1000);
         // Min Fee
-        int64_t nMinFee = txDummy.GetMinFee(1, fAllowFree, GMF_SEND, nBytes);
+        int64_t nMinFee = CTransaction(txDummy).GetMinFee(1, fAllowFree, GMF_SEND, nBytes);
 
         nPayFee = max(nFee, nMinFee);
 
@@ -20,6 +20,8 @@
 #include <QTimer>
 #include <QIcon>
 #include <QDateTime>
+#include <QMutex>
+#include <QThread>
 #include <QtAlgorithms>
 
 extern double GetDifficulty(const CBlockIndex* blockindex);
@@ -55,7 +57,10 @@ class MintingTablePriv
 public:
     MintingTablePriv(CWallet *wallet, MintingTableModel *parent):
         wallet(wallet),
-        parent(parent)
+        parent(parent),
+        nGeneration(0),
+        fEstimateRequested(false),
+        nEstimatedHeight(-1)
     {
     }
     CWallet *wallet;
@@ -63,6 +68,22 @@ public:
 
     QList<KernelRecord> cachedWallet;
 
+    // Estimator for the current difficulty and minting interval, rows
+    //   estimated with another one are recomputed when displayed
+    MintingEstimator estimator;
+
+    // Background estimation, guarded by csEstimates. Generation changes
+    //   together with the rows of cachedWallet or the estimator, results
+    //   of any older generation are dropped.
+    QMutex csEstimates;
+    int nGeneration;
+    bool fEstimateRequested;
+    std::vector<KernelRecord> vPending;
+    std::vector<MintingEstimate> vEstimates;
+
+    // Best height when the estimator was made
+    int nEstimatedHeight;
+
     void refreshWallet()
     {
 #ifdef WALLET_UPDATE_DEBUG
@@ -217,6 +238,62 @@ public:
 
 };
 
+/** Computes minting estimates for the rows of the table in a separate thread.
+
+   Rows are estimated in chunks, every chunk is announced with a signal so that
+   the view is refreshed incrementally. A newer generation of rows makes the
+   worker stop, the pending request is then picked up by the next call.
+*/
+class MintingEstimatorWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    MintingEstimatorWorker(MintingTablePriv *priv) : priv(priv) { }
+
+    static const int ESTIMATE_CHUNK = 256;
+
+public slots:
+    void estimate();
+
+signals:
+    void estimated(int generation, int begin, int end);
+
+private:
+    MintingTablePriv *priv;
+};
+
+#include "mintingtablemodel.moc"
+
+void MintingEstimatorWorker::estimate()
+{
+    std::vector<KernelRecord> records;
+    MintingEstimator estimator;
+    int generation;
+    {
+        QMutexLocker lock(&priv->csEstimates);
+        records.swap(priv->vPending);
+        estimator = priv->estimator;
+        generation = priv->nGeneration;
+        priv->fEstimateRequested = false;
+    }
+
+    std::vector<MintingEstimate> chunk;
+    for (int begin = 0; begin < (int)records.size(); begin += ESTIMATE_CHUNK)
+    {
+        int end = std::min(begin + ESTIMATE_CHUNK, (int)records.size());
+        std::vector<KernelRecord> slice(records.begin() + begin, records.begin() + end);
+        estimator.estimate(slice, chunk);
+        {
+            QMutexLocker lock(&priv->csEstimates);
+            if (generation != priv->nGeneration)
+                return;
+            std::copy(chunk.begin(), chunk.end(), priv->vEstimates.begin() + begin);
+        }
+        emit estimated(generation, begin, end);
+    }
+}
+
 
 MintingTableModel::MintingTableModel(CWallet *wallet, WalletModel *parent):
         QAbstractTableModel(parent),
@@ -228,6 +305,9 @@ MintingTableModel::MintingTableModel(CWallet *wallet, WalletModel *parent):
     columns << tr("Transaction") <<  tr("Address") << tr("Balance") << tr("Age") << tr("CoinDay") << tr("MintProbability") << tr("MintReward");
     priv->refreshWallet();
 
+    startEstimator();
+    estimateAll();
+
     QTimer *timer = new QTimer(this);
     connect(timer, SIGNAL(timeout()), this, SLOT(update()));
     timer->start(MODEL_UPDATE_DELAY);
@@ -235,9 +315,87 @@ MintingTableModel::MintingTableModel(CWallet *wallet, WalletModel *parent):
 
 MintingTableModel::~MintingTableModel()
 {
+    {
+        // Make the worker drop the chunk it is computing
+        QMutexLocker lock(&priv->csEstimates);
+        priv->nGeneration++;
+    }
+    emit stopEstimator();
+    estimatorThread->wait();
     delete priv;
 }
 
+void MintingTableModel::startEstimator()
+{
+    estimatorThread = new QThread(this);
+    MintingEstimatorWorker *worker = new MintingEstimatorWorker(priv);
+    worker->moveToThread(estimatorThread);
+
+    connect(worker, SIGNAL(estimated(int,int,int)), this, SLOT(applyEstimates(int,int,int)));
+    connect(this, SIGNAL(estimateRequested()), worker, SLOT(estimate()));
+    /*  make sure worker object is deleted in its own thread */
+    connect(this, SIGNAL(stopEstimator()), worker, SLOT(deleteLater()));
+    connect(this, SIGNAL(stopEstimator()), estimatorThread, SLOT(quit()));
+
+    estimatorThread->start(QThread::LowPriority);
+}
+
+/* Estimate all rows in the background with the current difficulty and
+   minting interval. Must be called whenever rows are added or removed.
+ */
+void MintingTableModel::estimateAll()
+{
+    const CBlockIndex *p = GetLastBlockIndex(pindexBest, true);
+    if (!p)
+        return;
+    MintingEstimator estimator(GetDifficulty(p), p->nBits, mintingInterval, GetAdjustedTime());
+
+    QMutexLocker lock(&priv->csEstimates);
+    priv->estimator = estimator;
+    priv->nEstimatedHeight = nBestHeight;
+    priv->nGeneration++;
+    priv->vPending.assign(priv->cachedWallet.begin(), priv->cachedWallet.end());
+    priv->vEstimates.assign(priv->vPending.size(), MintingEstimate());
+    if (!priv->fEstimateRequested)
+    {
+        priv->fEstimateRequested = true;
+        emit estimateRequested();
+    }
+}
+
+void MintingTableModel::applyEstimates(int generation, int begin, int end)
+{
+    {
+        QMutexLocker lock(&priv->csEstimates);
+        if (generation != priv->nGeneration)
+            return;
+        const MintingEstimator &estimator = priv->estimator;
+        for (int i = begin; i < end; i++)
+        {
+            KernelRecord &rec = priv->cachedWallet[i];
+            rec.estimate = priv->vEstimates[i];
+            rec.nEstimateBits = estimator.nBits;
+            rec.nEstimateMinutes = estimator.minutes;
+            rec.nEstimateTime = estimator.nTime;
+        }
+    }
+    emit dataChanged(index(begin, MintProbability), index(end - 1, MintReward));
+}
+
+const MintingEstimate &MintingTableModel::getEstimate(KernelRecord *wtx) const
+{
+    // Not estimated in the background yet
+    const MintingEstimator &estimator = priv->estimator;
+    if (wtx->nEstimateBits != estimator.nBits || wtx->nEstimateMinutes != estimator.minutes || wtx->nEstimateTime != estimator.nTime)
+    {
+        wtx->estimate = estimator.estimate(wtx->nValue, wtx->nTime);
+        wtx->nEstimateBits = estimator.nBits;
+        wtx->nEstimateMinutes = estimator.minutes;
+        wtx->nEstimateTime = estimator.nTime;
+    }
+    return wtx->estimate;
+}
+
 void MintingTableModel::update()
 {
     QList<uint256> updated;
@@ -268,8 +426,14 @@ void MintingTableModel::update()
     if(!updated.empty())
     {
         priv->updateWallet(updated);
+        estimateAll();
         mintingProxyModel->invalidate(); // Force deletion of empty rows
     }
+    else if(nBestHeight != priv->nEstimatedHeight)
+    {
+        // New block, difficulty and coin ages have changed
+        estimateAll();
+    }
 }
 
 void MintingTableModel::setMintingProxyModel(MintingFilterProxy *mintingProxy)
@@ -385,6 +549,7 @@ QVariant MintingTableModel::data(const QModelIndex &index, int role) const
 void MintingTableModel::setMintingInterval(int interval)
 {
     mintingInterval = interval;
+    estimateAll();
 }
 
 QString MintingTableModel::lookupAddress(const std::string &address, bool tooltip) const
@@ -405,18 +570,15 @@ QString MintingTableModel::lookupAddress(const std::string &address, bool toolti
 QString MintingTableModel::formatTxPoSReward(KernelRecord *wtx) const
 {
     QString posReward;
-    int nBits = GetLastBlockIndex(pindexBest, true)->nBits;
-    posReward += QString(QObject::tr("from  %1 to %2")).arg(BitcoinUnits::formatWithUnit(walletModel->getOptionsModel()->getDisplayUnit(), wtx->getPoSReward(nBits, 0)), 
-        BitcoinUnits::formatWithUnit(walletModel->getOptionsModel()->getDisplayUnit(), wtx->getPoSReward(nBits, mintingInterval))); 
+    const MintingEstimate &estimate = getEstimate(wtx);
+    posReward += QString(QObject::tr("from  %1 to %2")).arg(BitcoinUnits::formatWithUnit(walletModel->getOptionsModel()->getDisplayUnit(), estimate.nRewardBegin), 
+        BitcoinUnits::formatWithUnit(walletModel->getOptionsModel()->getDisplayUnit(), estimate.nRewardEnd)); 
     return posReward;
 }
 
 double MintingTableModel::getDayToMint(KernelRecord *wtx) const
 {
-    const CBlockIndex *p = GetLastBlockIndex(pindexBest, true);
-    double difficulty = GetDifficulty(p);
-
-    double prob = wtx->getProbToMintWithinNMinutes(difficulty, mintingInterval);
+    double prob = getEstimate(wtx).probability;
     prob = prob * 100;
     return prob;
 }
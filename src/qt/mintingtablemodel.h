@@ -6,9 +6,11 @@
 #include <QStringList>
 
 class CWallet;
+class QThread;
 class MintingTablePriv;
 class MintingFilterProxy;
 class KernelRecord;
+struct MintingEstimate;
 class WalletModel;
 
 class MintingTableModel : public QAbstractTableModel
@@ -37,6 +39,10 @@ public:
 
     void setMintingInterval(int interval);
 
+signals:
+    void estimateRequested();
+    void stopEstimator();
+
 private:
     CWallet* wallet;
     WalletModel *walletModel;
@@ -44,6 +50,11 @@ private:
     int mintingInterval;
     MintingTablePriv *priv;
     MintingFilterProxy *mintingProxyModel;
+    QThread *estimatorThread;
+
+    void startEstimator();
+    void estimateAll();
+    const MintingEstimate &getEstimate(KernelRecord *wtx) const;
 
     QString lookupAddress(const std::string &address, bool tooltip) const;
 
@@ -57,6 +68,7 @@ private:
     QString formatTxPoSReward(KernelRecord *wtx) const;
 private slots:
     void update();
+    void applyEstimates(int generation, int begin, int end);
 
     friend class MintingTablePriv;
 };
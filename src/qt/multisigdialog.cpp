@@ -277,7 +277,7 @@ void MultisigDialog::removeEntry(MultisigAddressEntry *entry)
 
 void MultisigDialog::on_createTransactionButton_clicked()
 {
-    CTransaction transaction;
+    CMutableTransaction transaction;
 
     // Get inputs
     for(int i = 0; i < ui->inputs->count(); i++)
@@ -416,20 +416,20 @@ void MultisigDialog::on_signTransactionButton_clicked()
     {
         return;
     }
-    CTransaction mergedTx(tx);
+    CMutableTransaction mergedTx(tx);
 
     // Fetch previous transactions (inputs)
     std::map<COutPoint, CScript> mapPrevOut;
     for(unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
-        CTransaction tempTx;
+        CMutableTransaction tempTx;
         MapPrevTx mapPrevTx;
         CTxDB txdb("r");
         std::map<uint256, CTxIndex> unused;
         bool fInvalid;
 
         tempTx.vin.push_back(mergedTx.vin[i]);
-        tempTx.FetchInputs(txdb, unused, false, false, mapPrevTx, fInvalid);
+        CTransaction(tempTx).FetchInputs(txdb, unused, false, false, mapPrevTx, fInvalid);
 
         for (const CTxIn& txin : tempTx.vin)
         {
@@ -459,6 +459,10 @@ void MultisigDialog::on_signTransactionButton_clicked()
     if(!ctx.isValid())
         return;
 
+    // Signature hashes leave out all signatures, so the signatures being
+    // merged are checked against one copy of the transaction
+    const CTransaction txConst(mergedTx);
+
     // Sign what we can
     bool fComplete = true;
     for(unsigned int i = 0; i < mergedTx.vin.size(); i++)
@@ -473,8 +477,8 @@ void MultisigDialog::on_signTransactionButton_clicked()
 
         txin.scriptSig.clear();
         SignSignature(*wallet, prevPubKey, mergedTx, i, SIGHASH_ALL);
-        txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, tx.vin[i].scriptSig);
-        if(!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, 0))
+        txin.scriptSig = CombineSignatures(prevPubKey, txConst, i, txin.scriptSig, tx.vin[i].scriptSig);
+        if(!VerifyScript(txin.scriptSig, prevPubKey, txConst, i, true, 0))
         {
             fComplete = false;
         }
@@ -5,6 +5,7 @@
 
 #include "main.h"
 #include "bitcoinrpc.h"
+#include "digestcache.h"
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/stream.hpp>
@@ -185,6 +186,32 @@ Value getdifficulty(const Array& params, bool fHelp)
 }
 
 
+static Object CacheToJSON(const CDigestCache& cache)
+{
+    Object obj;
+    obj.push_back(Pair("bytes",     (uint64_t)cache.MemoryUsage()));
+    obj.push_back(Pair("capacity",  (uint64_t)cache.Capacity()));
+    obj.push_back(Pair("hits",      cache.Hits()));
+    obj.push_back(Pair("misses",    cache.Misses()));
+    obj.push_back(Pair("inserts",   cache.Inserts()));
+    obj.push_back(Pair("evictions", cache.Evictions()));
+    return obj;
+}
+
+Value getcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcacheinfo\n"
+            "Returns an object containing validation cache statistics.");
+
+    Object obj;
+    obj.push_back(Pair("signatures", CacheToJSON(GetSignatureCache())));
+    obj.push_back(Pair("scripts",    CacheToJSON(GetScriptExecutionCache())));
+    return obj;
+}
+
+
 Value settxfee(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 1 || AmountFromValue(params[0]) < MIN_TX_FEE)
@@ -274,7 +301,7 @@ Value getblockbynumber(const Array& params, bool fHelp)
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 }
 
-bool ExportBlock(const string& strBlockHash, const CDataStream& ssBlock)
+bool ExportBlock(const string& strBlockHash, const CBlockFileBytes& blockBytes)
 {
     boost::filesystem::path pathDest = GetDataDir() / strBlockHash;
     if (boost::filesystem::is_directory(pathDest))
@@ -283,7 +310,7 @@ bool ExportBlock(const string& strBlockHash, const CDataStream& ssBlock)
     try {
         boost::iostreams::stream_buffer<boost::iostreams::file_sink> buf(pathDest.string());
         ostream                     exportStream(&buf);
-        exportStream << HexStr(ssBlock.begin(), ssBlock.end());
+        exportStream << HexStr(blockBytes.begin(), blockBytes.end());
         exportStream.flush();
 
         printf("Successfully exported block to %s\n", pathDest.string().c_str());
@@ -308,19 +335,18 @@ Value dumpblock(const Array& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
+    // Stored bytes are the serialized block already
+    CBlockFileBytes blockBytes;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
-
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
+    if (!ReadBlockBytesFromDisk(pblockindex, blockBytes))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block from disk");
 
     if (params.size() > 1)
     {
-        return ExportBlock(params[1].get_str(), ssBlock);
+        return ExportBlock(params[1].get_str(), blockBytes);
     }
 
-    return HexStr(ssBlock.begin(), ssBlock.end());
+    return HexStr(blockBytes.begin(), blockBytes.end());
 }
 
 
@@ -335,23 +361,20 @@ Value dumpblockbynumber(const Array& params, bool fHelp)
     if (nHeight < 0 || nHeight > nBestHeight)
         throw runtime_error("Block number out of range.");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
     while (pblockindex->nHeight > nHeight)
         pblockindex = pblockindex->pprev;
 
-    pblockindex = mapBlockIndex[*pblockindex->phashBlock];
-    block.ReadFromDisk(pblockindex, true);
-
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
+    CBlockFileBytes blockBytes;
+    if (!ReadBlockBytesFromDisk(pblockindex, blockBytes))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block from disk");
 
     if (params.size() > 1)
     {
-        return ExportBlock(params[1].get_str(), ssBlock);
+        return ExportBlock(params[1].get_str(), blockBytes);
     }
 
-    return HexStr(ssBlock.begin(), ssBlock.end());
+    return HexStr(blockBytes.begin(), blockBytes.end());
 }
 
 
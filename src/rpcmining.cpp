@@ -8,6 +8,8 @@
 #include "init.h"
 #include "miner.h"
 #include "kernel.h"
+#include "kernel_worker.h"
+#include "kernelrecord.h"
 #include "bitcoinrpc.h"
 #include "wallet.h"
 
@@ -39,6 +41,26 @@ Value getsubsidy(const Array& params, bool fHelp)
     return (uint64_t)GetProofOfWorkReward(nBits);
 }
 
+Value setgenerate(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "setgenerate <generate> [genproclimit]\n"
+            "<generate> is true or false to turn proof-of-work generation on or off.\n"
+            "Generation is limited to [genproclimit] threads, -1 is one thread per CPU core.");
+
+    bool fGenerate = params[0].get_bool();
+    int nThreads = -1;
+    if (params.size() > 1)
+        nThreads = params[1].get_int();
+
+    mapArgs["-gen"] = (fGenerate ? "1" : "0");
+    mapArgs["-genproclimit"] = itostr(nThreads);
+    GeneratePoWBlocks(fGenerate, nThreads, pwalletMain);
+
+    return Value::null;
+}
+
 Value getmininginfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -46,6 +68,9 @@ Value getmininginfo(const Array& params, bool fHelp)
             "getmininginfo\n"
             "Returns an object containing mining-related information.");
 
+    // Wallet figures come from its coin-age cache and don't need cs_wallet
+    LOCK(cs_main);
+
     Object obj, diff;
     obj.push_back(Pair("blocks",        (int)nBestHeight));
     obj.push_back(Pair("currentblocksize",(uint64_t)nLastBlockSize));
@@ -57,27 +82,196 @@ Value getmininginfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",    diff));
 
     obj.push_back(Pair("blockvalue",    (uint64_t)GetProofOfWorkReward(GetLastBlockIndex(pindexBest, false)->nBits)));
+    obj.push_back(Pair("generate",      GetPoWMinerThreads() > 0));
+    obj.push_back(Pair("genproclimit",  GetPoWMinerThreads()));
+    obj.push_back(Pair("hashespersec",  GetPoWHashesPerSec()));
     obj.push_back(Pair("netmhashps",    GetPoWMHashPS()));
     obj.push_back(Pair("netstakeweight",GetPoSKernelPS()));
     obj.push_back(Pair("errors",        GetWarnings("statusbar")));
     obj.push_back(Pair("pooledtx",      (uint64_t)mempool.size()));
 
     obj.push_back(Pair("stakeinputs",   (uint64_t)nStakeInputsMapSize));
+    obj.push_back(Pair("stakeweight",   (uint64_t)pwalletMain->GetStakeWeight()));
     obj.push_back(Pair("stakeinterest", GetProofOfStakeReward(0, GetLastBlockIndex(pindexBest, true)->nBits, GetLastBlockIndex(pindexBest, true)->nTime, true)));
 
     obj.push_back(Pair("testnet",       fTestNet));
     return obj;
 }
 
+Value getmintingforecast(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmintingforecast [minutes=10]\n"
+            "Returns chances to mint a proof-of-stake block within given number of minutes\n"
+            "at current difficulty, for the whole wallet and for each of its unspent outputs,\n"
+            "along with the rewards if minted at the beginning or at the end of this time.");
+
+    int nMinutes = 10;
+    if (params.size() > 0)
+        nMinutes = params[0].get_int();
+    if (nMinutes <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of minutes");
+
+    const CBlockIndex *pindexPoS = GetLastBlockIndex(pindexBest, true);
+    double dDifficulty = GetDifficulty(pindexPoS);
+    MintingEstimator estimator(dDifficulty, pindexPoS->nBits, nMinutes, GetAdjustedTime());
+
+    vector<KernelRecord> vRecords;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        {
+            for (const KernelRecord& rec : KernelRecord::decomposeOutput(pwalletMain, it->second))
+                if (!rec.spent)
+                    vRecords.push_back(rec);
+        }
+    }
+
+    vector<MintingEstimate> vEstimates;
+    estimator.estimate(vRecords, vEstimates);
+
+    Array inputs;
+    for (unsigned int i = 0; i < vRecords.size(); i++)
+    {
+        const KernelRecord& rec = vRecords[i];
+        Object item;
+        item.push_back(Pair("txid", rec.hash.GetHex()));
+        item.push_back(Pair("vout", rec.idx));
+        item.push_back(Pair("address", rec.address));
+        item.push_back(Pair("amount", ValueFromAmount(rec.nValue)));
+        item.push_back(Pair("age", (int64_t)rec.getAge()));
+        item.push_back(Pair("probability", vEstimates[i].probability));
+        item.push_back(Pair("rewardfrom", ValueFromAmount(vEstimates[i].nRewardBegin)));
+        item.push_back(Pair("rewardto", ValueFromAmount(vEstimates[i].nRewardEnd)));
+        inputs.push_back(item);
+    }
+
+    Object result;
+    result.push_back(Pair("difficulty", dDifficulty));
+    result.push_back(Pair("minutes", nMinutes));
+    result.push_back(Pair("probability", MintingEstimator::getCombinedProbability(vEstimates)));
+    result.push_back(Pair("inputs", inputs));
+    return result;
+}
+
+// Background scans started by scaninput with async flag
+struct CScanInputJob
+{
+    std::shared_ptr<KernelScan> scan;
+    vector<int> vOuts; // Output numbers of scanned inputs
+};
+
+static const unsigned int MAX_SCAN_JOBS = 16;
+
+static CCriticalSection cs_mapScanJobs;
+static map<int64_t, CScanInputJob> mapScanJobs;
+static int64_t nLastScanId = 0;
+
+// Returns id of the started scan, or -1 if there are too many of them
+static int64_t StartScanInputJob(const std::shared_ptr<KernelScan>& scan, const vector<int>& vOuts, int nThreads)
+{
+    LOCK(cs_mapScanJobs);
+    if (mapScanJobs.size() >= MAX_SCAN_JOBS)
+        return -1;
+
+    scan->Start(nThreads);
+    CScanInputJob& job = mapScanJobs[++nLastScanId];
+    job.scan = scan;
+    job.vOuts = vOuts;
+
+    return nLastScanId;
+}
+
+static Array ScanSolutionsToJSON(const KernelScan& scan, const vector<int>& vOuts)
+{
+    Array results;
+    for (const auto &solution : scan.GetSolutions())
+    {
+        Object item;
+        item.push_back(Pair("nout", vOuts[solution.nInput]));
+        item.push_back(Pair("hash", solution.hashProofOfStake.GetHex()));
+        item.push_back(Pair("time", DateTimeStrFormat(solution.nTime)));
+
+        results.push_back(item);
+    }
+    return results;
+}
+
+static Object ScanJobToJSON(int64_t nScanId, const CScanInputJob& job)
+{
+    const KernelScan& scan = *job.scan;
+    bool fRunning = scan.IsRunning();
+
+    Object result;
+    result.push_back(Pair("scanid", nScanId));
+    result.push_back(Pair("status", fRunning ? "running" : (scan.IsCancelled() ? "cancelled" : "done")));
+    result.push_back(Pair("progress", scan.GetProgress()));
+    result.push_back(Pair("solutions", ScanSolutionsToJSON(scan, job.vOuts)));
+    return result;
+}
+
+Value getscanresult(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getscanresult <scanid>\n"
+            "Returns progress and solutions found so far by the background scaninput call.\n"
+            "Finished scans are forgotten once their results are returned.");
+
+    int64_t nScanId = params[0].get_int64();
+
+    LOCK(cs_mapScanJobs);
+    map<int64_t, CScanInputJob>::iterator it = mapScanJobs.find(nScanId);
+    if (it == mapScanJobs.end())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown scan id");
+
+    bool fFinished = !it->second.scan->IsRunning();
+    Object result = ScanJobToJSON(nScanId, it->second);
+    if (fFinished)
+        mapScanJobs.erase(it);
+
+    return result;
+}
+
+Value cancelscan(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "cancelscan <scanid>\n"
+            "Stops the background scaninput call and returns solutions it has found.");
+
+    int64_t nScanId = params[0].get_int64();
+
+    CScanInputJob job;
+    {
+        LOCK(cs_mapScanJobs);
+        map<int64_t, CScanInputJob>::iterator it = mapScanJobs.find(nScanId);
+        if (it == mapScanJobs.end())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown scan id");
+        job = it->second;
+        mapScanJobs.erase(it);
+    }
+
+    // Workers check the flag every few hashes, so waiting doesn't take long
+    job.scan->Cancel();
+    job.scan->Wait();
+
+    return ScanJobToJSON(nScanId, job);
+}
+
 // scaninput '{"txid":"95d640426fe66de866a8cf2d0601d2c8cf3ec598109b4d4ffa7fd03dad6d35ce","difficulty":0.01, "days":10}'
 Value scaninput(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
-            "scaninput '{\"txid\":\"txid\", \"vout\":[vout1, vout2, ..., voutN], \"difficulty\":difficulty, \"days\":days}'\n"
+            "scaninput '{\"txid\":\"txid\", \"vout\":[vout1, vout2, ..., voutN], \"difficulty\":difficulty, \"days\":days, \"threads\":threads, \"async\":async}'\n"
             "Scan specified transaction or input for suitable kernel solutions.\n"
             "    difficulty - upper limit for difficulty, current difficulty by default;\n"
-            "    days - time window, 90 days by default.\n"
+            "    days - time window, 90 days by default;\n"
+            "    threads - number of scanning threads, one per core by default and at most;\n"
+            "    async - return scan id at once instead of waiting for the results,\n"
+            "            see getscanresult and cancelscan.\n"
         );
 
     RPCTypeCheck(params, { obj_type });
@@ -117,6 +311,20 @@ Value scaninput(const Array& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, interval length must be greater than zero");
     }
 
+    int nThreads = 0;
+    const Value& threads_v = find_value(scanParams, "threads");
+    if (threads_v.type() == int_type)
+    {
+        nThreads = threads_v.get_int();
+        if (nThreads <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, threads must be greater than zero");
+    }
+
+    bool fAsync = false;
+    const Value& async_v = find_value(scanParams, "async");
+    if (async_v.type() == bool_type)
+        fAsync = async_v.get_bool();
+
 
     CTransaction tx;
     uint256 hashBlock = 0;
@@ -184,7 +392,8 @@ Value scaninput(const Array& params, bool fHelp)
             interval.first += (nStakeMinAge + block.nTime - interval.first);
         interval.second = interval.first + nDays * nOneDay;
 
-        Array results;
+        std::shared_ptr<KernelScan> scan = std::make_shared<KernelScan>(nBits, interval.first, interval.second);
+        vector<int> vScanOuts;
         for (const int &nOut : vInputs)
         {
             // Check for spent flag
@@ -202,21 +411,26 @@ Value scaninput(const Array& params, bool fHelp)
             ssKernel << block.nTime << (txindex.pos.nTxPos - txindex.pos.nBlockPos) << tx.nTime << nOut;
             CDataStream::const_iterator itK = ssKernel.begin();
 
-            std::vector<std::pair<uint256, uint32_t> > result;
-            if (ScanKernelForward((unsigned char *)&itK[0], nBits, tx.nTime, tx.vout[nOut].nValue, interval, result))
-            {
-                for (const auto &solution : result)
-                {
-                    Object item;
-                    item.push_back(Pair("nout", nOut));
-                    item.push_back(Pair("hash", solution.first.GetHex()));
-                    item.push_back(Pair("time", DateTimeStrFormat(solution.second)));
+            scan->AddInput((unsigned char *)&itK[0], tx.nTime, tx.vout[nOut].nValue);
+            vScanOuts.push_back(nOut);
+        }
 
-                    results.push_back(item);
-                }
-            }
+        if (fAsync)
+        {
+            int64_t nScanId = StartScanInputJob(scan, vScanOuts, nThreads);
+            if (nScanId < 0)
+                throw JSONRPCError(RPC_MISC_ERROR, "Too many scans in progress, fetch or cancel some of them first");
+
+            Object result;
+            result.push_back(Pair("scanid", nScanId));
+            result.push_back(Pair("inputs", (int)vScanOuts.size()));
+            return result;
         }
 
+        scan->Start(nThreads);
+        scan->Wait();
+
+        Array results = ScanSolutionsToJSON(*scan, vScanOuts);
         if (results.size() == 0)
             return false;
 
@@ -340,11 +554,16 @@ Value getworkex(const Array& params, bool fHelp)
         pblock->nNonce = pdata->nNonce;
 
         if(coinbase.size() == 0)
-            pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+        {
+            CMutableTransaction txCoinBase(pblock->vtx[0]);
+            txCoinBase.vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+            pblock->vtx[0] = txCoinBase;
+        }
         else
             CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0]; // FIXME - HACK!
 
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->InvalidateHash();
 
         return CheckWork(pblock, *pwalletMain, reservekey);
     }
@@ -454,8 +673,12 @@ Value getwork(const Array& params, bool fHelp)
 
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
-        pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+
+        CMutableTransaction txCoinBase(pblock->vtx[0]);
+        txCoinBase.vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+        pblock->vtx[0] = txCoinBase;
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->InvalidateHash();
 
         return CheckWork(pblock, *pwalletMain, reservekey);
     }
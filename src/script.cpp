@@ -10,10 +10,10 @@
 #include "random.h"
 #include "util.h"
 #include "base58.h"
+#include "digestcache.h"
+#include "sha256.h"
 
-#include <shared_mutex>
-
-bool CheckSig(std::vector<unsigned char> vchSig, const std::vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(std::vector<unsigned char> vchSig, const std::vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHashCache* pcache = NULL);
 
 static const valtype vchFalse(0);
 static const valtype vchZero(0);
@@ -412,7 +412,7 @@ bool CheckSequence(const int64_t& nSequence, const CTransaction &txTo, unsigned
     return true;
 }
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHashCache* pcache)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -1025,7 +1025,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     scriptCode.FindAndDelete(CScript(vchSig));
 
                     bool fSuccess = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
-                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcache);
 
                     popstack(stack);
                     popstack(stack);
@@ -1086,7 +1086,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
 
                         // Check signature
                         bool fOk = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
-                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcache);
 
                         if (fOk) {
                             isig++;
@@ -1157,66 +1157,141 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+namespace {
+
+// Serialize scriptCode with all OP_CODESEPARATORs removed, the same way
+//   as CScript::FindAndDelete(CScript(OP_CODESEPARATOR)) does.
+template<typename Stream>
+void SerializeScriptCode(Stream& s, const CScript& scriptCode)
+{
+    CScript::const_iterator pc = scriptCode.begin(), pbegin = pc;
+    opcodetype opcode;
+    unsigned int nCodeSeparators = 0;
+    while (scriptCode.GetOp(pc, opcode))
+        if (opcode == OP_CODESEPARATOR)
+            nCodeSeparators++;
+
+    WriteCompactSize(s, scriptCode.size() - nCodeSeparators);
+    pc = scriptCode.begin();
+    while (scriptCode.GetOp(pc, opcode))
+    {
+        if (opcode == OP_CODESEPARATOR)
+        {
+            if (pc - 1 > pbegin)
+                s.write((const char*)&pbegin[0], pc - 1 - pbegin);
+            pbegin = pc;
+        }
+    }
+    if (scriptCode.end() > pbegin)
+        s.write((const char*)&pbegin[0], scriptCode.end() - pbegin);
+}
+
+// Input with the scriptSig blanked out or replaced by scriptCode for nIn
+template<typename Stream>
+void SerializeInput(Stream& s, const CTransaction& txTo, unsigned int nInput, const CScript& scriptCode, unsigned int nIn, bool fBlankSequence)
+{
+    const CTxIn& txin = txTo.vin[nInput];
+    ::Serialize(s, txin.prevout, SER_GETHASH, 0);
+    if (nInput == nIn)
+        SerializeScriptCode(s, scriptCode);
+    else
+        WriteCompactSize(s, 0);
+    ::Serialize(s, (nInput != nIn && fBlankSequence) ? (uint32_t)0 : txin.nSequence, SER_GETHASH, 0);
+}
+
+}
+
+CSignatureHashCache::CSignatureHashCache(const CTransaction& txTo)
+{
+    CDataStream ssInputs(SER_GETHASH, 0);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        SerializeInput(ssInputs, txTo, i, CScript(), txTo.vin.size(), false);
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+
+    CDataStream ssTail(SER_GETHASH, 0);
+    ssTail << txTo.vout << txTo.nLockTime;
+    vchTail.assign(ssTail.begin(), ssTail.end());
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(ss, txTo.vin.size());
+    vMidstate.reserve(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        vMidstate.push_back(ss.GetState());
+        ss.write((const char*)&vchInputs[i * INPUT_SIZE], INPUT_SIZE);
+    }
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashCache* pcache)
 {
     if (nIn >= txTo.vin.size())
     {
         printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
 
-    // In case concatenating two scripts ends up with two codeseparators,
-    // or an extra one at the end, this prevents all those possible incompatibilities.
-    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+    bool fAnyoneCanPay = (nHashType & SIGHASH_ANYONECANPAY) != 0;
+    bool fHashNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    bool fHashSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
 
-    // Blank out other inputs' signatures
-    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
+    // Only lock-in the txout payee at same index as txin
+    if (fHashSingle && nIn >= txTo.vout.size())
+    {
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
 
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    // SIGHASH_ALL: everything except our own input comes from the cache
+    if (pcache && !fAnyoneCanPay && !fHashNone && !fHashSingle && pcache->vMidstate.size() == txTo.vin.size())
     {
-        // Wildcard payee
-        txTmp.vout.clear();
+        const unsigned char *pInput = &pcache->vchInputs[nIn * CSignatureHashCache::INPUT_SIZE];
+        CHashWriter ss(pcache->vMidstate[nIn], SER_GETHASH, 0);
+        ss.write((const char*)pInput, 36);
+        SerializeScriptCode(ss, scriptCode);
+        ss.write((const char*)pInput + 37, 4);
+        ss.write((const char*)pInput + CSignatureHashCache::INPUT_SIZE, pcache->vchInputs.size() - (nIn + 1) * CSignatureHashCache::INPUT_SIZE);
+        ss.write((const char*)&pcache->vchTail[0], pcache->vchTail.size());
+        ss << nHashType;
+        return ss.GetHash();
+    }
 
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+    // Serialize the transaction as modified by nHashType straight into
+    // the hasher. Other inputs' signatures are blanked out, with
+    // SIGHASH_NONE and SIGHASH_SINGLE other inputs may update at will.
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
+
+    // Blank out other inputs completely, not recommended for open transactions
+    if (fAnyoneCanPay)
+    {
+        WriteCompactSize(ss, 1);
+        SerializeInput(ss, txTo, nIn, scriptCode, nIn, false);
     }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    else
     {
-        // Only lock-in the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
-        {
-            printf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
-        }
-        txTmp.vout.resize(nOut+1);
-        for (unsigned int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
-
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+        WriteCompactSize(ss, txTo.vin.size());
+        for (unsigned int i = 0; i < txTo.vin.size(); i++)
+            SerializeInput(ss, txTo, i, scriptCode, nIn, fHashNone || fHashSingle);
     }
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    if (fHashNone)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
+        // Wildcard payee
+        WriteCompactSize(ss, 0);
+    }
+    else if (fHashSingle)
+    {
+        WriteCompactSize(ss, nIn + 1);
+        for (unsigned int i = 0; i < nIn; i++)
+            ss << CTxOut();
+        ss << txTo.vout[nIn];
     }
+    else
+        ss << txTo.vout;
 
-    // Serialize and hash
-    CDataStream ss(SER_GETHASH, 0);
-    ss.reserve(10000);
-    ss << txTmp << nHashType;
-    return Hash(ss.begin(), ss.end());
+    ss << txTo.nLockTime << nHashType;
+    return ss.GetHash();
 }
 
 
@@ -1227,60 +1302,60 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    using sigdata_type = std::tuple<uint256, std::vector<unsigned char>, CPubKey>;
-    std::set<sigdata_type> setValid;
-    std::shared_mutex cs_sigcache;
+    // Entries are salted hashes of (signature hash, signature, public key),
+    // the salt is private to this process.
+    unsigned char nonce[32];
+    CDigestCache setValid;
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    // Pick a new salt, the table must be empty. Not done by the constructor,
+    //   the RNG isn't seeded during static initialization.
+    void SetNonce()
     {
-        std::shared_lock<std::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        GetRandBytes(nonce, sizeof(nonce));
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        std::shared_lock<std::shared_mutex> lock(cs_sigcache);
+        uint32_t nSigSize = vchSig.size();
+        CSHA256()
+            .Write(nonce, sizeof(nonce))
+            .Write(hash.begin(), hash.size())
+            .Write((const unsigned char*)&nSigSize, sizeof(nSigSize))
+            .Write(vchSig.data(), vchSig.size())
+            .Write(pubKey.begin(), pubKey.size())
+            .Finalize(entry.begin());
+    }
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+    bool Get(const uint256& entry) const
+    {
+        return setValid.Contains(entry);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void Set(const uint256& entry)
+    {
+        setValid.Insert(entry);
     }
+
+    CDigestCache& Table() { return setValid; }
 };
 
-bool CheckSig(std::vector<unsigned char> vchSig, const std::vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+static CSignatureCache signatureCache;
+
+size_t InitSignatureCache(size_t nMaxBytes)
+{
+    signatureCache.SetNonce();
+    return signatureCache.Table().Resize(nMaxBytes);
+}
+
+const CDigestCache& GetSignatureCache()
 {
-    static CSignatureCache signatureCache;
+    return signatureCache.Table();
+}
 
+bool CheckSig(std::vector<unsigned char> vchSig, const std::vector<unsigned char> &vchPubKey, const CScript &scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHashCache* pcache)
+{
     CPubKey pubkey(vchPubKey);
     if (!pubkey.IsValid())
         return false;
@@ -1294,16 +1369,19 @@ bool CheckSig(std::vector<unsigned char> vchSig, const std::vector<unsigned char
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType, pcache);
+
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    if (signatureCache.Get(entry))
         return true;
 
     if (!pubkey.Verify(sighash, vchSig))
         return false;
 
     if (!(flags & SCRIPT_VERIFY_NOCACHE))
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
 
     return true;
 }
@@ -1841,14 +1919,14 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::
 }
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, const CSignatureHashCache* pcache)
 {
     std::vector<std::vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, pcache))
         return false;
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, pcache))
         return false;
     if (stack.empty())
         return false;
@@ -1871,7 +1949,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, pcache))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1881,14 +1959,18 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
     return true;
 }
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, int nHashType)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
 
+    // Signature hashes leave out all signatures, one copy of the
+    // transaction serves every hash below
+    const CTransaction txToConst(txTo);
+
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = SignatureHash(fromPubKey, txToConst, nIn, nHashType);
 
     txnouttype whichType;
     if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
@@ -1902,7 +1984,7 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         CScript subscript = txin.scriptSig;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = SignatureHash(subscript, txToConst, nIn, nHashType);
 
         txnouttype subType;
         bool fSolved =
@@ -1913,10 +1995,10 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
     }
 
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, STRICT_FLAGS, 0);
+    return VerifyScript(txin.scriptSig, fromPubKey, txToConst, nIn, STRICT_FLAGS, 0);
 }
 
-bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
@@ -8,6 +8,7 @@
 #include "keystore.h"
 #include "bignum.h"
 #include "util.h"
+#include "sha256.h"
 
 #include <string>
 #include <vector>
@@ -16,6 +17,7 @@
 typedef std::vector<uint8_t> valtype;
 
 class CTransaction;
+struct CMutableTransaction;
 class CBitcoinAddress;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
@@ -630,7 +632,26 @@ bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey, unsigned int
 bool IsDERSignature(const valtype &vchSig, bool fWithHashType=false, bool fCheckLow=false);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig, unsigned int flags);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** Parts of SIGHASH_ALL signature hashes shared by all inputs of a transaction:
+ * hasher state at the start of every input, inputs with blanked scripts
+ * and the serialized outputs. It's read-only once built, so script checks
+ * running in parallel may share it.
+ */
+class CSignatureHashCache
+{
+public:
+    // Serialized input with empty scriptSig: prevout, script length, nSequence
+    static const size_t INPUT_SIZE = 36 + 1 + 4;
+
+    std::vector<CSHA256> vMidstate;
+    std::vector<unsigned char> vchInputs;
+    std::vector<unsigned char> vchTail;
+
+    explicit CSignatureHashCache(const CTransaction& txTo);
+};
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashCache* pcache = NULL);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHashCache* pcache = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -641,9 +662,20 @@ void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey,
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractAddress(const CKeyStore &keystore, const CScript& scriptPubKey, CBitcoinAddress& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHashCache* pcache = NULL);
+
+class CDigestCache;
+
+// Default and maximum size of the signature and script execution caches
+//   together, in megabytes
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 1024;
+
+// Allocate the valid signature cache, returns the number of entries
+size_t InitSignatureCache(size_t nMaxBytes);
+const CDigestCache& GetSignatureCache();
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
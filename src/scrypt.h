@@ -1,6 +1,7 @@
 #ifndef SCRYPT_H
 #define SCRYPT_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include "uint256.h"
 
@@ -8,4 +9,13 @@
 
 uint256 scrypt_blockhash(const uint8_t* input);
 
+// Hash nCount consecutive 80 byte headers at once, output[i] receives the
+//   same value as scrypt_blockhash(input + 80 * i). Independent headers are
+//   interleaved to use the CPU better; the widest variant supported by the
+//   CPU is chosen at runtime.
+void scrypt_blockhash_batch(const uint8_t* input, uint256* output, size_t nCount);
+
+// Name of the implementation used by scrypt_blockhash_batch()
+const char* scrypt_batch_impl();
+
 #endif // SCRYPT_H
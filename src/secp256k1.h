@@ -0,0 +1,25 @@
+#ifndef NOVACOIN_SECP256K1_H
+#define NOVACOIN_SECP256K1_H
+
+#include <stddef.h>
+
+// Native secp256k1 signature verification. The field arithmetic needs
+//   128-bit integers, without them callers keep using OpenSSL.
+#if defined(__SIZEOF_INT128__)
+#define HAVE_NATIVE_SECP256K1 1
+
+// Check that the public key is a point on the curve in one of the encodings
+//   accepted by OpenSSL: compressed, uncompressed or hybrid.
+bool secp256k1_pubkey_valid(const unsigned char *pubkey, size_t nLen);
+
+// Parse DER encoded signature (without the hash type byte). Only the strict
+//   encoding checked by IsDERSignature() is accepted, r and s receive big
+//   endian values.
+bool secp256k1_parse_der_strict(const unsigned char *sig, size_t nLen, unsigned char r[32], unsigned char s[32]);
+
+// Verify ECDSA signature (r, s) of a 32 byte hash, the hash bytes are taken
+//   as a big endian number in the same way as ECDSA_verify() does.
+bool secp256k1_verify(const unsigned char *pubkey, size_t nLen, const unsigned char hash[32], const unsigned char r[32], const unsigned char s[32]);
+#endif
+
+#endif // NOVACOIN_SECP256K1_H
@@ -0,0 +1,67 @@
+#ifndef NOVACOIN_SHA256_H
+#define NOVACOIN_SHA256_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** SHA256 hasher. Block transform is selected at startup by SHA256AutoDetect(). */
+class CSHA256
+{
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    uint64_t bytes;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    CSHA256();
+    CSHA256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CSHA256& Reset();
+};
+
+// SHA256 of a 32 byte message, i.e. the second pass of double SHA256.
+//   Padding of such message is constant, so it is a single transform.
+void SHA256Hash32(unsigned char out[32], const unsigned char in[32]);
+
+// Double SHA256 of nBlocks 64 byte messages (two concatenated hashes,
+//   as used by the merkle tree), writing 32 bytes of output per message.
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks);
+
+// Choose the fastest implementations supported by this CPU and describe them
+std::string SHA256AutoDetect();
+
+// Check every implementation usable on this CPU against known vectors
+bool SHA256SelfTest();
+
+// Whether both the CPU and the OS support AVX2, false if this build has no
+//   AVX2 code. Shared with the scrypt batch hashing.
+bool CPUSupportsAVX2();
+
+// Number of consecutive timestamps hashed by one sha256_kernel_hash8() call
+#define KERNEL_SHA256_LANES 8
+
+// Proof-of-stake kernel is a fixed 24 byte prefix (nStakeModifier,
+//   nTimeBlockFrom, nTxPrevOffset, txPrev.nTime, prevout.n) followed by
+//   a 4 byte nTimeTx.
+// The whole kernel fits into a single SHA256 block, so everything that
+//   doesn't depend on nTimeTx (the first six rounds) is computed once.
+struct sha256_kernel_ctx
+{
+    uint32_t w[6];      // prefix as big endian message words
+    uint32_t state[8];  // state after the first six rounds
+};
+
+// Prepare scanner context for the 24 byte kernel prefix
+void sha256_kernel_init(sha256_kernel_ctx *ctx, const uint8_t *prefix);
+
+// Double SHA256 of the kernel for timestamps nTimeTx .. nTimeTx + 7,
+//   hashes[i] receives the words of uint256 hash for nTimeTx + i
+void sha256_kernel_hash8(const sha256_kernel_ctx *ctx, uint32_t nTimeTx, uint32_t hashes[KERNEL_SHA256_LANES][8]);
+
+// Name of the implementation chosen by sha256_kernel_hash8()
+const char* sha256_kernel_impl();
+
+#endif // NOVACOIN_SHA256_H
@@ -7,6 +7,8 @@
 #include "kernel.h"
 #include "checkpoints.h"
 #include "main.h"
+#include "init.h"
+#include "interface.h"
 
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
@@ -21,11 +23,237 @@ using namespace std;
 
 leveldb::DB *txdb; // global pointer for LevelDB object instance
 
+/** Write-back cache in front of the LevelDB instance.
+ *
+ * Holds committed changes which haven't been written yet (dirty entries)
+ * and values recently read from the database, including the absence of a
+ * key. Dirty entries are written together in one synced batch, clean ones
+ * are dropped in no particular order when the cache is full.
+ */
+class CTxDBCache
+{
+private:
+    struct CEntry
+    {
+        bool fExists;
+        bool fDirty;
+        string strValue;
+    };
+
+    CCriticalSection cs;
+    unordered_map<string, CEntry> mapEntries;
+    size_t nCacheBytes;
+    size_t nDirtyBytes;
+    size_t nMaxBytes;
+    size_t nFlushBytes;
+    int64_t nLastFlush;
+    uint64_t nGeneration;  // changes whenever an entry may have become stale
+    bool fWriteFailed;
+
+    static size_t EntryBytes(const string& strKey, const CEntry& entry)
+    {
+        // Rough allocation overhead of a node and its strings
+        return strKey.size() + entry.strValue.size() + 96;
+    }
+
+    void Evict();
+    bool WriteDirty(leveldb::DB* pdb);
+
+public:
+    CTxDBCache() : nCacheBytes(0), nDirtyBytes(0), nMaxBytes(0), nFlushBytes(0), nLastFlush(0), nGeneration(0), fWriteFailed(false) { }
+
+    void SetLimits(size_t nMaxBytesIn, size_t nFlushBytesIn)
+    {
+        LOCK(cs);
+        nMaxBytes = nMaxBytesIn;
+        // Leave room for clean entries, or eviction would keep scanning
+        // dirty ones
+        nFlushBytes = min(nFlushBytesIn, nMaxBytesIn / 2);
+        nLastFlush = GetTime();
+    }
+
+    // Returns false if the key has to be read from the database, and
+    //   the generation to pass to AddClean() after that read
+    bool Get(const string& strKey, bool& fExists, string& strValue, uint64_t& nGenerationRet);
+    void AddClean(const string& strKey, bool fExists, const string& strValue, uint64_t nGenerationRead);
+
+    // Changes are committed once they are in the cache, a failure to
+    //   write them afterwards doesn't undo them but stops the node
+    void Commit(CTxDBBatch& batch, leveldb::DB* pdb);
+    bool Flush(leveldb::DB* pdb);
+    void Clear();
+};
+
+static CTxDBCache txdbCache;
+
+bool CTxDBCache::Get(const string& strKey, bool& fExists, string& strValue, uint64_t& nGenerationRet)
+{
+    LOCK(cs);
+    unordered_map<string, CEntry>::const_iterator it = mapEntries.find(strKey);
+    if (it == mapEntries.end())
+    {
+        nGenerationRet = nGeneration;
+        return false;
+    }
+    fExists = it->second.fExists;
+    if (fExists)
+        strValue = it->second.strValue;
+    return true;
+}
+
+void CTxDBCache::AddClean(const string& strKey, bool fExists, const string& strValue, uint64_t nGenerationRead)
+{
+    LOCK(cs);
+    // The value read may be older than a change committed meanwhile
+    if (nGenerationRead != nGeneration || nMaxBytes == 0)
+        return;
+    CEntry entry;
+    entry.fExists = fExists;
+    entry.fDirty = false;
+    entry.strValue = strValue;
+    if (mapEntries.insert(make_pair(strKey, entry)).second)
+        nCacheBytes += EntryBytes(strKey, entry);
+    if (nCacheBytes > nMaxBytes)
+        Evict();
+}
+
+void CTxDBCache::Evict()
+{
+    // Keep some room, so this doesn't run on every insert
+    size_t nTarget = nMaxBytes / 4 * 3;
+    for (unordered_map<string, CEntry>::iterator it = mapEntries.begin(); it != mapEntries.end() && nCacheBytes > nTarget; )
+    {
+        if (it->second.fDirty)
+        {
+            ++it;
+            continue;
+        }
+        nCacheBytes -= EntryBytes(it->first, it->second);
+        it = mapEntries.erase(it);
+    }
+}
+
+void CTxDBCache::Commit(CTxDBBatch& batch, leveldb::DB* pdb)
+{
+    bool fReportFailure = false;
+    {
+        LOCK(cs);
+        nGeneration++;
+        for (CTxDBBatch::iterator bi = batch.begin(); bi != batch.end(); ++bi)
+        {
+            unordered_map<string, CEntry>::iterator it = mapEntries.find(bi->first);
+            if (it == mapEntries.end())
+                it = mapEntries.insert(make_pair(bi->first, CEntry())).first;
+            else
+            {
+                size_t nOldBytes = EntryBytes(it->first, it->second);
+                nCacheBytes -= nOldBytes;
+                if (it->second.fDirty)
+                    nDirtyBytes -= nOldBytes;
+            }
+
+            CEntry& entry = it->second;
+            entry.fExists = bi->second.first;
+            entry.fDirty = true;
+            entry.strValue.swap(bi->second.second);
+
+            size_t nNewBytes = EntryBytes(bi->first, entry);
+            nCacheBytes += nNewBytes;
+            nDirtyBytes += nNewBytes;
+        }
+
+        // Large batches also bound the work lost in a crash, so don't wait
+        // for the threshold forever
+        if (nDirtyBytes > nFlushBytes || (nDirtyBytes > 0 && GetTime() - nLastFlush > 10 * 60))
+        {
+            // The entries stay dirty, the write is retried on the next commit
+            // and once more at shutdown
+            if (!WriteDirty(pdb) && !fWriteFailed)
+                fWriteFailed = fReportFailure = true;
+        }
+        else if (nCacheBytes > nMaxBytes)
+            Evict();
+    }
+
+    // Readers of the database wait for cs, and callers usually hold
+    // cs_main, so the message box doesn't wait for the user
+    if (fReportFailure)
+    {
+        string strMessage = _("Error: Failed to write to the transaction database, shutting down");
+        strMiscWarning = strMessage;
+        printf("*** %s\n", strMessage.c_str());
+        uiInterface.ThreadSafeMessageBox(strMessage, "NovaCoin", CClientUIInterface::OK | CClientUIInterface::ICON_EXCLAMATION);
+        StartShutdown();
+    }
+}
+
+bool CTxDBCache::WriteDirty(leveldb::DB* pdb)
+{
+    if (nDirtyBytes == 0)
+        return true;
+
+    // Blocks the written index points to have to be on disk first
+    CommitBlockFile();
+
+    int64_t nStart = GetTimeMillis();
+    leveldb::WriteBatch batch;
+    unsigned int nWritten = 0;
+    for (unordered_map<string, CEntry>::const_iterator it = mapEntries.begin(); it != mapEntries.end(); ++it)
+    {
+        if (!it->second.fDirty)
+            continue;
+        if (it->second.fExists)
+            batch.Put(it->first, it->second.strValue);
+        else
+            batch.Delete(it->first);
+        nWritten++;
+    }
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status status = pdb->Write(writeOptions, &batch);
+    if (!status.ok()) {
+        printf("LevelDB batch commit failure: %s\n", status.ToString().c_str());
+        return false;
+    }
+
+    for (unordered_map<string, CEntry>::iterator it = mapEntries.begin(); it != mapEntries.end(); ++it)
+        it->second.fDirty = false;
+    nDirtyBytes = 0;
+    nLastFlush = GetTime();
+    if (fDebug)
+        printf("CTxDBCache::WriteDirty() : wrote %u entries in %" PRId64 "ms\n", nWritten, GetTimeMillis() - nStart);
+
+    if (nCacheBytes > nMaxBytes)
+        Evict();
+    return true;
+}
+
+bool CTxDBCache::Flush(leveldb::DB* pdb)
+{
+    LOCK(cs);
+    return WriteDirty(pdb);
+}
+
+void CTxDBCache::Clear()
+{
+    LOCK(cs);
+    nGeneration++;
+    mapEntries.clear();
+    nCacheBytes = 0;
+    nDirtyBytes = 0;
+}
+
 static leveldb::Options GetOptions() {
     leveldb::Options options;
+    // A quarter of -dbcache goes to LevelDB's block cache, the rest to the
+    // write-back cache
     int nCacheSizeMB = GetArgInt("-dbcache", 25);
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
+    size_t nCacheBytes = (size_t)max(nCacheSizeMB, 1) * 1048576;
+    options.block_cache = leveldb::NewLRUCache(nCacheBytes / 4);
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    size_t nWriteBackBytes = nCacheBytes - nCacheBytes / 4;
+    txdbCache.SetLimits(nWriteBackBytes, (size_t)GetArg("-dbflush", nWriteBackBytes / 2 / 1048576) * 1048576);
     return options;
 }
 
@@ -93,6 +321,7 @@ CTxDB::CTxDB(const char* pszMode)
             // Leveldb instance destruction
             delete activeBatch;
             activeBatch = NULL;
+            txdbCache.Clear();
             delete txdb;
             txdb = pdb = NULL;
 
@@ -118,6 +347,9 @@ CTxDB::CTxDB(const char* pszMode)
 
 void CTxDB::Close()
 {
+    if (txdb)
+        txdbCache.Flush(txdb);
+    txdbCache.Clear();
     delete txdb;
     txdb = pdb = NULL;
     delete options.filter_policy;
@@ -128,68 +360,71 @@ void CTxDB::Close()
     activeBatch = NULL;
 }
 
+bool CTxDB::Flush()
+{
+    if (!txdb)
+        return true;
+    return txdbCache.Flush(txdb);
+}
+
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CTxDBBatch();
     return true;
 }
 
 bool CTxDB::TxnCommit()
 {
     assert(activeBatch);
-    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
+    bool fOk = CommitBatch(*activeBatch);
     delete activeBatch;
     activeBatch = NULL;
-    if (!status.ok()) {
-        printf("LevelDB batch commit failure: %s\n", status.ToString().c_str());
-        return false;
-    }
+    return fOk;
+}
+
+bool CTxDB::CommitBatch(CTxDBBatch& batch)
+{
+    txdbCache.Commit(batch, pdb);
     return true;
 }
 
-class CBatchScanner : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
-
-    CBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        }
-    }
+bool CTxDB::ReadRaw(const string& strKey, string& strValue)
+{
+    bool fExists;
+    uint64_t nGeneration;
+    if (txdbCache.Get(strKey, fExists, strValue, nGeneration))
+        return fExists;
 
-    virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = true;
+    leveldb::Status status = pdb->Get(leveldb::ReadOptions(), strKey, &strValue);
+    if (!status.ok()) {
+        if (status.IsNotFound()) {
+            txdbCache.AddClean(strKey, false, string(), nGeneration);
+            return false;
         }
+        // Some unexpected error.
+        printf("LevelDB read failure: %s\n", status.ToString().c_str());
+        return false;
     }
-};
+    txdbCache.AddClean(strKey, true, strValue, nGeneration);
+    return true;
+}
 
 // When performing a read, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// a database transaction begins reads are consistent with it. The batch
+// keeps the latest change of each key, so this is a single hash lookup.
 bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
     assert(activeBatch);
     *deleted = false;
-    CBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
-    }
-    return scanner.foundEntry;
+    CTxDBBatch::const_iterator it = activeBatch->find(key.str());
+    if (it == activeBatch->end())
+        return false;
+    if (it->second.first)
+        *value = it->second.second;
+    else
+        *deleted = true;
+    return true;
 }
 
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
@@ -232,7 +467,7 @@ bool CTxDB::ContainsTx(uint256 hash)
 bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
 {
     assert(!fClient);
-    tx.SetNull();
+    tx = CTransaction();
     if (!ReadTxIndex(hash, txindex))
         return false;
     return (tx.ReadFromDisk(txindex.pos));
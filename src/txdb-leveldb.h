@@ -13,6 +13,8 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <unordered_map>
+
 class CBigNum;
 class CDiskBlockIndex;
 class COutPoint;
@@ -21,6 +23,10 @@ class CTransaction;
 class uint256;
 class CDiskTxPos;
 
+// Pending changes of a database transaction, a key maps to (true, value)
+// for a write and to (false, "") for a delete
+typedef std::unordered_map<std::string, std::pair<bool, std::string> > CTxDBBatch;
+
 // Class that provides access to a LevelDB. Note that this class is frequently
 // instantiated on the stack and then destroyed again, so instantiation has to
 // be very cheap. Unfortunately that means, a CTxDB instance is actually just a
@@ -33,6 +39,14 @@ class CDiskTxPos;
 // together when too many files stack up.
 //
 // Learn more: http://code.google.com/p/leveldb/
+//
+// Committed changes don't go to LevelDB right away. They are kept in a
+// write-back cache together with recently read values, and written in one
+// atomic batch once they take more than -dbflush megabytes, after ten
+// minutes or on shutdown. The database therefore always holds the state of
+// some commit. A failure to write the cache stops the node, the commit
+// itself isn't undone. Blocks stored after it are replayed from the block files on
+// the next start, see ReplayBlockFiles().
 class CTxDB
 {
 public:
@@ -46,12 +60,17 @@ public:
     // Destroys the underlying shared global state accessed by this TxDB.
     void Close();
 
+    // Writes all cached changes to the database.
+    static bool Flush();
+
 private:
     leveldb::DB *pdb;  // Points to the global instance.
 
     // A batch stores up writes and deletes for atomic application. When this
-    // field is non-NULL, writes/deletes go there instead of directly to disk.
-    leveldb::WriteBatch *activeBatch;
+    // field is non-NULL, writes/deletes go there instead of to the cache. It
+    // keeps only the latest change of every key, so reads don't have to scan
+    // it.
+    CTxDBBatch *activeBatch;
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
@@ -62,6 +81,13 @@ protected:
     // delete for it.
     bool ScanBatch(const CDataStream &key, std::string *value, bool *deleted) const;
 
+    // Reads through the write-back cache, returns false if the key doesn't
+    // exist.
+    bool ReadRaw(const std::string& strKey, std::string& strValue);
+
+    // Hands committed changes over to the write-back cache.
+    bool CommitBatch(CTxDBBatch& batch);
+
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
@@ -80,17 +106,8 @@ protected:
                 return false;
             }
         }
-        if (readFromDb) {
-            leveldb::Status status = pdb->Get(leveldb::ReadOptions(),
-                                              ssKey.str(), &strValue);
-            if (!status.ok()) {
-                if (status.IsNotFound())
-                    return false;
-                // Some unexpected error.
-                printf("LevelDB read failure: %s\n", status.ToString().c_str());
-                return false;
-            }
-        }
+        if (readFromDb && !ReadRaw(ssKey.str(), strValue))
+            return false;
         // Unserialize value
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(),
@@ -117,15 +134,12 @@ protected:
         ssValue << value;
 
         if (activeBatch) {
-            activeBatch->Put(ssKey.str(), ssValue.str());
+            (*activeBatch)[ssKey.str()] = std::make_pair(true, ssValue.str());
             return true;
         }
-        leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
-        if (!status.ok()) {
-            printf("LevelDB write failure: %s\n", status.ToString().c_str());
-            return false;
-        }
-        return true;
+        CTxDBBatch batch;
+        batch[ssKey.str()] = std::make_pair(true, ssValue.str());
+        return CommitBatch(batch);
     }
 
     template<typename K>
@@ -140,11 +154,12 @@ protected:
         ssKey.reserve(1000);
         ssKey << key;
         if (activeBatch) {
-            activeBatch->Delete(ssKey.str());
+            (*activeBatch)[ssKey.str()] = std::make_pair(false, std::string());
             return true;
         }
-        leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
-        return (status.ok() || status.IsNotFound());
+        CTxDBBatch batch;
+        batch[ssKey.str()] = std::make_pair(false, std::string());
+        return CommitBatch(batch);
     }
 
     template<typename K>
@@ -157,14 +172,12 @@ protected:
 
         if (activeBatch) {
             bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
-                return true;
+            if (ScanBatch(ssKey, &unused, &deleted)) {
+                return !deleted;
             }
         }
 
-
-        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &unused);
-        return status.IsNotFound() == false;
+        return ReadRaw(ssKey.str(), unused);
     }
 
 
@@ -165,8 +165,8 @@ uint256& uint256::operator*=(const uint256& b)
     for (int j = 0; j < WIDTH; j++) {
         uint64_t carry = 0;
         for (int i = 0; i + j < WIDTH; i++) {
-            uint64_t n = carry + pn[i + j] + (uint64_t)a.pn[j] * b.pn[i];
-            pn[i + j] = n & 0xffffffff;
+            uint64_t n = carry + a.pn[i + j] + (uint64_t)pn[j] * b.pn[i];
+            a.pn[i + j] = n & 0xffffffff;
             carry = n >> 32;
         }
     }
@@ -174,6 +174,19 @@ uint256& uint256::operator*=(const uint256& b)
     return *this;
 }
 
+uint256& uint256::operator/=(uint32_t b32)
+{
+    if (b32 == 0)
+        throw uint256_error("Division by zero");
+    uint64_t rem = 0;
+    for (int i = WIDTH - 1; i >= 0; i--) {
+        uint64_t n = (rem << 32) | pn[i];
+        pn[i] = (uint32_t)(n / b32);
+        rem = n % b32;
+    }
+    return *this;
+}
+
 uint256& uint256::operator/=(const uint256& b)
 {
     uint256 div = b;     // make a copy, so we can shift.
@@ -190,7 +203,7 @@ uint256& uint256::operator/=(const uint256& b)
     while (shift >= 0) {
         if (num >= div) {
             num -= div;
-            pn[shift / 32] |= (1 << (shift & 31)); // set a bit of the result.
+            pn[shift / 32] |= (1U << (shift & 31)); // set a bit of the result.
         }
         div >>= 1; // shift back.
         shift--;
@@ -211,3 +224,137 @@ uint256::uint256(const std::vector<unsigned char>& vch)
     else
         *this = 0;
 }
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// uint512
+//
+
+uint512::uint512()
+{
+    for (int i = 0; i < WIDTH; i++)
+        pn[i] = 0;
+}
+
+uint512::uint512(const basetype& b)
+{
+    for (int i = 0; i < WIDTH; i++)
+        pn[i] = b.pn[i];
+}
+
+uint512& uint512::operator=(const basetype& b)
+{
+    for (int i = 0; i < WIDTH; i++)
+        pn[i] = b.pn[i];
+    return *this;
+}
+
+uint512::uint512(uint64_t b)
+{
+    pn[0] = (uint32_t)b;
+    pn[1] = (uint32_t)(b >> 32);
+    for (int i = 2; i < WIDTH; i++)
+        pn[i] = 0;
+}
+
+uint512& uint512::operator=(uint64_t b)
+{
+    pn[0] = (uint32_t)b;
+    pn[1] = (uint32_t)(b >> 32);
+    for (int i = 2; i < WIDTH; i++)
+        pn[i] = 0;
+    return *this;
+}
+
+uint512::uint512(const base_uint256& b)
+{
+    for (int i = 0; i < base_uint256::WIDTH; i++)
+        pn[i] = b.pn[i];
+    for (int i = base_uint256::WIDTH; i < WIDTH; i++)
+        pn[i] = 0;
+}
+
+uint512& uint512::operator*=(uint32_t b32)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < WIDTH; i++) {
+        uint64_t n = carry + (uint64_t)b32 * pn[i];
+        pn[i] = n & 0xffffffff;
+        carry = n >> 32;
+    }
+    return *this;
+}
+
+uint512& uint512::operator*=(const uint512& b)
+{
+    // Operands are mostly much narrower than 512 bits,
+    //   only multiply their significant words
+    int na = (bits() + 31) / 32, nb = (b.bits() + 31) / 32;
+    uint512 a;
+    for (int j = 0; j < na; j++) {
+        uint64_t carry = 0;
+        for (int i = 0; i < nb && i + j < WIDTH; i++) {
+            uint64_t n = carry + a.pn[i + j] + (uint64_t)pn[j] * b.pn[i];
+            a.pn[i + j] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        if (j + nb < WIDTH)
+            a.pn[j + nb] = (uint32_t)carry;
+    }
+    *this = a;
+    return *this;
+}
+
+uint512& uint512::operator/=(uint32_t b32)
+{
+    if (b32 == 0)
+        throw uint256_error("Division by zero");
+    uint64_t rem = 0;
+    for (int i = WIDTH - 1; i >= 0; i--) {
+        uint64_t n = (rem << 32) | pn[i];
+        pn[i] = (uint32_t)(n / b32);
+        rem = n % b32;
+    }
+    return *this;
+}
+
+uint512& uint512::operator/=(const uint512& b)
+{
+    uint512 div = b;     // make a copy, so we can shift.
+    uint512 num = *this; // make a copy, so we can subtract.
+    *this = 0;                   // the quotient.
+    int num_bits = num.bits();
+    int div_bits = div.bits();
+    if (div_bits == 0)
+        throw uint256_error("Division by zero");
+    if (div_bits > num_bits) // the result is certainly 0.
+        return *this;
+    int shift = num_bits - div_bits;
+    div <<= shift; // shift so that div and num align.
+    while (shift >= 0) {
+        if (num >= div) {
+            num -= div;
+            pn[shift / 32] |= (1U << (shift & 31)); // set a bit of the result.
+        }
+        div >>= 1; // shift back.
+        shift--;
+    }
+    // num now contains the remainder of the division.
+    return *this;
+}
+
+uint256 uint512::trim256() const
+{
+    uint256 ret;
+    for (int i = 0; i < base_uint256::WIDTH; i++)
+        ret.pn[i] = pn[i];
+    return ret;
+}
+
+uint256 uint512::saturate256() const
+{
+    for (int i = base_uint256::WIDTH; i < WIDTH; i++)
+        if (pn[i] != 0)
+            return ~uint256(0);
+    return trim256();
+}
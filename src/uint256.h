@@ -407,10 +407,12 @@ public:
 
     friend class uint160;
     friend class uint256;
+    friend class uint512;
 };
 
 typedef base_uint<160> base_uint160;
 typedef base_uint<256> base_uint256;
+typedef base_uint<512> base_uint512;
 
 //
 // uint160 and uint256 could be implemented as templates, but to keep
@@ -526,6 +528,7 @@ public:
     uint32_t GetCompact(bool fNegative = false) const;
     uint256& operator*=(uint32_t b32);
     uint256& operator*=(const uint256& b);
+    uint256& operator/=(uint32_t b32);
     uint256& operator/=(const uint256& b);
     explicit uint256(const std::string& str);
     explicit uint256(const std::vector<unsigned char>& vch);
@@ -584,4 +587,58 @@ inline const uint256 operator|(const uint256& a, const uint256& b)      { return
 inline const uint256 operator+(const uint256& a, const uint256& b)      { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const uint256& b)      { return (base_uint256)a -  (base_uint256)b; }
 
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// uint512
+//
+
+/** 512-bit unsigned integer, wide enough to hold a product of a 256-bit
+ * target and a coin value without overflow.
+ */
+class uint512 : public base_uint512
+{
+public:
+    typedef base_uint512 basetype;
+
+    uint512();
+    uint512(const basetype& b);
+    uint512& operator=(const basetype& b);
+    uint512(uint64_t b);
+    uint512& operator=(uint64_t b);
+    explicit uint512(const base_uint256& b);
+    uint512& operator*=(uint32_t b32);
+    uint512& operator*=(const uint512& b);
+    uint512& operator/=(uint32_t b32);
+    uint512& operator/=(const uint512& b);
+
+    // Low 256 bits of the number
+    uint256 trim256() const;
+    // Number if it fits into 256 bits, ~uint256(0) otherwise
+    uint256 saturate256() const;
+};
+
+inline bool operator==(const uint512& a, uint64_t b)                           { return (base_uint512)a == b; }
+inline bool operator!=(const uint512& a, uint64_t b)                           { return (base_uint512)a != b; }
+inline const uint512 operator<<(const base_uint512& a, unsigned int shift)   { return uint512(a) <<= shift; }
+inline const uint512 operator>>(const base_uint512& a, unsigned int shift)   { return uint512(a) >>= shift; }
+inline const uint512 operator<<(const uint512& a, unsigned int shift)        { return uint512(a) <<= shift; }
+inline const uint512 operator>>(const uint512& a, unsigned int shift)        { return uint512(a) >>= shift; }
+
+inline const uint512 operator+(const base_uint512& a, const base_uint512& b) { return uint512(a) += b; }
+inline const uint512 operator-(const base_uint512& a, const base_uint512& b) { return uint512(a) -= b; }
+inline const uint512 operator*(const base_uint512& a, const base_uint512& b) { return uint512(a) *= b; }
+inline const uint512 operator/(const base_uint512& a, const base_uint512& b) { return uint512(a) /= b; }
+
+inline bool operator<(const uint512& a, const uint512& b)               { return (base_uint512)a <  (base_uint512)b; }
+inline bool operator<=(const uint512& a, const uint512& b)              { return (base_uint512)a <= (base_uint512)b; }
+inline bool operator>(const uint512& a, const uint512& b)               { return (base_uint512)a >  (base_uint512)b; }
+inline bool operator>=(const uint512& a, const uint512& b)              { return (base_uint512)a >= (base_uint512)b; }
+inline bool operator==(const uint512& a, const uint512& b)              { return (base_uint512)a == (base_uint512)b; }
+inline bool operator!=(const uint512& a, const uint512& b)              { return (base_uint512)a != (base_uint512)b; }
+inline const uint512 operator+(const uint512& a, const uint512& b)      { return (base_uint512)a +  (base_uint512)b; }
+inline const uint512 operator-(const uint512& a, const uint512& b)      { return (base_uint512)a -  (base_uint512)b; }
+inline const uint512 operator*(const uint512& a, const uint512& b)      { return (base_uint512)a *  (base_uint512)b; }
+inline const uint512 operator/(const uint512& a, const uint512& b)      { return (base_uint512)a /  (base_uint512)b; }
+
 #endif
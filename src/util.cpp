@@ -250,8 +250,22 @@ string real_strprintf(const std::string &format, int dummy, ...)
     return str;
 }
 
+static thread_local int nSilentErrors = 0;
+
+CSilentErrors::CSilentErrors()
+{
+    nSilentErrors++;
+}
+
+CSilentErrors::~CSilentErrors()
+{
+    nSilentErrors--;
+}
+
 bool error(const char *format, ...)
 {
+    if (nSilentErrors > 0)
+        return false;
     va_list arg_ptr;
     va_start(arg_ptr, format);
     std::string str = vstrprintf(format, arg_ptr);
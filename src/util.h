@@ -176,6 +176,16 @@ std::string vstrprintf(const char *format, va_list ap);
 
 bool ATTR_WARN_PRINTF(1,2) error(const char *format, ...);
 
+/** While in scope, error() returns false without logging on this thread.
+ *  For checks run ahead of time whose failures get reported by a later run.
+ */
+class CSilentErrors
+{
+public:
+    CSilentErrors();
+    ~CSilentErrors();
+};
+
 /* Redefine printf so that it directs output to debug.log
  *
  * Do this *after* defining the other printf-like functions, because otherwise the
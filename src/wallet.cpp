@@ -624,6 +624,7 @@ void CWallet::MarkDirty()
         for (auto& item : mapWallet)
             item.second.MarkDirty();
     }
+    coinAgeCache.MarkRescan();
 }
 
 bool CWallet::AddToWallet(const CWalletTx& wtxIn)
@@ -784,6 +785,7 @@ bool CWallet::EraseFromWallet(uint256 hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        coinAgeCache.MarkTx(hash);
     }
     return true;
 }
@@ -1792,15 +1794,7 @@ static void ApproximateBestSubset(std::vector<std::pair<int64_t, std::pair<const
 
 int64_t CWallet::GetStake() const
 {
-    int64_t nTotal = 0;
-    LOCK(cs_wallet);
-    for (auto it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin, MINE_ALL);
-    }
-    return nTotal;
+    return coinAgeCache.GetStake();
 }
 
 int64_t CWallet::GetWatchOnlyStake() const
@@ -1977,14 +1971,16 @@ bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, std::se
             SelectCoinsMinConf(nTargetValue, nSpendTime, 0, 1, vCoins, setCoinsRet, nValueRet));
 }
 
-CWallet::CWallet()
+CWallet::CWallet() : coinAgeCache(this)
 {
     SetNull();
+    NotifyTransactionChanged.connect(boost::bind(&CCoinAgeCache::MarkTx, &coinAgeCache, boost::placeholders::_2));
 }
 
-CWallet::CWallet(std::string strWalletFileIn)
+CWallet::CWallet(std::string strWalletFileIn) : coinAgeCache(this)
 {
     SetNull();
+    NotifyTransactionChanged.connect(boost::bind(&CCoinAgeCache::MarkTx, &coinAgeCache, boost::placeholders::_2));
 
     strWalletFile = strWalletFileIn;
     fFileBacked = true;
@@ -2075,23 +2071,24 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
         // txdb must be opened before the mapWallet lock
         CTxDB txdb("r");
         {
+            CMutableTransaction txNew(wtxNew);
             nFeeRet = nTransactionFee;
             for ( ; ; )
             {
-                wtxNew.vin.clear();
-                wtxNew.vout.clear();
+                txNew.vin.clear();
+                txNew.vout.clear();
                 wtxNew.fFromMe = true;
 
                 int64_t nTotalValue = nValue + nFeeRet;
                 double dPriority = 0;
                 // vouts to the payees
                 for (const auto& s : vecSend)
-                    wtxNew.vout.push_back(CTxOut(s.second, s.first));
+                    txNew.vout.push_back(CTxOut(s.second, s.first));
 
                 // Choose coins to use
                 std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
                 int64_t nValueIn = 0;
-                if (!SelectCoins(nTotalValue, wtxNew.nTime, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(nTotalValue, txNew.nTime, setCoins, nValueIn, coinControl))
                     return false;
                 for (auto pcoin : setCoins)
                 {
@@ -2128,22 +2125,25 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                     }
 
                     // Insert change txn at random position:
-                    auto position = wtxNew.vout.begin()+GetRandInt(wtxNew.vout.size());
-                    wtxNew.vout.insert(position, CTxOut(nChange, scriptChange));
+                    auto position = txNew.vout.begin()+GetRandInt(txNew.vout.size());
+                    txNew.vout.insert(position, CTxOut(nChange, scriptChange));
                 }
                 else
                     reservekey.ReturnKey();
 
                 // Fill vin
                 for (const auto& coin : setCoins)
-                    wtxNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second));
+                    txNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second));
 
                 // Sign
                 int nIn = 0;
                 for (const auto& coin : setCoins)
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
+                    if (!SignSignature(*this, *coin.first, txNew, nIn++))
                         return false;
 
+                // Embed the constructed transaction data in wtxNew
+                *static_cast<CTransaction*>(&wtxNew) = CTransaction(txNew);
+
                 // Limit size
                 unsigned int nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION);
                 if (nBytes >= MAX_BLOCK_SIZE_GEN/5)
@@ -2179,6 +2179,20 @@ bool CWallet::CreateTransaction(CScript scriptPubKey, int64_t nValue, CWalletTx&
     return CreateTransaction(vecSend, wtxNew, reservekey, nFeeRet, coinControl);
 }
 
+// Coin-day weight of nValue for the given time weight, nValue * nTimeWeight / COIN / nOneDay
+static uint64_t GetCoinDayWeight(int64_t nValue, int64_t nTimeWeight)
+{
+    // Whole coins and the remainder are weighted separately, as long as the product fits
+    uint64_t nCoins = nValue / COIN, nCents = nValue % COIN;
+    if (nValue < 0 || (nCoins != 0 && (uint64_t)nTimeWeight > std::numeric_limits<uint64_t>::max() / nCoins))
+    {
+        CBigNum bnCoinDayWeight = CBigNum(nValue) * nTimeWeight / COIN / nOneDay;
+        return bnCoinDayWeight.getuint64();
+    }
+
+    return (nCoins * nTimeWeight + nCents * nTimeWeight / COIN) / nOneDay;
+}
+
 void CWallet::GetStakeWeightFromValue(const int64_t& nTime, const int64_t& nValue, uint64_t& nWeight)
 {
     int64_t nTimeWeight = GetWeight(nTime, GetTime());
@@ -2190,8 +2204,180 @@ void CWallet::GetStakeWeightFromValue(const int64_t& nTime, const int64_t& nValu
         return;
     }
 
-    CBigNum bnCoinDayWeight = CBigNum(nValue) * nTimeWeight / COIN / nOneDay;
-    nWeight = bnCoinDayWeight.getuint64();
+    nWeight = GetCoinDayWeight(nValue, nTimeWeight);
+}
+
+uint64_t CWallet::GetStakeWeight() const
+{
+    return coinAgeCache.GetStakeWeight(GetTime());
+}
+
+void CCoinAgeCache::EraseInput(std::map<COutPoint, size_t>::iterator it)
+{
+    // Move the last input into the freed position
+    size_t nPos = it->second;
+    if (nPos + 1 != vInputs.size())
+    {
+        vInputs[nPos] = vInputs.back();
+        mapInputs[vInputs[nPos].prevout] = nPos;
+    }
+    vInputs.pop_back();
+    mapInputs.erase(it);
+}
+
+// Re-examine outputs of the wallet transaction, requires cs_wallet and cs_inputs
+void CCoinAgeCache::UpdateTx(const uint256& hashTx)
+{
+    std::map<COutPoint, size_t>::iterator it = mapInputs.lower_bound(COutPoint(hashTx, 0));
+    while (it != mapInputs.end() && it->first.hash == hashTx)
+        EraseInput(it++);
+    mapStake.erase(hashTx);
+
+    std::map<uint256, CWalletTx>::const_iterator mi = pwallet->mapWallet.find(hashTx);
+    if (mi == pwallet->mapWallet.end())
+        return;
+
+    const CWalletTx& wtx = mi->second;
+    CBlockIndex *pindex = NULL;
+    if (!wtx.IsFinal() || wtx.GetDepthInMainChain(pindex) <= 0)
+        return;
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (wtx.IsSpent(i) || wtx.vout[i].nValue <= 0 || pwallet->IsMine(wtx.vout[i]) != MINE_SPENDABLE)
+            continue;
+
+        CInput input;
+        input.prevout = COutPoint(hashTx, i);
+        input.nValue = wtx.vout[i].nValue;
+        input.nTime = wtx.nTime;
+        input.nBlockTime = pindex->nTime;
+        input.pindex = pindex;
+
+        mapInputs[input.prevout] = vInputs.size();
+        vInputs.push_back(input);
+    }
+
+    if (wtx.IsCoinStake())
+        mapStake[hashTx] = std::make_pair(pindex, pwallet->GetCredit(wtx, MINE_ALL));
+}
+
+// Apply pending changes and drop inputs which have left the main chain
+void CCoinAgeCache::Update()
+{
+    {
+        LOCK(cs_pending);
+        if (!fRescan && setPendingTx.empty() && pindexLast == pindexBest)
+            return;
+    }
+
+    LOCK2(pwallet->cs_wallet, cs_inputs);
+
+    std::set<uint256> setTx;
+    bool fFullRescan;
+    CBlockIndex *pindexPrev;
+    {
+        LOCK(cs_pending);
+        setTx.swap(setPendingTx);
+        fFullRescan = fRescan;
+        fRescan = false;
+        pindexPrev = pindexLast;
+        pindexLast = pindexBest;
+    }
+
+    if (fFullRescan)
+    {
+        vInputs.clear();
+        mapInputs.clear();
+        mapStake.clear();
+        for (std::map<uint256, CWalletTx>::const_iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); it++)
+            UpdateTx(it->first);
+        return;
+    }
+
+    // Transactions of the blocks disconnected since the last update
+    if (pindexPrev != pindexLast)
+    {
+        for (const CInput& input : vInputs)
+            if (!input.pindex->IsInMainChain())
+                setTx.insert(input.prevout.hash);
+        for (std::map<uint256, std::pair<CBlockIndex*, int64_t> >::const_iterator it = mapStake.begin(); it != mapStake.end(); it++)
+            if (!it->second.first->IsInMainChain())
+                setTx.insert(it->first);
+    }
+
+    for (const uint256& hashTx : setTx)
+        UpdateTx(hashTx);
+}
+
+uint64_t CCoinAgeCache::GetStakeWeight(int64_t nTime)
+{
+    Update();
+
+    LOCK(cs_inputs);
+    uint64_t nWeight = 0;
+    for (const CInput& input : vInputs)
+    {
+        int64_t nTimeWeight = GetWeight(input.nTime, nTime);
+        if (nTimeWeight > 0)
+            nWeight += GetCoinDayWeight(input.nValue, nTimeWeight);
+    }
+    return nWeight;
+}
+
+int64_t CCoinAgeCache::GetStake()
+{
+    Update();
+
+    LOCK(cs_inputs);
+    int nHeight = pindexBest->nHeight;
+    int64_t nTotal = 0;
+    for (std::map<uint256, std::pair<CBlockIndex*, int64_t> >::const_iterator it = mapStake.begin(); it != mapStake.end(); it++)
+    {
+        int nDepth = nHeight - it->second.first->nHeight + 1;
+        if (nDepth > 0 && nDepth < nCoinbaseMaturity + 20)
+            nTotal += it->second.second;
+    }
+    return nTotal;
+}
+
+bool CCoinAgeCache::GetCoinAge(const CTransaction& tx, uint64_t& nCoinAge)
+{
+    CBigNum bnCentSecond = 0;  // coin age in the unit of cent-seconds
+    nCoinAge = 0;
+
+    if (tx.IsCoinBase())
+        return true;
+
+    Update();
+
+    LOCK(cs_inputs);
+    for (const CTxIn& txin : tx.vin)
+    {
+        std::map<COutPoint, size_t>::const_iterator it = mapInputs.find(txin.prevout);
+        if (it == mapInputs.end())
+            return false;
+
+        const CInput& input = vInputs[it->second];
+        if (tx.nTime < input.nTime)
+            return false;  // Transaction timestamp violation, reported by the full check
+        if (input.nBlockTime + nStakeMinAge > tx.nTime)
+            continue; // only count coins meeting min age requirement
+
+        bnCentSecond += CBigNum(input.nValue) * (tx.nTime - input.nTime) / CENT;
+    }
+
+    CBigNum bnCoinDay = bnCentSecond * CENT / COIN / nOneDay;
+    nCoinAge = bnCoinDay.getuint64();
+    return true;
+}
+
+size_t CCoinAgeCache::GetInputCount()
+{
+    Update();
+
+    LOCK(cs_inputs);
+    return vInputs.size();
 }
 
 bool CWallet::MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const int64_t& nOutputValue, std::list<uint256>& listMerged)
@@ -2212,7 +2398,7 @@ bool CWallet::MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const
     if (setCoins.empty())
         return false;
 
-    CWalletTx wtxNew;
+    CMutableTransaction txNew;
     std::vector<const CWalletTx*> vwtxPrev;
 
     // Reserve a new key pair from key pool
@@ -2224,7 +2410,7 @@ bool CWallet::MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const
     scriptOutput.SetDestination(vchPubKey.GetID());
 
     // Insert output
-    wtxNew.vout.push_back(CTxOut(0, scriptOutput));
+    txNew.vout.push_back(CTxOut(0, scriptOutput));
 
     double dWeight = 0;
     for (auto pcoin : setCoins)
@@ -2232,46 +2418,47 @@ bool CWallet::MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const
         int64_t nCredit = pcoin.first->vout[pcoin.second].nValue;
 
         // Add current coin to inputs list and add its credit to transaction output
-        wtxNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-        wtxNew.vout[0].nValue += nCredit;
+        txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+        txNew.vout[0].nValue += nCredit;
         vwtxPrev.push_back(pcoin.first);
 
 /*
         // Replaced with estimation for performance purposes
 
-        for (unsigned int i = 0; i < wtxNew.vin.size(); i++) {
+        for (unsigned int i = 0; i < txNew.vin.size(); i++) {
             const CWalletTx *txin = vwtxPrev[i];
 
             // Sign scripts to get actual transaction size for fee calculation
-            if (!SignSignature(*this, *txin, wtxNew, i))
+            if (!SignSignature(*this, *txin, txNew, i))
                 return false;
         }
 */
 
         // Assuming that average scriptsig size is 110 bytes
-        int64_t nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION) + wtxNew.vin.size() * 110;
+        int64_t nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION) + txNew.vin.size() * 110;
         dWeight += (double)nCredit * pcoin.first->GetDepthInMainChain();
 
         double dFinalPriority = dWeight /= nBytes;
         bool fAllowFree = CTransaction::AllowFree(dFinalPriority);
 
         // Get actual transaction fee according to its estimated size and priority
-        int64_t nMinFee = wtxNew.GetMinFee(1, fAllowFree, GMF_SEND, nBytes);
+        int64_t nMinFee = CTransaction(txNew).GetMinFee(1, fAllowFree, GMF_SEND, nBytes);
 
         // Prepare transaction for commit if sum is enough ot its size is too big
-        if (nBytes >= MAX_BLOCK_SIZE_GEN/6 || wtxNew.vout[0].nValue >= nOutputValue)
+        if (nBytes >= MAX_BLOCK_SIZE_GEN/6 || txNew.vout[0].nValue >= nOutputValue)
         {
-            wtxNew.vout[0].nValue -= nMinFee; // Set actual fee
+            txNew.vout[0].nValue -= nMinFee; // Set actual fee
 
-            for (unsigned int i = 0; i < wtxNew.vin.size(); i++) {
+            for (unsigned int i = 0; i < txNew.vin.size(); i++) {
                 const CWalletTx *txin = vwtxPrev[i];
 
                 // Sign all scripts
-                if (!SignSignature(*this, *txin, wtxNew, i))
+                if (!SignSignature(*this, *txin, txNew, i))
                     return false;
             }
 
             // Try to commit, return false on failure
+            CWalletTx wtxNew(this, txNew);
             if (!CommitTransaction(wtxNew, reservekey))
                 return false;
 
@@ -2279,35 +2466,36 @@ bool CWallet::MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const
 
             dWeight = 0;  // Reset all temporary values
             vwtxPrev.clear();
-            wtxNew.SetNull();
-            wtxNew.vout.push_back(CTxOut(0, scriptOutput));
+            txNew = CMutableTransaction();
+            txNew.vout.push_back(CTxOut(0, scriptOutput));
         }
     }
 
     // Create transactions if there are some unhandled coins left
-    if (wtxNew.vout[0].nValue > 0) {
-        int64_t nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION) + wtxNew.vin.size() * 110;
+    if (txNew.vout[0].nValue > 0) {
+        int64_t nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION) + txNew.vin.size() * 110;
 
         double dFinalPriority = dWeight / nBytes;
         bool fAllowFree = CTransaction::AllowFree(dFinalPriority);
 
         // Get actual transaction fee according to its size and priority
-        int64_t nMinFee = wtxNew.GetMinFee(1, fAllowFree, GMF_SEND, nBytes);
+        int64_t nMinFee = CTransaction(txNew).GetMinFee(1, fAllowFree, GMF_SEND, nBytes);
 
-        wtxNew.vout[0].nValue -= nMinFee; // Set actual fee
+        txNew.vout[0].nValue -= nMinFee; // Set actual fee
 
-        if (wtxNew.vout[0].nValue <= 0)
+        if (txNew.vout[0].nValue <= 0)
             return false;
 
-        for (unsigned int i = 0; i < wtxNew.vin.size(); i++) {
+        for (unsigned int i = 0; i < txNew.vin.size(); i++) {
             const CWalletTx *txin = vwtxPrev[i];
 
             // Sign all scripts again
-            if (!SignSignature(*this, *txin, wtxNew, i))
+            if (!SignSignature(*this, *txin, txNew, i))
                 return false;
         }
 
         // Try to commit, return false on failure
+        CWalletTx wtxNew(this, txNew);
         if (!CommitTransaction(wtxNew, reservekey))
             return false;
 
@@ -2317,7 +2505,7 @@ bool CWallet::MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const
     return true;
 }
 
-bool CWallet::CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nGenerationTime, uint32_t nBits, CTransaction &txNew, CKey& key)
+bool CWallet::CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nGenerationTime, uint32_t nBits, CTransaction &txCoinStake, CKey& key)
 {
     CWalletTx wtx;
     if (!GetTransaction(hashTx, wtx))
@@ -2361,8 +2549,7 @@ bool CWallet::CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nGenerati
     int64_t nBalance = GetBalance();
     int64_t nCredit = wtx.vout[nOut].nValue;
 
-    txNew.vin.clear();
-    txNew.vout.clear();
+    CMutableTransaction txNew;
 
     // List of constake dependencies
     std::vector<const CWalletTx*> vwtxPrev;
@@ -2456,11 +2643,14 @@ bool CWallet::CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nGenerati
         }
     }
 
-    // Calculate coin age reward
+    // Calculate coin age reward, inputs not in the cache are read from disk
     uint64_t nCoinAge;
-    CTxDB txdb("r");
-    if (!txNew.GetCoinAge(txdb, nCoinAge))
-        return error("CreateCoinStake : failed to calculate coin age\n");
+    if (!coinAgeCache.GetCoinAge(txNew, nCoinAge))
+    {
+        CTxDB txdb("r");
+        if (!CTransaction(txNew).GetCoinAge(txdb, nCoinAge))
+            return error("CreateCoinStake : failed to calculate coin age\n");
+    }
     nCredit += GetProofOfStakeReward(nCoinAge, nBits, nGenerationTime);
 
     int64_t nMinFee = 0;
@@ -2489,9 +2679,10 @@ bool CWallet::CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nGenerati
             return error("CreateCoinStake : exceeded coinstake size limit\n");
 
         // Check enough fee is paid
-        if (nMinFee < txNew.GetMinFee(1, false, GMF_BLOCK, nBytes) - CENT)
+        int64_t nRequiredFee = CTransaction(txNew).GetMinFee(1, false, GMF_BLOCK, nBytes) - CENT;
+        if (nMinFee < nRequiredFee)
         {
-            nMinFee = txNew.GetMinFee(1, false, GMF_BLOCK, nBytes) - CENT;
+            nMinFee = nRequiredFee;
             continue; // try signing again
         }
         else
@@ -2503,6 +2694,7 @@ bool CWallet::CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nGenerati
     }
 
     // Successfully created coinstake
+    txCoinStake = txNew;
     return true;
 }
 
@@ -3072,6 +3264,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 {
                     pcoin->MarkUnspent(n);
                     pcoin->WriteToDisk();
+                    coinAgeCache.MarkTx(pcoin->GetHash());
                 }
             }
             else if (IsMine(pcoin->vout[n]) && !pcoin->IsSpent(n) && (txindex.vSpent.size() > n && !txindex.vSpent[n].IsNull()))
@@ -3084,6 +3277,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 {
                     pcoin->MarkSpent(n);
                     pcoin->WriteToDisk();
+                    coinAgeCache.MarkTx(pcoin->GetHash());
                 }
             }
 
@@ -3117,6 +3311,7 @@ void CWallet::DisableTransaction(const CTransaction &tx)
             {
                 prev.MarkUnspent(txin.prevout.n);
                 prev.WriteToDisk();
+                coinAgeCache.MarkTx(prev.GetHash());
             }
         }
     }
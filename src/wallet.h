@@ -52,6 +52,71 @@ public:
     )
 };
 
+/** Coin-age inputs of the wallet: value, transaction time and block time of
+ * every output which could be staked, and credit of immature coinstakes.
+ *
+ * Wallet transaction notifications only mark transactions for re-examination,
+ * changes are applied by the next query along with the new best block, if any.
+ * Between changes stake weight, stake and coin age queries are arithmetic over
+ * the cached inputs and don't take cs_wallet.
+ */
+class CCoinAgeCache
+{
+public:
+    struct CInput
+    {
+        COutPoint prevout;
+        int64_t nValue;
+        uint32_t nTime;         // transaction time
+        uint32_t nBlockTime;    // time of the block containing the transaction
+        CBlockIndex *pindex;    // block containing the transaction
+    };
+
+private:
+    CWallet *pwallet;
+
+    CCriticalSection cs_pending;
+    std::set<uint256> setPendingTx;
+    bool fRescan;
+    CBlockIndex *pindexLast;
+
+    CCriticalSection cs_inputs;
+    std::vector<CInput> vInputs;
+    std::map<COutPoint, size_t> mapInputs;  // position in vInputs
+    std::map<uint256, std::pair<CBlockIndex*, int64_t> > mapStake;  // immature coinstakes with their credit
+
+    void EraseInput(std::map<COutPoint, size_t>::iterator it);
+    void UpdateTx(const uint256& hashTx);
+    void Update();
+
+public:
+    CCoinAgeCache(CWallet *pwalletIn) : pwallet(pwalletIn), fRescan(true), pindexLast(NULL) { }
+
+    void MarkTx(const uint256& hashTx)
+    {
+        LOCK(cs_pending);
+        setPendingTx.insert(hashTx);
+    }
+
+    void MarkRescan()
+    {
+        LOCK(cs_pending);
+        fRescan = true;
+    }
+
+    // Combined stake weight of the outputs at nTime, in coin-days
+    uint64_t GetStakeWeight(int64_t nTime);
+
+    // Credit of the coinstakes which are not mature yet
+    int64_t GetStake();
+
+    // Coin age spent by the transaction, as CTransaction::GetCoinAge() computes it.
+    //   Returns false if some of its inputs are not cached.
+    bool GetCoinAge(const CTransaction& tx, uint64_t& nCoinAge);
+
+    size_t GetInputCount();
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -99,6 +164,7 @@ public:
 
     std::map<uint256, CWalletTx> mapWallet;
     std::vector<uint256> vMintingWalletUpdated;
+    mutable CCoinAgeCache coinAgeCache;
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -200,7 +266,8 @@ public:
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
 
     void GetStakeWeightFromValue(const int64_t& nTime, const int64_t& nValue, uint64_t& nWeight);
-    bool CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nTime, uint32_t nBits, CTransaction &txNew, CKey& key);
+    uint64_t GetStakeWeight() const;
+    bool CreateCoinStake(uint256 &hashTx, uint32_t nOut, uint32_t nTime, uint32_t nBits, CTransaction &txCoinStake, CKey& key);
     bool MergeCoins(const int64_t& nAmount, const int64_t& nMinValue, const int64_t& nMaxValue, std::list<uint256>& listMerged);
 
     std::string SendMoney(CScript scriptPubKey, int64_t nValue, CWalletTx& wtxNew, bool fAskFee=false);